@@ -0,0 +1,223 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <benchmark/benchmark.h>
+#include <beholder/beholder.h>
+#include <beholder/message_urls.h>
+#include <beholder/scan_source.h>
+#include <CxxUrl/url.hpp>
+#include <filesystem>
+#include <set>
+
+/**
+ * @brief URL extraction micro-benchmark: message_urls against the per-token code
+ * on_message_create used before it.
+ */
+
+namespace {
+
+	/**
+	 * @brief The extraction on_message_create did before message_urls, kept as the baseline
+	 */
+	std::vector<dpp::attachment> tokenised_extract(const dpp::message& msg) {
+		std::vector<dpp::attachment> found;
+
+		/* Split the message by spaces and newlines */
+		std::vector<std::string> parts = dpp::utility::tokenize(replace_string(msg.content, "\n", " "), " ");
+
+		/* Check for images in the embeds of the message, if any. Found urls and
+		 * scannable content are appended into the parts vector for scanning as text content.
+		 *
+		 * You might be asking "we do we look in embeds, if we ignore messages from other bots, and embeds can
+		 * only be legally sent by bots?" There are two reasons for this: Firstly, when a user sends a link
+		 * that can be automatically embedded by Discord, such as a YouTube link, an embed is automatically generated
+		 * and associated with the message. The second reason is detecting misbehaviour by selfbots.
+		 */
+		if (msg.embeds.size() > 0) {
+			for (const dpp::embed& embed : msg.embeds) {
+				if (!embed.url.empty()) {
+					parts.emplace_back(embed.url);
+				}
+				if (embed.thumbnail.has_value() && !embed.thumbnail->url.empty()) {
+					parts.emplace_back(embed.thumbnail->url);
+				}
+				if (embed.footer.has_value() && !embed.footer->icon_url.empty()) {
+					parts.emplace_back(embed.footer->icon_url);
+				}
+				if (embed.image.has_value() && !embed.image->url.empty()) {
+					parts.emplace_back(embed.image->url);
+				}
+				if (embed.video.has_value() && !embed.video->url.empty()) {
+					parts.emplace_back(embed.video->url);
+				}
+				if (embed.author.has_value()) {
+					if (!embed.author->icon_url.empty()) {
+						parts.emplace_back(embed.author->icon_url);
+					}
+					if (!embed.author->url.empty()) {
+						parts.emplace_back(embed.author->url);
+					}
+				}
+				auto spaced = dpp::utility::tokenize(replace_string(embed.description, "\n", " "), " ");
+				if (!spaced.empty()) {
+					parts.insert(parts.end(), spaced.begin(), spaced.end());
+				}
+				for (const dpp::embed_field& field : embed.fields) {
+					auto spaced = dpp::utility::tokenize(replace_string(field.value, "\n", " "), " ");
+					if (!spaced.empty()) {
+						parts.insert(parts.end(), spaced.begin(), spaced.end());
+					}
+				}
+			}
+		}
+
+		/* Extract sticker urls, if any stickers are in the image */
+		if (msg.stickers.size() > 0) {
+			for (const dpp::sticker& sticker : msg.stickers) {
+				if (!sticker.id.empty()) {
+					parts.emplace_back(sticker.get_url());
+				}
+			}
+		}
+
+		std::set<std::string> seen_urls;
+		/* Check each word in the message looking for URLs */
+		for (std::string& possibly_url : parts) {
+			std::string original_url = possibly_url;
+			possibly_url = dpp::lowercase(possibly_url);
+
+			size_t url_pos = possibly_url.find("<http");
+			size_t offset = 1;
+			char closing_wrapper = '>';
+
+			if (url_pos == std::string::npos) {
+				url_pos = possibly_url.find("[http");
+				offset = 1;
+				closing_wrapper = ']';
+			}
+
+			if (url_pos == std::string::npos) {
+				url_pos = possibly_url.find("http");
+				offset = 0;
+				closing_wrapper = '\0';
+			}
+
+			if (url_pos == std::string::npos) {
+				continue;
+			}
+
+			possibly_url = possibly_url.substr(url_pos + offset);
+			original_url = original_url.substr(url_pos + offset);
+
+			if (closing_wrapper != '\0') {
+				size_t wrapper_end = possibly_url.find(closing_wrapper);
+
+				if (wrapper_end != std::string::npos) {
+					possibly_url = possibly_url.substr(0, wrapper_end);
+					original_url = original_url.substr(0, wrapper_end);
+				}
+			}
+
+			if (!seen_urls.insert(original_url).second) {
+				continue;
+			}
+
+			dpp::attachment attach(const_cast<dpp::message*>(&msg));
+			attach.url = original_url;
+
+			try {
+				Url u(original_url);
+				attach.filename = std::filesystem::path(u.path()).filename();
+			}
+			catch (const std::exception&) {
+				attach.filename = std::filesystem::path(original_url).filename();
+			}
+
+			found.emplace_back(attach);
+		}
+		return found;
+	}
+
+	std::vector<scan_source> single_pass_extract(const dpp::message& msg) {
+		std::vector<scan_source> found;
+		const message_urls::found links = message_urls::extract(msg);
+		for (std::string_view url : links.urls) {
+			found.emplace_back(url, nullptr);
+		}
+		return found;
+	}
+
+	dpp::message chat_message() {
+		dpp::message msg;
+		msg.content = "hey everyone, check this out\n"
+			"https://cdn.discordapp.com/attachments/123456789012345678/987654321098765432/image.png?ex=65f1&is=65de&hm=abcdef\n"
+			"also <https://tenor.com/view/cat-dancing-gif-12345> and [this one](https://i.imgur.com/abc123.gif) lol, "
+			"it was posted on HTTPS://Example.com/Path/To/Picture.JPG yesterday. no more links in the rest of this "
+			"sentence, which just goes on for a while so that the scanner has some ordinary text to walk over.";
+		dpp::embed embed;
+		embed.url = "https://tenor.com/view/cat-dancing-gif-12345";
+		embed.image = dpp::embed_image{ .url = "https://media.tenor.com/abcdef/AAAAC/cat-dancing.gif" };
+		embed.description = "A cat, dancing. Source: https://example.org/cats/dancing.html";
+		embed.fields.push_back({ .name = "Link", .value = "https://i.imgur.com/abc123.gif" });
+		msg.embeds.push_back(embed);
+		return msg;
+	}
+
+	dpp::message plain_message() {
+		dpp::message msg;
+		msg.content = "just a normal message without anything interesting in it, the kind most messages are, "
+			"with a few hundred characters of chat and no links at all so nothing is extracted from it.";
+		return msg;
+	}
+
+	void BM_tokenised_links(benchmark::State& state) {
+		const dpp::message msg = chat_message();
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(tokenised_extract(msg));
+		}
+	}
+
+	void BM_single_pass_links(benchmark::State& state) {
+		const dpp::message msg = chat_message();
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(single_pass_extract(msg));
+		}
+	}
+
+	void BM_tokenised_plain(benchmark::State& state) {
+		const dpp::message msg = plain_message();
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(tokenised_extract(msg));
+		}
+	}
+
+	void BM_single_pass_plain(benchmark::State& state) {
+		const dpp::message msg = plain_message();
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(single_pass_extract(msg));
+		}
+	}
+}
+
+BENCHMARK(BM_tokenised_links);
+BENCHMARK(BM_single_pass_links);
+BENCHMARK(BM_tokenised_plain);
+BENCHMARK(BM_single_pass_plain);
+
+BENCHMARK_MAIN();
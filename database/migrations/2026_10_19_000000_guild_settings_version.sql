@@ -0,0 +1,91 @@
+--
+-- Per-guild settings version, used by the bot to notice settings changed outside of its
+-- own slash commands (e.g. from the dashboard) and refresh its cached copy of them.
+--
+-- Every insert, update or delete on a settings table bumps the guild's version through
+-- the triggers below, so nothing else needs to write to this table.
+--
+
+CREATE TABLE IF NOT EXISTS guild_settings_version (
+  guild_id bigint UNSIGNED NOT NULL COMMENT 'PK Guild ID',
+  version bigint UNSIGNED NOT NULL DEFAULT '1' COMMENT 'Incremented on every settings change',
+  updated_at timestamp(6) NOT NULL DEFAULT CURRENT_TIMESTAMP(6) ON UPDATE CURRENT_TIMESTAMP(6) COMMENT 'Time of the last change',
+  PRIMARY KEY (guild_id),
+  KEY updated_at (updated_at)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COLLATE=utf8mb4_0900_ai_ci COMMENT='Per-guild settings change counter';
+
+DELIMITER $$
+
+DROP TRIGGER IF EXISTS guild_config_insert_version$$
+CREATE TRIGGER guild_config_insert_version AFTER INSERT ON guild_config FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_config_update_version$$
+CREATE TRIGGER guild_config_update_version AFTER UPDATE ON guild_config FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_config_delete_version$$
+CREATE TRIGGER guild_config_delete_version AFTER DELETE ON guild_config FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS channel_settings_insert_version$$
+CREATE TRIGGER channel_settings_insert_version AFTER INSERT ON channel_settings FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS channel_settings_update_version$$
+CREATE TRIGGER channel_settings_update_version AFTER UPDATE ON channel_settings FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS channel_settings_delete_version$$
+CREATE TRIGGER channel_settings_delete_version AFTER DELETE ON channel_settings FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_patterns_insert_version$$
+CREATE TRIGGER guild_patterns_insert_version AFTER INSERT ON guild_patterns FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_patterns_update_version$$
+CREATE TRIGGER guild_patterns_update_version AFTER UPDATE ON guild_patterns FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_patterns_delete_version$$
+CREATE TRIGGER guild_patterns_delete_version AFTER DELETE ON guild_patterns FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_ignored_channels_insert_version$$
+CREATE TRIGGER guild_ignored_channels_insert_version AFTER INSERT ON guild_ignored_channels FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_ignored_channels_update_version$$
+CREATE TRIGGER guild_ignored_channels_update_version AFTER UPDATE ON guild_ignored_channels FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_ignored_channels_delete_version$$
+CREATE TRIGGER guild_ignored_channels_delete_version AFTER DELETE ON guild_ignored_channels FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_bypass_roles_insert_version$$
+CREATE TRIGGER guild_bypass_roles_insert_version AFTER INSERT ON guild_bypass_roles FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_bypass_roles_update_version$$
+CREATE TRIGGER guild_bypass_roles_update_version AFTER UPDATE ON guild_bypass_roles FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS guild_bypass_roles_delete_version$$
+CREATE TRIGGER guild_bypass_roles_delete_version AFTER DELETE ON guild_bypass_roles FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS premium_credits_insert_version$$
+CREATE TRIGGER premium_credits_insert_version AFTER INSERT ON premium_credits FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS premium_credits_update_version$$
+CREATE TRIGGER premium_credits_update_version AFTER UPDATE ON premium_credits FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (NEW.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DROP TRIGGER IF EXISTS premium_credits_delete_version$$
+CREATE TRIGGER premium_credits_delete_version AFTER DELETE ON premium_credits FOR EACH ROW
+  INSERT INTO guild_settings_version (guild_id) VALUES (OLD.guild_id) ON DUPLICATE KEY UPDATE version = version + 1$$
+
+DELIMITER ;
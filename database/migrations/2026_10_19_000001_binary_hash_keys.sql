@@ -0,0 +1,57 @@
+--
+-- Store image hashes as 32 byte BINARY keys instead of 64 character hex strings, halving
+-- the size of the primary key indexes, and add last_hit to the scan cache tables so cold
+-- rows can be expired.
+--
+-- Stop the bot before running this. Each table is copied into a new table with the new
+-- key and swapped in with RENAME, and a row written between the copy and the rename would
+-- be lost. The block list copy is also made under a write lock, so even if something does
+-- write to it, no block is lost. Rows whose hash is not valid hex are dropped. Needs
+-- MySQL 8.0.13 or later, for RENAME TABLE under LOCK TABLES.
+--
+
+-- scan_cache
+
+DROP TABLE IF EXISTS scan_cache_binary;
+CREATE TABLE scan_cache_binary LIKE scan_cache;
+ALTER TABLE scan_cache_binary
+  MODIFY hash binary(32) NOT NULL COMMENT 'SHA256 of image content',
+  ADD COLUMN last_hit timestamp NOT NULL DEFAULT CURRENT_TIMESTAMP COMMENT 'Last time the entry was read or written',
+  ADD KEY last_hit (last_hit);
+
+INSERT IGNORE INTO scan_cache_binary (hash, ocr, cached_at, last_hit)
+  SELECT UNHEX(hash), ocr, cached_at, COALESCE(cached_at, CURRENT_TIMESTAMP) FROM scan_cache WHERE hash REGEXP '^[0-9a-fA-F]{64}$';
+
+RENAME TABLE scan_cache TO scan_cache_hex, scan_cache_binary TO scan_cache;
+DROP TABLE scan_cache_hex;
+
+-- basic_cache
+
+DROP TABLE IF EXISTS basic_cache_binary;
+CREATE TABLE basic_cache_binary LIKE basic_cache;
+ALTER TABLE basic_cache_binary
+  MODIFY hash binary(32) NOT NULL COMMENT 'SHA256 of image content',
+  ADD COLUMN last_hit timestamp NOT NULL DEFAULT CURRENT_TIMESTAMP COMMENT 'Last time the entry was read or written',
+  ADD KEY last_hit (last_hit);
+
+INSERT IGNORE INTO basic_cache_binary (hash, basic)
+  SELECT UNHEX(hash), basic FROM basic_cache WHERE hash REGEXP '^[0-9a-fA-F]{64}$';
+
+RENAME TABLE basic_cache TO basic_cache_hex, basic_cache_binary TO basic_cache;
+DROP TABLE basic_cache_hex;
+
+-- block_list_items
+
+DROP TABLE IF EXISTS block_list_items_binary;
+CREATE TABLE block_list_items_binary LIKE block_list_items;
+ALTER TABLE block_list_items_binary
+  MODIFY hash binary(32) NOT NULL COMMENT 'SHA256 of image content';
+
+LOCK TABLES block_list_items WRITE, block_list_items_binary WRITE;
+
+INSERT IGNORE INTO block_list_items_binary (guild_id, hash)
+  SELECT guild_id, UNHEX(hash) FROM block_list_items WHERE hash REGEXP '^[0-9a-fA-F]{64}$';
+
+RENAME TABLE block_list_items TO block_list_items_hex, block_list_items_binary TO block_list_items;
+UNLOCK TABLES;
+DROP TABLE block_list_items_hex;
@@ -0,0 +1,7 @@
+--
+-- Guild patterns can be regular expressions as well as wildcard patterns. Existing
+-- patterns are all wildcards.
+--
+
+ALTER TABLE guild_patterns
+  ADD COLUMN pattern_type enum('glob','regex') NOT NULL DEFAULT 'glob' COMMENT 'glob: * and ? wildcards, regex: regular expression' AFTER pattern;
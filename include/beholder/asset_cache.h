@@ -0,0 +1,91 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <beholder/url_cache.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Scan results for stickers and custom emoji, keyed by their Discord ID and file type.
+ *
+ * The image behind a sticker or emoji ID never changes, so unlike url_cache entries do
+ * not expire with time. The same ID is served as a static .png and an animated .gif, so
+ * the extension is part of the key, and URLs with a query such as ?size= are not cached. Each entry keeps the content hash and the last verdict for each
+ * guild and channel it was used in. A verdict is only reused while the guild's settings
+ * version is the one it was produced under; a newer version replaces it.
+ */
+namespace asset_cache {
+
+	/**
+	 * @brief A cached sticker or emoji
+	 */
+	struct entry {
+		std::string hash;
+		std::vector<url_cache::verdict> verdicts;
+
+		/**
+		 * @brief Find the verdict for a channel under a settings version
+		 *
+		 * @return verdict, or nullptr if there is none for this channel and version
+		 */
+		const url_cache::verdict* find(dpp::snowflake guild_id, dpp::snowflake channel_id, uint64_t settings_version) const;
+	};
+
+	/**
+	 * @brief Get the cache key of a sticker or custom emoji from its Discord CDN URL,
+	 * its kind, ID and extension such as "emojis/123.gif"
+	 *
+	 * @param url image URL
+	 * @return key, or std::nullopt if the URL is not a sticker or emoji image, or has a query
+	 */
+	std::optional<std::string> asset_key(const std::string& url);
+
+	/**
+	 * @brief Look up a sticker or emoji
+	 *
+	 * @param key key from asset_key()
+	 * @return entry, or std::nullopt if it has not been scanned
+	 */
+	std::optional<entry> get(const std::string& key);
+
+	/**
+	 * @brief Record the hash of a sticker or emoji image
+	 *
+	 * @param key key from asset_key()
+	 * @param hash content hash
+	 */
+	void store_hash(const std::string& key, const std::string& hash);
+
+	/**
+	 * @brief Record the result of scanning a sticker or emoji
+	 *
+	 * @param key key from asset_key()
+	 * @param hash content hash
+	 * @param result scan response and settings
+	 */
+	void store_verdict(const std::string& key, const std::string& hash, const url_cache::verdict& result);
+
+	/**
+	 * @brief Number of cached stickers and emoji
+	 */
+	size_t size();
+};
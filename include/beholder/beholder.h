@@ -19,6 +19,7 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/dpp.h>
+#include <beholder/scan_source.h>
 #include <atomic>
 #include <cstdint>
 
@@ -29,6 +30,11 @@ namespace fs = std::filesystem;
 constexpr size_t max_size = 64 * 1024 * 1024;
 constexpr int max_concurrency = 48;
 
+/**
+ * @brief Most images one tessd process fetches and scans for a message
+ */
+constexpr size_t max_batch_items = 10;
+
 namespace colours {
 	constexpr uint32_t bad = 0xff7a7a;
 	constexpr uint32_t good = 0x7aff7a;
@@ -49,12 +55,6 @@ struct premium_scan_config {
 	std::vector<std::string> languages;
 };
 
-#define INCREMENT_STATISTIC(STAT_NAME, GUILD_ID) \
-		db::query("INSERT INTO guild_statistics (guild_id, stat_date, " STAT_NAME ") VALUES(?,NOW(),1) ON DUPLICATE KEY UPDATE " STAT_NAME " = " STAT_NAME " + 1", { GUILD_ID });
-
-#define INCREMENT_STATISTIC2(STAT_NAME1, STAT_NAME2, GUILD_ID) \
-		db::query("INSERT INTO guild_statistics (guild_id, stat_date, " STAT_NAME1 ", " STAT_NAME2 ") VALUES(?,NOW(),1,1) ON DUPLICATE KEY UPDATE " STAT_NAME1 " = " STAT_NAME1 " + 1, " STAT_NAME2 " = " STAT_NAME2 " + 1", { GUILD_ID });
-
 using json = dpp::json;
 
 bool match(const char* str, const char* mask);
@@ -86,23 +86,45 @@ inline std::string trim(std::string s)
 }
 
 /**
- * @brief Processes an attachment into text, then checks to see if it matches a certain pattern. If it matches then it called delete_message_and_warn.
- * @param attach The attachment to process into text.
+ * @brief Processes the images of a message into text, then checks to see if they match a certain pattern. If one matches then it calls delete_message_and_warn.
+ * The images are scanned together by one tessd process, which stops once the message is deleted.
+ * @param sources The images to process into text, all from the same message.
  * @param bot Bot reference.
- * @param ev message_create_t reference.
  */
-void download_image(const dpp::attachment attach, dpp::cluster& bot, const dpp::message_create_t ev);
+void download_images(std::vector<scan_source> sources, dpp::cluster& bot);
 
 /**
  * @brief Delete a message and send a warning.
  * @param bot Bot reference.
- * @param ev message_create_t reference.
- * @param attach The attachment that was flagged as bad.
+ * @param source The image that was flagged as bad, and the message it came from.
  * @param text What the attachment was flagged for.
- * @param trigger premium trigger threshold
  */
-bool delete_message_and_warn(std::string hash, std::string image, dpp::cluster& bot, const dpp::message_create_t ev, const dpp::attachment attach, const std::string text);
+bool delete_message_and_warn(const std::string& hash, const std::string& image, dpp::cluster& bot, const scan_source& source, const std::string& text);
+
+/**
+ * @brief Check if delete_message_and_warn has already deleted, or tried to delete, a message.
+ * @param message_id Message ID.
+ * @return true if it has, so there is no need to scan the rest of the message.
+ */
+bool message_delete_attempted(dpp::snowflake message_id);
 
 std::string replace_string(std::string subject, const std::string& search, const std::string& replace);
 
+/**
+ * @brief Convert a database value to a double, returning 0 if it is not a number
+ */
+double safe_stod(const std::string& s);
+
+/**
+ * @brief Convert a database tinyint to a bool
+ * @param value column value
+ * @param fallback value to use if the column is NULL
+ */
+bool db_bool(const std::string& value, bool fallback);
+
+/**
+ * @brief Parse a JSON array of language codes, as stored in guild_config.prem_languages
+ */
+std::vector<std::string> parse_language_list(const std::string& value);
+
 std::string sha256(const std::string &buffer);
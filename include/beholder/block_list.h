@@ -0,0 +1,73 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <string>
+
+/**
+ * @brief In-memory copy of block_list_items.
+ *
+ * Entries are kept as a sorted array of guild ID and binary SHA-256 pairs, so checking
+ * an image is a binary search rather than a query. The bot's own changes are applied as
+ * they are made; reload() picks up changes made elsewhere, such as the dashboard.
+ *
+ * Until the first load() completes, and for hashes which are not SHA-256, contains()
+ * falls back to querying the database.
+ */
+namespace block_list {
+
+	/**
+	 * @brief Load the whole table, replacing the in-memory copy. Runs queries, so call
+	 * it from a database worker.
+	 */
+	void load();
+
+	/**
+	 * @brief Check if an image is on a guild's block list
+	 *
+	 * @param guild_id guild ID
+	 * @param hash image hash
+	 * @return true if blocked
+	 */
+	bool contains(dpp::snowflake guild_id, const std::string& hash);
+
+	/**
+	 * @brief Record that an image was added to a guild's block list.
+	 * Call after the row has been written.
+	 *
+	 * @param guild_id guild ID
+	 * @param hash image hash
+	 */
+	void add(dpp::snowflake guild_id, const std::string& hash);
+
+	/**
+	 * @brief Record that an image was removed from a guild's block list.
+	 * Call after the row has been deleted.
+	 *
+	 * @param guild_id guild ID
+	 * @param hash image hash
+	 */
+	void remove(dpp::snowflake guild_id, const std::string& hash);
+
+	/**
+	 * @brief Number of entries held in memory
+	 */
+	size_t size();
+};
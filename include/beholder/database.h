@@ -18,10 +18,14 @@
  *
  ************************************************************************************/
 #pragma once
+#include <dpp/dpp.h>
+#include <beholder/database_result.h>
+#include <functional>
 #include <vector>
 #include <map>
 #include <string>
 #include <variant>
+#include <cstdint>
 
 /**
  * @brief Database abstraction layer
@@ -30,19 +34,19 @@
 namespace db {
 
 	/**
-	 * @brief Definition of a row in a result set
+	 * @brief A binary string parameter, bound as a BLOB rather than as text in the
+	 * connection's character set. Used for BINARY columns.
 	 */
-	using row = std::map<std::string, std::string>;
+	struct binary {
+		std::string bytes;
 
-	/**
-	 * @brief Definition of a result set, a vector of maps
-	 */
-	using resultset = std::vector<row>;
+		bool operator==(const binary&) const = default;
+	};
 
 	/**
 	 * @brief Possible parameter types for SQL parameters
 	 */
-	using parameter_type = std::variant<float, std::string, uint64_t, int64_t, bool, int32_t, uint32_t, double>;
+	using parameter_type = std::variant<float, std::string, uint64_t, int64_t, bool, int32_t, uint32_t, double, binary>;
 
 	/**
 	 * @brief A list of database query parameters.
@@ -51,26 +55,120 @@ namespace db {
 	using paramlist = std::vector<parameter_type>;
 
 	/**
-	 * @brief Initialise database connection
+	 * @brief Completion callback for query_async()
+	 * 
+	 * @param results Query results
+	 * @param error Error string, empty on success
+	 */
+	using query_callback = std::function<void(const resultset& results, const std::string& error)>;
+
+	/**
+	 * @brief Outcome of a query run by co_query
+	 */
+	struct query_result {
+		/**
+		 * @brief Query results
+		 */
+		resultset rows;
+
+		/**
+		 * @brief Error string, empty on success
+		 */
+		std::string error;
+
+		/**
+		 * @brief Rows affected by an INSERT, UPDATE or DELETE
+		 */
+		size_t affected_rows{0};
+	};
+
+	/**
+	 * @brief Connection pool statistics
+	 */
+	struct pool_statistics {
+		/**
+		 * @brief Number of pooled connections
+		 */
+		size_t size{0};
+
+		/**
+		 * @brief Connections not currently checked out
+		 */
+		size_t idle{0};
+
+		/**
+		 * @brief Total checkouts, one per query outside a transaction
+		 */
+		uint64_t checkouts{0};
+
+		/**
+		 * @brief Checkouts which had to wait for a connection to be returned
+		 */
+		uint64_t waits{0};
+
+		/**
+		 * @brief Total time spent waiting for a connection
+		 */
+		double total_wait_ms{0};
+
+		/**
+		 * @brief Longest single wait for a connection
+		 */
+		double max_wait_ms{0};
+	};
+
+	/**
+	 * @brief Statistics for the resultset cache used by query() with a lifetime
+	 */
+	struct result_cache_statistics {
+		/**
+		 * @brief Number of cached resultsets
+		 */
+		size_t entries{0};
+
+		/**
+		 * @brief Estimated memory used by cached resultsets
+		 */
+		size_t bytes{0};
+
+		/**
+		 * @brief Memory limit, least recently used resultsets are evicted above this
+		 */
+		size_t limit{0};
+
+		uint64_t hits{0};
+		uint64_t misses{0};
+
+		/**
+		 * @brief Resultsets evicted to stay within the memory limit
+		 */
+		uint64_t evictions{0};
+	};
+
+	/**
+	 * @brief Initialise database connection pool and start one worker thread per connection.
+	 * The number of connections is taken from "pool_size" in the database
+	 * section of the config file, defaulting to 8. The resultset cache limit is taken
+	 * from "result_cache_bytes", defaulting to 32MB.
 	 * 
 	 * @param bot creating D++ cluster
 	 */
 	void init (dpp::cluster& bot);
 
 	/**
-	 * @brief Connect to database and set options
+	 * @brief Connect the connection pool to the database and set options
 	 * 
 	 * @param host Database hostname
 	 * @param user Database username
 	 * @param pass Database password
 	 * @param db Database schema name
 	 * @param port Databae port number
-	 * @return True if the database connection succeeded
+	 * @return True if every pooled connection succeeded
 	 */
 	bool connect(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, int port = 3306);
 
 	/**
-	 * @brief Disconnect from database and free query cache
+	 * @brief Finish queued background work, then disconnect all pooled connections and free their query caches
 	 * 
 	 * @return true on successful disconnection
 	 */
@@ -96,6 +194,19 @@ namespace db {
 	 */
 	resultset query(const std::string &format, const paramlist &parameters = {});
 
+	/**
+	 * @brief Run a mysql query, returning a columnar result.
+	 * 
+	 * This takes the same format and parameters as query(), but avoids building a map for
+	 * every row, and integer and floating point columns are fetched in binary. Prefer it
+	 * on hot paths and for larger results.
+	 * 
+	 * @param format Format string, where each parameter should be indicated by a ? symbol
+	 * @param parameters Parameters to prepare into the query in place of the ?'s
+	 * @return result columnar result
+	 */
+	result execute(const std::string &format, const paramlist &parameters = {});
+
 	/**
 	 * @brief Run a mysql query, with automatic escaping of parameters to prevent SQL injection.
 	 * 
@@ -104,7 +215,8 @@ namespace db {
 	 * @param lifetime How long to cache this query's resultset in memory for
 	 * 
 	 * @note If the query is already cached in memory, the cached resultset will be returned instead
-	 * of querying the database.
+	 * of querying the database. The cache is bounded by "result_cache_bytes" in the database config,
+	 * evicting the least recently used resultsets, and failed queries are not cached.
 	 * 
 	 * The parameters given should be a vector of strings. You can instantiate this using "{}".
 	 * The queries are cached as prepared statements and therefore do not need quote symbols
@@ -120,10 +232,46 @@ namespace db {
 	 */
 	resultset query(const std::string &format, const paramlist &parameters, double lifetime);
 
+	/**
+	 * @brief Run a query on a database worker thread, without blocking the caller.
+	 * 
+	 * @param format Format string, where each parameter should be indicated by a ? symbol
+	 * @param parameters Parameters to prepare into the query in place of the ?'s
+	 * @param callback Called on the worker thread with the results. db::error() and
+	 * db::affected_rows() are valid inside the callback.
+	 */
+	void query_async(const std::string &format, const paramlist &parameters, query_callback callback);
+
+	/**
+	 * @brief Run a query on a database worker thread, as an awaitable.
+	 * 
+	 * The query starts immediately, so several can be started before the first is awaited
+	 * to run them in parallel. The awaiting coroutine may resume on the worker thread or,
+	 * if the query had already finished, on its own thread, so db::error() and
+	 * db::affected_rows() must not be used afterwards. The result carries both instead.
+	 * 
+	 * ```cpp
+	 * 	db::query_result result = co_await db::co_query("SELECT * FROM foo WHERE id = ?", { 3 });
+	 * ```
+	 * 
+	 * @param format Format string, where each parameter should be indicated by a ? symbol
+	 * @param parameters Parameters to prepare into the query in place of the ?'s
+	 * @return dpp::async<query_result> awaitable results, error and affected row count
+	 */
+	dpp::async<query_result> co_query(const std::string &format, const paramlist &parameters = {});
+
+	/**
+	 * @brief Run arbitrary work on a database worker thread. Use this to move a group of
+	 * dependent db::query() calls off a thread which must not block.
+	 * 
+	 * @param work Work to run. If the worker threads are not running yet, it runs immediately.
+	 */
+	void background(std::function<void()> work);
+
 	/**
 	 * @brief Returns number of affected rows from an UPDATE, INSERT, DELETE
 	 * 
-	 * @note This value is by any db::query() call. Take a copy!
+	 * @note This value is per-thread and is replaced by the calling thread's next db::query() call.
 	 * @return size_t Number of affected rows
 	 */
 	size_t affected_rows();
@@ -131,17 +279,35 @@ namespace db {
 	/**
 	 * @brief Returns the last error string.
 	 * 
-	 * @note This value is by any db::query() call. Take a copy!
+	 * @note This value is per-thread and is replaced by the calling thread's next db::query() call. Take a copy!
 	 * @return const std::string& Error mesage
 	 */
 	const std::string& error();
 
+	/**
+	 * @brief Convert a hex SHA-256 image hash into the key stored in BINARY(32) hash
+	 * columns, such as scan_cache.hash and block_list_items.hash
+	 * 
+	 * @param hash hex hash
+	 * @return binary parameter. Text which is not hex is passed through unchanged, and matches no rows.
+	 */
+	binary hash_key(std::string_view hash);
+
+	/**
+	 * @brief Convert a BINARY(32) hash column back into a hex hash
+	 * 
+	 * @param key column value
+	 * @return hex hash
+	 */
+	std::string hash_hex(std::string_view key);
+
 	/**
 	 * @brief Returns the size of the query cache
 	 * 
 	 * Prepared statement handles are stored in a std::map along with their metadata, so that
-	 * they don't have to be re-prepared if they are executed repeatedly. This is a diagnostic
-	 * and informational function which returns the size of that map.
+	 * they don't have to be re-prepared if they are executed repeatedly. Each pooled connection
+	 * has its own map. This is a diagnostic and informational function which returns the total
+	 * size of those maps.
 	 * 
 	 * @return size_t Cache size
 	 */
@@ -154,9 +320,26 @@ namespace db {
 	 */
 	size_t query_count();
 
+	/**
+	 * @brief Returns statistics for the resultset cache
+	 * 
+	 * @return result_cache_statistics statistics
+	 */
+	result_cache_statistics result_cache_stats();
+
+	/**
+	 * @brief Returns statistics for the connection pool
+	 * 
+	 * @return pool_statistics statistics
+	 */
+	pool_statistics pool_stats();
+
 	/**
 	 * @brief Start a transaction
 	 * 
+	 * @note The calling thread keeps one pooled connection until it calls commit() or
+	 * rollback(), and all of its queries in between run inside the transaction. Always
+	 * end a transaction on the thread which started it.
 	 * @return true if transaction was started
 	 */
 	bool transaction();
@@ -0,0 +1,192 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace db {
+
+	/**
+	 * @brief Definition of a row in a result set
+	 */
+	using row = std::map<std::string, std::string>;
+
+	/**
+	 * @brief Definition of a result set, a vector of maps
+	 */
+	using resultset = std::vector<row>;
+
+	/**
+	 * @brief A columnar query result.
+	 *
+	 * Column names are stored once, and every value's text lives in one contiguous
+	 * buffer. Integer and floating point columns are fetched from MySQL in their native
+	 * binary form, so get<uint64_t>() and get<double>() on them do no parsing.
+	 *
+	 * ```cpp
+	 * 	db::result rows = db::execute("SELECT id, name FROM foo WHERE bar = ?", { 3 });
+	 * 	size_t name = rows.column("name");
+	 * 	for (size_t r = 0; r < rows.size(); ++r) {
+	 * 		uint64_t id = rows.get<uint64_t>(r, "id");
+	 * 		std::string_view text = rows.get<std::string_view>(r, name);
+	 * 	}
+	 * ```
+	 *
+	 * String views returned from a result are valid for as long as the result is.
+	 * SQL NULL reads as an empty string or zero, as it does in a db::row.
+	 */
+	class result {
+	public:
+		/**
+		 * @brief Number of rows
+		 */
+		size_t size() const {
+			return names.empty() ? 0 : cells.size() / names.size();
+		}
+
+		/**
+		 * @brief True if there are no rows
+		 */
+		bool empty() const {
+			return size() == 0;
+		}
+
+		/**
+		 * @brief Column names, in SELECT order
+		 */
+		const std::vector<std::string>& columns() const {
+			return names;
+		}
+
+		/**
+		 * @brief Find a column by name
+		 *
+		 * @param name column name
+		 * @return column index
+		 * @throw std::out_of_range if there is no such column
+		 */
+		size_t column(std::string_view name) const;
+
+		/**
+		 * @brief True if a value is SQL NULL
+		 */
+		bool is_null(size_t row, size_t column) const;
+
+		/**
+		 * @brief Get a value. T may be std::string_view, std::string, bool, any
+		 * integer or floating point type, or a type constructible from uint64_t
+		 * such as dpp::snowflake.
+		 *
+		 * @param row row index
+		 * @param column column index
+		 * @return value
+		 */
+		template<typename T> T get(size_t row, size_t column) const {
+			if constexpr (std::is_same_v<T, std::string_view>) {
+				return text(row, column);
+			} else if constexpr (std::is_same_v<T, std::string>) {
+				return std::string(text(row, column));
+			} else if constexpr (std::is_same_v<T, bool>) {
+				return get_int64(row, column) != 0;
+			} else if constexpr (std::is_floating_point_v<T>) {
+				return static_cast<T>(get_double(row, column));
+			} else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+				return static_cast<T>(get_int64(row, column));
+			} else if constexpr (std::is_integral_v<T>) {
+				return static_cast<T>(get_uint64(row, column));
+			} else {
+				return T(get_uint64(row, column));
+			}
+		}
+
+		/**
+		 * @brief Get a value by column name
+		 */
+		template<typename T> T get(size_t row, std::string_view column_name) const {
+			return get<T>(row, column(column_name));
+		}
+
+		/**
+		 * @brief Convert to the map based resultset, for callers which have not moved
+		 * to the columnar interface
+		 */
+		resultset to_resultset() const;
+
+		/**
+		 * @brief Set the column names. Used by db::execute() while building the result.
+		 */
+		void set_columns(std::vector<std::string> column_names);
+
+		/**
+		 * @brief Reserve space for rows and text. Used by db::execute() while building the result.
+		 */
+		void reserve(size_t rows, size_t text_bytes);
+
+		/**
+		 * @brief Append the next value, filling rows left to right.
+		 * Used by db::execute() while building the result.
+		 * @{
+		 */
+		void add_null();
+		void add_text(std::string_view value);
+		void add_int64(int64_t value);
+		void add_uint64(uint64_t value);
+		void add_double(double value);
+		/** @} */
+
+	private:
+		enum class cell_type : uint8_t {
+			null_value,
+			text_value,
+			int64_value,
+			uint64_value,
+			double_value,
+		};
+
+		/**
+		 * @brief One value: where its text is in the arena, and its native value for numbers
+		 */
+		struct cell {
+			uint32_t offset{0};
+			uint32_t length{0};
+			cell_type type{cell_type::null_value};
+			union {
+				int64_t i;
+				uint64_t u;
+				double d;
+			} native{};
+		};
+
+		std::vector<std::string> names;
+		std::vector<cell> cells;
+		std::string arena;
+
+		const cell& at(size_t row, size_t column) const;
+		std::string_view text(size_t row, size_t column) const;
+		int64_t get_int64(size_t row, size_t column) const;
+		uint64_t get_uint64(size_t row, size_t column) const;
+		double get_double(size_t row, size_t column) const;
+		void append_text(cell& c, std::string_view value);
+	};
+};
@@ -0,0 +1,218 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <beholder/beholder.h>
+#include <beholder/regex_set.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief In-memory copy of each guild's configuration.
+ *
+ * A snapshot holds everything the scanning paths need from guild_config, channel_settings,
+ * guild_patterns, guild_ignored_channels, guild_bypass_roles and premium_credits. Snapshots
+ * are immutable once published, so callers can keep the shared pointer for as long as they
+ * need it and read it without locking.
+ *
+ * Slash commands which change settings call invalidate(). Changes made through the dashboard
+ * bump the guild's row in guild_settings_version, which poll_changes() picks up.
+ */
+namespace guild_settings {
+
+	/**
+	 * @brief A row of channel_settings. Channel ID 0 holds the guild wide defaults.
+	 */
+	struct channel_settings {
+		bool warn{false};
+		uint8_t action{act_nothing};
+		uint64_t silence_length{0};
+		uint64_t ban_length{0};
+		double basic_nsfw_suggestive{0};
+		double basic_nsfw_porn{0};
+		double basic_nsfw_drawing{0};
+		double basic_nsfw_hentai{0};
+		bool prem_profanity_filter_enable{false};
+		bool prem_anim_scan_enable{true};
+		bool prem_video_scan_enable{true};
+	};
+
+	/**
+	 * @brief An OCR pattern, either for one channel or for the whole guild
+	 */
+	struct pattern {
+		/**
+		 * @brief Pattern text, normalised by pattern_matcher::normalise() and never empty
+		 */
+		std::string text;
+
+		/**
+		 * @brief Channel the pattern applies to, empty for all channels
+		 */
+		dpp::snowflake channel_id;
+
+		/**
+		 * @brief True if the pattern is a regular expression rather than a wildcard pattern
+		 */
+		bool is_regex{false};
+	};
+
+	/**
+	 * @brief Settings for one guild
+	 */
+	struct snapshot {
+		dpp::snowflake guild_id;
+
+		/**
+		 * @brief Value of guild_settings_version.version when this snapshot was loaded
+		 */
+		uint64_t version{0};
+
+		/**
+		 * @brief When the snapshot was loaded
+		 */
+		time_t loaded_at{0};
+
+		/**
+		 * @brief True if the guild has a guild_config row
+		 */
+		bool has_config{false};
+
+		dpp::snowflake log_channel;
+		bool embeds_disabled{false};
+		std::string embed_title;
+		std::string embed_body;
+		std::vector<std::string> languages;
+
+		/**
+		 * @brief True if the guild has an active premium credit
+		 */
+		bool premium{false};
+
+		std::unordered_set<dpp::snowflake> ignored_channels;
+		std::vector<dpp::snowflake> bypass_roles;
+
+		/**
+		 * @brief channel_settings rows by channel ID
+		 */
+		std::unordered_map<dpp::snowflake, channel_settings> channels;
+
+		std::vector<pattern> patterns;
+
+		/**
+		 * @brief The regular expression patterns, compiled together, in the order they
+		 * appear in patterns. Null if the guild has none.
+		 */
+		std::shared_ptr<const regex::regex_set> regexes;
+
+		/**
+		 * @brief Index into patterns of each pattern in regexes
+		 */
+		std::vector<size_t> regex_patterns;
+
+		/**
+		 * @brief Get the settings which apply to a channel. These are the channel's own row
+		 * if it has one, otherwise the guild defaults.
+		 *
+		 * @param channel_id channel ID
+		 * @return channel settings, or nullptr if the guild has no channel_settings rows
+		 */
+		const channel_settings* channel(dpp::snowflake channel_id) const;
+
+		/**
+		 * @brief Get the OCR wildcard patterns for a channel, including the guild wide ones
+		 *
+		 * @param channel_id channel ID
+		 * @return pattern texts
+		 */
+		std::vector<std::string> patterns_for(dpp::snowflake channel_id) const;
+
+		/**
+		 * @brief Check if any regular expression patterns apply to a channel
+		 *
+		 * @param channel_id channel ID
+		 * @return true if OCR text needs checking against regexes
+		 */
+		bool has_regexes_for(dpp::snowflake channel_id) const;
+
+		/**
+		 * @brief Match OCR text against the regular expression patterns for a channel
+		 *
+		 * @param channel_id channel ID
+		 * @param text OCR text
+		 * @return the first pattern which matched, or std::nullopt
+		 */
+		std::optional<std::string> match_regexes(dpp::snowflake channel_id, const std::string& text) const;
+
+		/**
+		 * @brief Check if a member with the given roles bypasses scanning
+		 *
+		 * @param roles the member's roles
+		 * @return true if any of the roles is a bypass role
+		 */
+		bool bypasses(const std::vector<dpp::snowflake>& roles) const;
+	};
+
+	using snapshot_ptr = std::shared_ptr<const snapshot>;
+
+	/**
+	 * @brief Get a guild's settings, loading them from the database if they are not cached.
+	 * A cache miss blocks while the settings load, so call this from a database worker
+	 * or use co_get() in a coroutine.
+	 *
+	 * @param guild_id guild ID
+	 * @return settings snapshot, never null
+	 */
+	snapshot_ptr get(dpp::snowflake guild_id);
+
+	/**
+	 * @brief Get a guild's settings as an awaitable. A cached snapshot is returned
+	 * immediately, otherwise the settings load on a database worker.
+	 *
+	 * @param guild_id guild ID
+	 * @return dpp::async<snapshot_ptr> settings snapshot
+	 */
+	dpp::async<snapshot_ptr> co_get(dpp::snowflake guild_id);
+
+	/**
+	 * @brief Drop a guild's cached settings. The next get() loads them again.
+	 * Call this after changing any of the guild's settings.
+	 *
+	 * @param guild_id guild ID
+	 */
+	void invalidate(dpp::snowflake guild_id);
+
+	/**
+	 * @brief Drop cached settings which have changed in the database since the last
+	 * poll, or which are older than the maximum snapshot age. Run periodically on a
+	 * database worker.
+	 */
+	void poll_changes();
+
+	/**
+	 * @brief Number of cached snapshots
+	 *
+	 * @return size_t cached snapshots
+	 */
+	size_t size();
+};
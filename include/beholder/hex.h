@@ -0,0 +1,93 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Table driven hex encoding, shared by the bot and tessd
+ */
+namespace hex {
+
+	/**
+	 * @brief Encode bytes as lower case hex
+	 *
+	 * @param data bytes
+	 * @param length number of bytes
+	 * @return hex string, twice as long as the input
+	 */
+	inline std::string encode(const unsigned char* data, size_t length) {
+		static constexpr char digits[] = "0123456789abcdef";
+		std::string out(length * 2, '\0');
+		for (size_t index = 0; index < length; ++index) {
+			out[index * 2] = digits[data[index] >> 4];
+			out[index * 2 + 1] = digits[data[index] & 0x0f];
+		}
+		return out;
+	}
+
+	inline std::string encode(std::string_view data) {
+		return encode(reinterpret_cast<const unsigned char*>(data.data()), data.length());
+	}
+
+	namespace detail {
+		constexpr std::array<int8_t, 256> make_decode_table() {
+			std::array<int8_t, 256> table{};
+			for (auto& value : table) {
+				value = -1;
+			}
+			for (int digit = 0; digit < 10; ++digit) {
+				table['0' + digit] = static_cast<int8_t>(digit);
+			}
+			for (int digit = 0; digit < 6; ++digit) {
+				table['a' + digit] = static_cast<int8_t>(10 + digit);
+				table['A' + digit] = static_cast<int8_t>(10 + digit);
+			}
+			return table;
+		}
+
+		inline constexpr std::array<int8_t, 256> decode_table = make_decode_table();
+	};
+
+	/**
+	 * @brief Decode hex into bytes. Upper and lower case digits are accepted.
+	 *
+	 * @param text hex string
+	 * @return bytes, or std::nullopt if the text has an odd length or a non-hex character
+	 */
+	inline std::optional<std::string> decode(std::string_view text) {
+		if (text.length() % 2 != 0) {
+			return std::nullopt;
+		}
+		std::string out(text.length() / 2, '\0');
+		for (size_t index = 0; index < out.length(); ++index) {
+			int8_t high = detail::decode_table[static_cast<uint8_t>(text[index * 2])];
+			int8_t low = detail::decode_table[static_cast<uint8_t>(text[index * 2 + 1])];
+			if (high < 0 || low < 0) {
+				return std::nullopt;
+			}
+			out[index] = static_cast<char>((high << 4) | low);
+		}
+		return out;
+	}
+};
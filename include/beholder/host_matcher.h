@@ -0,0 +1,119 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Matches URLs against a list of host patterns, such as the whitelist and the
+ * trusted media hosts.
+ *
+ * A pattern is "[scheme://]host[/path]". Without a scheme any scheme matches, and without
+ * a path any path matches. A host label of "*" on its own at the start matches one or
+ * more subdomains, so "*.example.com" matches "a.example.com" and "a.b.example.com" but
+ * not "example.com". A '*' inside a label, as in "images-ext-*.discordapp.net", matches
+ * within that label only. A path ending in '*' is a prefix.
+ *
+ * Host patterns are stored in a trie keyed on labels from right to left, so a URL is
+ * classified by walking its host labels once rather than trying every pattern. Hosts
+ * and schemes are compared without regard to case.
+ */
+class host_matcher {
+public:
+	/**
+	 * @brief Compile patterns. Empty patterns are ignored.
+	 *
+	 * @param patterns patterns, in priority order
+	 */
+	explicit host_matcher(const std::vector<std::string>& patterns);
+
+	/**
+	 * @brief Find the pattern which matches a URL
+	 *
+	 * @param url absolute URL, or a scheme and host such as "https://cdn.discordapp.com"
+	 * @return index of the first matching pattern, or std::nullopt if none match
+	 */
+	std::optional<size_t> find(std::string_view url) const;
+
+	/**
+	 * @brief Get a pattern as given
+	 *
+	 * @param index pattern index
+	 * @return pattern
+	 */
+	const std::string& pattern(size_t index) const;
+
+	/**
+	 * @brief Number of patterns
+	 */
+	size_t size() const;
+
+private:
+	struct rule {
+		/**
+		 * @brief Lower case scheme, empty for any
+		 */
+		std::string scheme;
+
+		/**
+		 * @brief Path pattern, empty for any path
+		 */
+		std::string path;
+
+		/**
+		 * @brief path is a prefix rather than a whole path or wildcard pattern
+		 */
+		bool path_prefix{false};
+	};
+
+	struct node {
+		/**
+		 * @brief Child nodes by literal label, sorted
+		 */
+		std::vector<std::pair<std::string, uint32_t>> children;
+
+		/**
+		 * @brief Child nodes whose label contains a wildcard
+		 */
+		std::vector<std::pair<std::string, uint32_t>> wildcard_children;
+
+		/**
+		 * @brief Rules for a host which ends at this node
+		 */
+		std::vector<uint32_t> exact;
+
+		/**
+		 * @brief Rules for any subdomain of this node
+		 */
+		std::vector<uint32_t> subdomains;
+	};
+
+	std::vector<std::string> patterns;
+	std::vector<rule> rules;
+	std::vector<node> nodes;
+
+	uint32_t child(uint32_t state, std::string_view label) const;
+	uint32_t add_child(uint32_t state, const std::string& label);
+	void collect(uint32_t state, const std::vector<std::string_view>& labels, size_t depth, std::vector<uint32_t>& found) const;
+	bool path_matches(const rule& r, std::string_view path) const;
+};
@@ -19,6 +19,8 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/dpp.h>
+#include <beholder/scan_source.h>
+#include <beholder/guild_settings.h>
 
-json make_fetch_request(const dpp::attachment& attach);
-json make_continue_request(dpp::cluster& bot, dpp::snowflake guild_id, const std::string& hash);
+json make_fetch_item(const scan_source& source);
+json make_continue_request(const guild_settings::snapshot& settings, dpp::snowflake channel_id);
@@ -53,25 +53,30 @@ namespace listeners {
 	void on_guild_delete(const dpp::guild_delete_t &event);
 
 	/**
-	 * @brief handle message creation
+	 * @brief handle message creation.
+	 * This is a coroutine which suspends on its database lookups, so the event
+	 * is taken by value to keep it alive across suspension.
 	 * 
 	 * @param event message_create_t
+	 * @return dpp::task<void>
 	 */
-	void on_message_create(const dpp::message_create_t& event);
+	dpp::task<void> on_message_create(dpp::message_create_t event);
 
 	/**
 	 * @brief handle message editing
 	 *
 	 * @param event message_update_t
+	 * @return dpp::task<void>
 	 */
-	void on_message_update(const dpp::message_update_t& event);
+	dpp::task<void> on_message_update(dpp::message_update_t event);
 
 	/**
 	 * @brief Handle button click (false positive, good match)
 	 * 
 	 * @param event button_click_t
+	 * @return dpp::task<void>
 	 */
-	void on_button_click(const dpp::button_click_t &event);
+	dpp::task<void> on_button_click(dpp::button_click_t event);
 };
 
 size_t tessd_process_count();
\ No newline at end of file
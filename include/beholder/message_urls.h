@@ -0,0 +1,117 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Finds the URLs a message links to, for scanning and for adding to the block list.
+ *
+ * The sources are the message content, every URL field of each embed, embed descriptions
+ * and field values, sticker images, and the images of custom emoji (<:name:id> and
+ * <a:name:id>) used in the content. Text is scanned once for "http://" and "https://",
+ * in any case. A URL ends at whitespace, or at the closing bracket when it is wrapped as
+ * <url>, [url] or the target of a [text](url) link.
+ */
+namespace message_urls {
+
+	/**
+	 * @brief URLs found in a message, in the order they were found and without duplicates.
+	 *
+	 * The views point into the message, which must outlive this, or into generated.
+	 */
+	struct found {
+		std::vector<std::string_view> urls;
+
+		/**
+		 * @brief URLs which are built rather than stored in the message, such as sticker images
+		 */
+		std::deque<std::string> generated;
+
+		found() = default;
+		found(found&&) = default;
+		found& operator=(found&&) = default;
+		found(const found&) = delete;
+		found& operator=(const found&) = delete;
+	};
+
+	/**
+	 * @brief Counts of messages checked by has_scannable_content(), since startup
+	 */
+	struct prefilter_statistics {
+		uint64_t checked{0};
+
+		/**
+		 * @brief Messages with nothing to scan, which were dropped before any further work
+		 */
+		uint64_t skipped{0};
+	};
+
+	/**
+	 * @brief Check text for "http://" or "https://", in any case, without finding the URLs.
+	 * Uses SSE2 where available.
+	 *
+	 * @param text text to check
+	 * @return true if a URL may start in the text
+	 */
+	bool contains_url(std::string_view text);
+
+	/**
+	 * @brief Cheap check for anything extract() or the attachment scan could find: attachments,
+	 * embeds, stickers, or a URL or custom emoji in the content. Updates the prefilter statistics.
+	 *
+	 * @param msg message
+	 * @return false if the message has nothing to scan
+	 */
+	bool has_scannable_content(const dpp::message& msg);
+
+	/**
+	 * @brief Pre-filter counts, since startup
+	 */
+	prefilter_statistics stats();
+
+	/**
+	 * @brief Append the URLs in a piece of text
+	 *
+	 * @param text text to scan
+	 * @param urls views into text are appended here
+	 */
+	void find_in_text(std::string_view text, std::vector<std::string_view>& urls);
+
+	/**
+	 * @brief Find every URL a message links to
+	 *
+	 * @param msg message
+	 * @return URLs, viewing into msg
+	 */
+	found extract(const dpp::message& msg);
+
+	/**
+	 * @brief Get the file name at the end of a URL's path
+	 *
+	 * @param url URL
+	 * @return last path segment, without the query string or fragment
+	 */
+	std::string filename(std::string_view url);
+};
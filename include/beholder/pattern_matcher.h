@@ -0,0 +1,114 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Matches text against a list of wildcard patterns, all at once.
+ *
+ * A pattern matches a line if it matches anywhere within it, as if it were surrounded
+ * by '*'. In a pattern '*' matches any run of characters and '?' any one character, and
+ * ASCII letters match regardless of case. These are the same rules as match() with
+ * "*pattern*", but every pattern is checked in one pass over the text.
+ *
+ * The longest wildcard-free run of each pattern is added to an Aho-Corasick automaton.
+ * Scanning a line finds the patterns whose run it contains, and only those are checked
+ * against the full pattern.
+ */
+class pattern_matcher {
+public:
+	/**
+	 * @brief Compile patterns. Carriage returns are removed and empty patterns are ignored.
+	 *
+	 * @param patterns patterns, in priority order
+	 */
+	explicit pattern_matcher(const std::vector<std::string>& patterns);
+
+	/**
+	 * @brief Find the first line of text which matches any pattern
+	 *
+	 * @param text text of one or more lines separated by '\n'
+	 * @return index of the pattern which matched, the lowest index if several match
+	 * the same line, or std::nullopt if nothing matched
+	 */
+	std::optional<size_t> find(std::string_view text) const;
+
+	/**
+	 * @brief Get a pattern as given, with carriage returns removed
+	 *
+	 * @param index pattern index
+	 * @return pattern
+	 */
+	const std::string& pattern(size_t index) const;
+
+	/**
+	 * @brief Remove carriage returns from a pattern
+	 *
+	 * @param pattern pattern
+	 * @return pattern as used for matching
+	 */
+	static std::string normalise(std::string_view pattern);
+
+private:
+	struct node {
+		/**
+		 * @brief Child nodes by byte, sorted
+		 */
+		std::vector<std::pair<uint8_t, uint32_t>> children;
+
+		/**
+		 * @brief Longest proper suffix of this node which is also in the automaton
+		 */
+		uint32_t fail{0};
+
+		/**
+		 * @brief Nearest node along the fail chain with outputs, 0 if none
+		 */
+		uint32_t output_link{0};
+
+		/**
+		 * @brief Patterns whose key ends at this node
+		 */
+		std::vector<uint32_t> outputs;
+	};
+
+	std::vector<std::string> patterns;
+
+	/**
+	 * @brief Patterns lower cased, for verification
+	 */
+	std::vector<std::string> folded;
+
+	/**
+	 * @brief Patterns with no literal characters, which have to be checked against every line
+	 */
+	std::vector<uint32_t> always_check;
+
+	std::vector<node> nodes;
+
+	uint32_t child(uint32_t state, uint8_t byte) const;
+	uint32_t add_child(uint32_t state, uint8_t byte);
+	void build_links();
+	std::optional<size_t> find_in_line(std::string_view line, std::vector<uint32_t>& candidates) const;
+};
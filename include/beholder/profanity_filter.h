@@ -0,0 +1,113 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Finds whole words from a word list in text, in one pass.
+ *
+ * Both the words and the text are normalised first: letters are lower cased, accents
+ * are removed from Latin letters, fullwidth forms become ASCII, zero width characters
+ * are dropped and punctuation separates words. Within a word that has letters in it,
+ * leetspeak digits and symbols are folded to the letters they stand for, so "$h1t"
+ * reads as "shit" while "2024" stays a number.
+ *
+ * Normalised words are added to an Aho-Corasick automaton, and a match only counts
+ * if it starts and ends on a word boundary of the normalised text.
+ */
+class profanity_filter {
+public:
+	/**
+	 * @brief Compile a word list. Entries may contain several words separated by spaces.
+	 *
+	 * @param words words to find
+	 */
+	explicit profanity_filter(const std::vector<std::string>& words);
+
+	/**
+	 * @brief Check if text contains any of the words
+	 *
+	 * @param text UTF-8 text
+	 * @return true if a word was found
+	 */
+	bool contains(std::string_view text) const;
+
+	/**
+	 * @brief Number of distinct normalised words
+	 */
+	size_t size() const;
+
+	/**
+	 * @brief Normalise UTF-8 text as it is matched
+	 *
+	 * @param text UTF-8 text
+	 * @return lower cased, folded words separated by single spaces
+	 */
+	static std::string normalise(std::string_view text);
+
+	/**
+	 * @brief Read word lists, one word per line, from "<directory>/<language>.txt".
+	 * Blank lines and lines starting with '#' are ignored.
+	 *
+	 * @param directory directory containing the lists
+	 * @param languages language codes, as sent to the profanity service
+	 * @return words from all the lists, or std::nullopt if any list is missing
+	 */
+	static std::optional<std::vector<std::string>> read_word_lists(const std::string& directory, const std::vector<std::string>& languages);
+
+private:
+	struct node {
+		/**
+		 * @brief Child nodes by byte, sorted
+		 */
+		std::vector<std::pair<uint8_t, uint32_t>> children;
+
+		/**
+		 * @brief Longest proper suffix of this node which is also in the automaton
+		 */
+		uint32_t fail{0};
+
+		/**
+		 * @brief Nearest node along the fail chain which ends a word, 0 if none
+		 */
+		uint32_t output_link{0};
+
+		/**
+		 * @brief Length in bytes of the path to this node
+		 */
+		uint32_t depth{0};
+
+		/**
+		 * @brief A word ends at this node
+		 */
+		bool word{false};
+	};
+
+	std::vector<node> nodes;
+	size_t word_count{0};
+
+	uint32_t child(uint32_t state, uint8_t byte) const;
+	uint32_t add_child(uint32_t state, uint8_t byte);
+	void build_links();
+};
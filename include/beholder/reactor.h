@@ -20,9 +20,14 @@
 #pragma once
 #include <dpp/dpp.h>
 #include <beholder/beholder.h>
+#include <beholder/scan_source.h>
 #include <functional>
 
-using scan_callback = std::function<void(const std::string& hash, const dpp::json& response)>;
+/**
+ * @brief Called with the result for each image of a request. hash is empty if the image
+ * could not be fetched, and response is then the error tessd gave.
+ */
+using scan_callback = std::function<void(const scan_source& source, const std::string& hash, const dpp::json& response)>;
 
 enum class reactor_fd_type {
 	child_stdin,
@@ -33,24 +38,64 @@ enum class reactor_fd_type {
 enum class scan_stage {
 	writing_fetch,
 	waiting_hash,
+	waiting_lookup,
 	writing_continue,
 	waiting_scan,
 	writing_stop,
 	waiting_exit
 };
 
+/**
+ * @brief Images to scan in one tessd process. They all come from the same message, or
+ * from the same command, so they share a guild and channel.
+ */
 struct scan_request {
-	dpp::attachment attach;
-	dpp::message_create_t ev;
+	std::vector<scan_source> sources;
 	dpp::cluster* bot;
 	scan_callback callback;
 
-	scan_request(const dpp::attachment& attach, const dpp::message_create_t& ev, dpp::cluster& bot, scan_callback callback = nullptr);
+	scan_request(std::vector<scan_source> sources, dpp::cluster& bot, scan_callback callback = nullptr);
 };
 
+/**
+ * @brief One image of a running scan_job
+ */
+struct scan_item {
+	scan_source source;
+
+	/**
+	 * @brief Content hash, empty until tessd has fetched the image or if it failed to
+	 */
+	std::string hash;
+
+	/**
+	 * @brief Error frame from tessd if the fetch failed, otherwise null
+	 */
+	json error;
+
+	/**
+	 * @brief asset_cache key for a sticker or custom emoji, empty if the image is neither
+	 */
+	std::string asset_key;
+
+	/**
+	 * @brief url_cache key for the image, empty if its URL is not cacheable or it is a sticker or emoji
+	 */
+	std::string url_key;
+
+	explicit scan_item(scan_source source);
+};
+
+/**
+ * @brief A tessd process scanning a batch of images.
+ *
+ * tessd fetches every image at once and reports a hash or an error for each. The block
+ * list and guild settings are then looked up once for the batch, and tessd scans the
+ * remaining images one at a time, waiting after each for the bot to say whether to go on.
+ * It is told to stop as soon as the message the images came from has been deleted.
+ */
 struct scan_job {
-	dpp::attachment attach;
-	dpp::message_create_t ev;
+	std::vector<scan_item> items;
 	dpp::cluster* bot;
 	scan_callback callback;
 
@@ -61,13 +106,30 @@ struct scan_job {
 
 	scan_stage stage{scan_stage::writing_fetch};
 
-	std::string hash;
+	/**
+	 * @brief Number of items tessd has sent a hash or fetch error for
+	 */
+	size_t hashes_received{0};
+
+	/**
+	 * @brief Indexes of the items being scanned, in the order tessd scans them
+	 */
+	std::vector<size_t> scan_order;
+
+	/**
+	 * @brief Number of items in scan_order tessd has sent a result for
+	 */
+	size_t scans_received{0};
+
+	/**
+	 * @brief Version of the guild settings the scan was requested with
+	 */
+	uint64_t settings_version{0};
+
 	std::string input_buffer;
 	std::string output_buffer;
 	size_t output_offset{0};
 
-	bool result_received{false};
-
 	scan_job(const scan_request& request);
 };
 
@@ -84,7 +146,16 @@ public:
 		return reactor;
 	}
 
-	void submit(const dpp::attachment& attach, dpp::cluster& bot, const dpp::message_create_t& ev, scan_callback callback = nullptr);
+	/**
+	 * @brief Queue images for scanning. They are split into batches of at most
+	 * max_batch_items, and at most max_size bytes where Discord gives the size,
+	 * each scanned by one tessd process.
+	 *
+	 * @param sources images from one message or command
+	 * @param bot cluster
+	 * @param callback called with each result
+	 */
+	void submit(std::vector<scan_source> sources, dpp::cluster& bot, scan_callback callback = nullptr);
 
 private:
 	int epoll_fd{-1};
@@ -92,6 +163,7 @@ private:
 	std::thread worker;
 	std::mutex queue_mutex;
 	std::deque<scan_request> requests;
+	std::deque<std::function<void()>> completions;
 	std::map<int, reactor_fd> fds;
 
 	scanner_reactor();
@@ -101,14 +173,19 @@ private:
 	void disable_fd(int fd);
 	void run();
 	void drain_queue_fd();
+	void post(std::function<void()> completion);
+	void run_completions();
 	void start_queued_jobs();
 	void start_job(const scan_request& request);
+	void spawn_job(const scan_request& request);
 	void handle_child_stdin(const std::shared_ptr<scan_job>& job);
 	void handle_child_stdout(const std::shared_ptr<scan_job>& job);
 	void process_input_lines(const std::shared_ptr<scan_job>& job);
 	void process_frame(const std::shared_ptr<scan_job>& job, const json& frame);
 	void process_hash_frame(const std::shared_ptr<scan_job>& job, const json& frame);
+	void lookup_batch(const std::shared_ptr<scan_job>& job);
 	void process_scan_frame(const std::shared_ptr<scan_job>& job, const json& frame);
+	void send_frame(const std::shared_ptr<scan_job>& job, scan_stage stage, const json& frame);
 	void modify_or_add_stdin(const std::shared_ptr<scan_job>& job);
 	void handle_child_exit(const std::shared_ptr<scan_job>& job);
 	void close_job_io(const std::shared_ptr<scan_job>& job);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <beholder/regex.h>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace regex {
+
+/**
+ * @brief Timing counters for regex_set, across all sets
+ */
+struct set_statistics {
+    uint64_t compiles{0};
+    double compile_ms{0};
+    uint64_t matches{0};
+    double match_ms{0};
+
+    /**
+     * @brief Patterns which RE2 could not compile and which are run through TRE instead
+     */
+    uint64_t fallback_patterns{0};
+};
+
+/**
+ * @brief A list of case insensitive regular expressions matched together.
+ *
+ * Patterns are compiled into one RE2::Set, a DFA which finds every matching pattern
+ * in a single pass over the text. Patterns RE2 does not support, such as ones with
+ * backreferences, are compiled with TRE and checked one by one.
+ */
+class regex_set {
+public:
+    /**
+     * @brief Compile a list of patterns
+     *
+     * @param patterns patterns, in priority order
+     */
+    explicit regex_set(const std::vector<std::string>& patterns);
+    ~regex_set();
+
+    regex_set(const regex_set&) = delete;
+    regex_set& operator=(const regex_set&) = delete;
+
+    /**
+     * @brief Find every pattern which matches somewhere in the text
+     *
+     * @param text text to search
+     * @return indexes of the matching patterns, ascending
+     */
+    std::vector<size_t> match(const std::string& text) const;
+
+    /**
+     * @brief Number of patterns
+     */
+    size_t size() const;
+
+    /**
+     * @brief Check a single pattern compiles with either engine
+     *
+     * @param pattern pattern
+     * @return error message, or std::nullopt if it is valid
+     */
+    static std::optional<std::string> validate(const std::string& pattern);
+
+    /**
+     * @brief Timing counters, across all sets
+     */
+    static set_statistics stats();
+
+private:
+    struct compiled_set;
+
+    std::unique_ptr<compiled_set> compiled;
+    std::vector<size_t> set_indexes;
+    std::vector<std::pair<size_t, std::unique_ptr<regex>>> fallback;
+    size_t pattern_count{0};
+};
+
+}
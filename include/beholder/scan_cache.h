@@ -0,0 +1,125 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/**
+ * @brief Cache of per-image scan results, keyed by the image's SHA-256 hash.
+ *
+ * Lookups go through three tiers:
+ * 1. An in-memory LRU of recently seen images.
+ * 2. An optional memory mapped, append-only file, which survives restarts.
+ * 3. The scan_cache and basic_cache tables in MySQL.
+ *
+ * Results found in a lower tier are copied into the tiers above it. New results are
+ * stored in the local tiers straight away and written to MySQL in the background.
+ *
+ * Configured by the optional "scan_cache" section of config.json:
+ * - "entries": images kept in memory (default 65536, 0 to disable)
+ * - "file": path of the on-disk cache (default empty, disabled)
+ * - "file_size": size of the on-disk cache in bytes (default 1GB). When it fills up
+ *   it is cleared and starts again.
+ * - "retention_days": database rows not read or written for this many days are
+ *   removed by expire_database() (default 90, 0 to keep them forever)
+ */
+namespace scan_cache {
+
+	/**
+	 * @brief Cached results for one image
+	 */
+	struct entry {
+		/**
+		 * @brief OCR text
+		 */
+		std::optional<std::string> ocr;
+
+		/**
+		 * @brief Basic NSFW scores, as JSON text
+		 */
+		std::optional<std::string> basic;
+	};
+
+	/**
+	 * @brief Cache statistics
+	 */
+	struct statistics {
+		size_t memory_entries{0};
+		uint64_t memory_hits{0};
+		uint64_t file_hits{0};
+		uint64_t database_hits{0};
+		uint64_t misses{0};
+
+		/**
+		 * @brief Bytes used in the on-disk cache, 0 if it is disabled
+		 */
+		uint64_t file_bytes{0};
+	};
+
+	/**
+	 * @brief Read configuration and open the on-disk cache. Call once at startup.
+	 *
+	 * @param bot cluster, used for logging
+	 */
+	void init(dpp::cluster& bot);
+
+	/**
+	 * @brief Look up an image. On a miss in both local tiers this queries MySQL,
+	 * so call it from a database worker.
+	 *
+	 * @param hash image hash
+	 * @return cached results, empty if nothing is cached
+	 */
+	entry get(const std::string& hash);
+
+	/**
+	 * @brief Store OCR text for an image
+	 *
+	 * @param hash image hash
+	 * @param ocr OCR text
+	 */
+	void put_ocr(const std::string& hash, const std::string& ocr);
+
+	/**
+	 * @brief Store basic NSFW scores for an image
+	 *
+	 * @param hash image hash
+	 * @param basic scores as JSON text
+	 */
+	void put_basic(const std::string& hash, const std::string& basic);
+
+	/**
+	 * @brief Delete database rows which have not been used within the retention period.
+	 * Rows are deleted in batches by last_hit, and a run stops after a bounded number of
+	 * batches. Runs queries, so call it from a database worker.
+	 *
+	 * @return rows deleted
+	 */
+	size_t expire_database();
+
+	/**
+	 * @brief Get cache statistics
+	 *
+	 * @return statistics
+	 */
+	statistics stats();
+};
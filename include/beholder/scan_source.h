@@ -0,0 +1,93 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief What the scan pipeline needs to know about one image: where it came from and
+ * where to fetch it.
+ *
+ * This is copied at each step from the message event to the deletion and its follow up
+ * actions, so it holds only IDs and the image details. The message itself, which with
+ * its embeds, member and raw gateway payload is many kilobytes, is shared by every image
+ * found in it through one immutable snapshot, and is only read when logging a deletion.
+ */
+struct scan_source {
+	dpp::snowflake guild_id;
+	dpp::snowflake channel_id;
+
+	/**
+	 * @brief Message the image was found in, empty for a manual scan
+	 */
+	dpp::snowflake message_id;
+	dpp::snowflake author_id;
+
+	/**
+	 * @brief Attachment ID, empty for an image linked to from the message
+	 */
+	dpp::snowflake attachment_id;
+
+	std::string url;
+	std::string filename;
+
+	/**
+	 * @brief Dimensions and size in bytes as given by Discord, 0 where not known
+	 */
+	uint32_t width{0};
+	uint32_t height{0};
+	uint32_t size{0};
+
+	/**
+	 * @brief Message the image was found in, or nullptr if there isn't one
+	 */
+	std::shared_ptr<const dpp::message> message;
+
+	scan_source() = default;
+
+	/**
+	 * @brief Describe an uploaded attachment
+	 *
+	 * @param attach attachment
+	 * @param message message it was uploaded with, may be nullptr
+	 */
+	scan_source(const dpp::attachment& attach, std::shared_ptr<const dpp::message> message);
+
+	/**
+	 * @brief Describe an image linked to from a message
+	 *
+	 * @param url URL
+	 * @param message message the URL was found in, may be nullptr
+	 */
+	scan_source(std::string_view url, std::shared_ptr<const dpp::message> message);
+
+	/**
+	 * @brief Mention of the author
+	 */
+	std::string author_mention() const;
+
+	/**
+	 * @brief Author's user name, or their mention if there is no message snapshot
+	 */
+	std::string author_name() const;
+};
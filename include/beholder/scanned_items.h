@@ -0,0 +1,56 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <beholder/scan_source.h>
+
+/**
+ * @brief Record of the attachments and URLs already submitted for scanning from each
+ * recent message, so that an edit only scans what it added.
+ *
+ * Messages are remembered until they are a week old, after which edits are ignored
+ * anyway, and the oldest are forgotten first if too many are being tracked. A forgotten
+ * message is simply scanned in full again if it is edited.
+ */
+namespace scanned_items {
+
+	/**
+	 * @brief Check if an attachment or URL has already been submitted from its message,
+	 * without recording it
+	 *
+	 * @param source image
+	 * @return true if it has been recorded for this message before
+	 */
+	bool scanned(const scan_source& source);
+
+	/**
+	 * @brief Record an attachment or URL as submitted for scanning. Attachments are matched
+	 * by ID, as their URLs change between edits of the same message.
+	 *
+	 * @param source image
+	 * @return true if it had not been recorded for this message before, and should be scanned
+	 */
+	bool first_scan(const scan_source& source);
+
+	/**
+	 * @brief Number of messages being tracked
+	 */
+	size_t size();
+};
@@ -0,0 +1,61 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <cstdint>
+
+/**
+ * @brief Per-guild daily statistics.
+ *
+ * Increments are counted in memory and written to guild_statistics by flush(),
+ * which sends every pending counter as one multi-row upsert. The bot flushes every
+ * few seconds and again when it is stopped.
+ */
+namespace statistics {
+
+	/**
+	 * @brief Statistics columns of guild_statistics
+	 */
+	enum stat : uint8_t {
+		images_scanned,
+		images_blocked,
+		images_ocr,
+		images_nsfw,
+		cache_miss,
+		stat_count
+	};
+
+	/**
+	 * @brief Add to one of today's statistics for a guild
+	 *
+	 * @param s statistic
+	 * @param guild_id guild ID
+	 * @param amount amount to add
+	 */
+	void increment(stat s, dpp::snowflake guild_id, uint32_t amount = 1);
+
+	/**
+	 * @brief Write pending counts to the database. If the write fails the counts
+	 * are kept and retried on the next flush.
+	 *
+	 * @return number of guild_statistics rows written
+	 */
+	size_t flush();
+};
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <dpp/json.h>
 #include <string>
+#include <string_view>
+#include <optional>
 
 namespace tessd {
 
@@ -360,5 +362,75 @@ dpp::json run_basic_nsfw_avif(const std::string& file_content, const std::vector
 
 bool is_webm(const std::string& file_content);
 
+/**
+ * @brief Check OCR text for profanity in the given languages.
+ *
+ * Uses the built in filter when every language has a word list in the "profanity"
+ * directory, otherwise asks the profanity service.
+ *
+ * @param text OCR text.
+ * @param languages Language codes.
+ * @return True if the text contains profanity.
+ */
 bool run_profanity_filter(const std::string& text, const std::vector<std::string>& languages);
 
+/**
+ * @brief Check OCR text for profanity using the profanity service, over its Unix
+ * domain socket when it exists, otherwise HTTP on port 6970.
+ *
+ * @param text OCR text.
+ * @param languages Language codes.
+ * @return The service's is-bad result.
+ */
+bool run_profanity_service(const std::string& text, const std::vector<std::string>& languages);
+
+/**
+ * @brief Perform NSFW classification of an encoded image.
+ *
+ * Uses the nsfwd Unix domain socket when it is available, otherwise HTTP.
+ *
+ * @param file_content Encoded image data.
+ * @return NSFW classification result.
+ */
+dpp::json run_basic_nsfw(const std::string& file_content);
+
+/**
+ * @brief Perform NSFW classification of a decoded RGBA frame.
+ *
+ * Over the nsfwd Unix domain socket the pixels are passed in shared memory. Without it,
+ * the frame is encoded as PNG and sent over HTTP.
+ *
+ * @param pixels RGBA pixel data.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @return NSFW classification result.
+ */
+dpp::json run_basic_nsfw_rgba(const unsigned char* pixels, int width, int height);
+
+/**
+ * @brief Set the nsfwd Unix domain socket path, as configured for nsfwd's "unix_socket".
+ *
+ * @param path Socket path, or empty to always use HTTP.
+ */
+void set_nsfw_socket_path(const std::string& path);
+
+/**
+ * @brief Classify an encoded image over the nsfwd Unix domain socket.
+ *
+ * @param file_content Encoded image data.
+ * @return NSFW classification result, or std::nullopt if the socket is unavailable.
+ * @throw std::runtime_error if nsfwd reports an error.
+ */
+std::optional<dpp::json> nsfw_socket_classify(std::string_view file_content);
+
+/**
+ * @brief Classify RGBA pixels over the nsfwd Unix domain socket, passing them in a memfd.
+ *
+ * @param pixels RGBA pixel data.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @return NSFW classification result, or std::nullopt if the socket is unavailable.
+ * @throw std::runtime_error if nsfwd reports an error.
+ */
+std::optional<dpp::json> nsfw_socket_classify_rgba(const unsigned char* pixels, int width, int height);
+
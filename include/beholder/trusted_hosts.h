@@ -18,6 +18,8 @@
  *
  ************************************************************************************/
 #pragma once
+#include <beholder/host_matcher.h>
+#include <iterator>
 
 /**
  * Hosts which may be contacted directly rather than via the local SSRF proxy.
@@ -160,4 +162,12 @@ inline static const char* trusted[] = {
 	"https://user-images.githubusercontent.com",
 	"https://m.media-amazon.com",
 	"https://a0.muscache.com",
-};
\ No newline at end of file
+};
+
+/**
+ * @brief The trusted hosts, compiled on first use
+ */
+inline const host_matcher& trusted_hosts() {
+	static const host_matcher matcher(std::vector<std::string>(std::begin(trusted), std::end(trusted)));
+	return matcher;
+}
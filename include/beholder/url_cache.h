@@ -0,0 +1,105 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/dpp.h>
+#include <memory>
+#include <optional>
+#include <string>
+
+/**
+ * @brief Map of recently scanned image URLs to the hash of their content, so an image
+ * which is posted again can be checked without downloading it.
+ *
+ * Only Discord attachment URLs are cached. Their path holds the attachment's own ID, so
+ * the content behind them never changes. Other hosts, even those in trusted_hosts.h, can
+ * serve different content at the same URL, so those are always fetched again. Discord
+ * CDN URLs carry signing parameters (ex, is and hm) which differ each time a link is
+ * shared; these are removed when building the key.
+ *
+ * Each entry also keeps the last scan response for the URL, along with the guild, channel
+ * and settings version it was produced under, so that it can be reused when the same image
+ * is posted again under the same settings.
+ */
+namespace url_cache {
+
+	/**
+	 * @brief A scan response and the settings it was produced under
+	 */
+	struct verdict {
+		dpp::snowflake guild_id;
+		dpp::snowflake channel_id;
+
+		/**
+		 * @brief guild_settings::snapshot::version used for the scan
+		 */
+		uint64_t settings_version{0};
+
+		/**
+		 * @brief tessd scan frame
+		 */
+		std::shared_ptr<const dpp::json> response;
+	};
+
+	/**
+	 * @brief A cached URL
+	 */
+	struct entry {
+		std::string hash;
+		std::optional<verdict> last_verdict;
+	};
+
+	/**
+	 * @brief Build the cache key for a URL
+	 *
+	 * @param url image URL
+	 * @return key, or an empty string if the URL is not a Discord attachment
+	 */
+	std::string canonical_key(const std::string& url);
+
+	/**
+	 * @brief Look up a URL
+	 *
+	 * @param key key from canonical_key()
+	 * @return entry, or std::nullopt if it is not cached or has expired
+	 */
+	std::optional<entry> get(const std::string& key);
+
+	/**
+	 * @brief Record the hash of a URL's content
+	 *
+	 * @param key key from canonical_key()
+	 * @param hash content hash
+	 */
+	void store_hash(const std::string& key, const std::string& hash);
+
+	/**
+	 * @brief Record the result of scanning a URL
+	 *
+	 * @param key key from canonical_key()
+	 * @param hash content hash
+	 * @param result scan response and settings
+	 */
+	void store_verdict(const std::string& key, const std::string& hash, const verdict& result);
+
+	/**
+	 * @brief Number of cached URLs
+	 */
+	size_t size();
+};
@@ -18,6 +18,7 @@
  *
  ************************************************************************************/
 #pragma once
+#include <beholder/host_matcher.h>
 #include <string>
 #include <vector>
 
@@ -30,3 +31,18 @@ inline constexpr const char* whitelist[] = {
 	"https://beholder.cc/*",
 	nullptr,
 };
+
+/**
+ * @brief Image URLs which are never scanned, compiled on first use
+ */
+inline const host_matcher& whitelisted_urls() {
+	static const host_matcher matcher([] {
+		std::vector<std::string> patterns;
+		for (int index = 0; whitelist[index] != nullptr; ++index) {
+			patterns.emplace_back(whitelist[index]);
+		}
+		return patterns;
+	}());
+	return matcher;
+}
+
@@ -0,0 +1,59 @@
+#pragma once
+#include <nsfwd/settings.h>
+#include <memory>
+#include <string>
+
+/**
+ * @brief A loaded NSFW model.
+ *
+ * Every backend takes the same input, INPUT_SIZE floats in NHWC order (1 x 299 x 299 x 3, RGB,
+ * scaled to 0..1), and produces INDEX_COUNT scores in INDEX_* order. Implementations must be
+ * safe to call from several HTTP and socket threads at once.
+ */
+class inference_backend {
+public:
+	virtual ~inference_backend() = default;
+
+	/**
+	 * @brief Run the model over one normalised input image
+	 *
+	 * @param input INPUT_SIZE normalised floats
+	 * @param scores receives the five class scores, in INDEX_* order
+	 * @param error receives the error message on failure
+	 * @return true on success
+	 */
+	virtual bool run(const float* input, float* scores, std::string& error) = 0;
+
+	/**
+	 * @brief Backend name for the log
+	 */
+	virtual const char* name() const = 0;
+};
+
+/**
+ * @brief TensorFlow SavedModel backend, loaded from ../nsfw_model
+ *
+ * @param settings settings
+ * @param error receives the error message on failure
+ * @return backend, or nullptr on failure
+ */
+std::unique_ptr<inference_backend> make_tensorflow_backend(const nsfwd_settings& settings, std::string& error);
+
+/**
+ * @brief OpenCV DNN backend, loaded from an ONNX export of the same model.
+ * Quantised (int8 QDQ) exports are supported by OpenCV 4.7 and later.
+ *
+ * @param settings settings
+ * @param error receives the error message on failure
+ * @return backend, or nullptr on failure
+ */
+std::unique_ptr<inference_backend> make_opencv_backend(const nsfwd_settings& settings, std::string& error);
+
+/**
+ * @brief Create the backend selected by the "backend" setting
+ *
+ * @param settings settings
+ * @param error receives the error message on failure
+ * @return backend, or nullptr on failure
+ */
+std::unique_ptr<inference_backend> make_inference_backend(const nsfwd_settings& settings, std::string& error);
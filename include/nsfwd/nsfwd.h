@@ -1,9 +1,9 @@
 #pragma once
 #include <stdint.h>
 #include <beholder/proc/spawn.h>
-#include <tensorflow/c/c_api.h>
 #include <cstring>
 #include <iostream>
+#include <string>
 #include <vector>
 
 inline constexpr size_t INPUT_HEIGHT = 299;
@@ -30,7 +30,18 @@ inline constexpr size_t INDEX_HENTAI = 1;
 inline constexpr size_t INDEX_NEUTRAL = 2;
 inline constexpr size_t INDEX_PORN = 3;
 inline constexpr size_t INDEX_SEXY = 4;
+inline constexpr size_t INDEX_COUNT = 5;
 
 [[noreturn]] void run_supervisor(const char* self);
 
+/**
+ * @brief Pin the calling thread, and every thread it starts afterwards, to a CPU list.
+ * The child calls this before it starts any thread, as threads already running keep their mask.
+ *
+ * @param list taskset style CPU list such as "0-3,8-11", empty to leave the mask alone
+ * @param error receives the reason if the list is invalid or could not be applied
+ * @return true on success, or if the list is empty
+ */
+bool set_cpu_affinity(const std::string& list, std::string& error);
+
 int run_server();
\ No newline at end of file
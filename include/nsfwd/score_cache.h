@@ -0,0 +1,115 @@
+#pragma once
+#include <nsfwd/nsfwd.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief How the image in a request body is represented
+ */
+enum class score_input : uint8_t {
+	/**
+	 * @brief Encoded image file, such as PNG or JPEG, sent over HTTP or the socket
+	 */
+	encoded,
+
+	/**
+	 * @brief Raw RGBA pixels of a given size, sent over the socket
+	 */
+	rgba,
+};
+
+/**
+ * @brief Identifies a request by a 128 bit XXH3 hash of its content and its length, how
+ * the content is represented and, for raw pixels, their dimensions
+ */
+struct score_key {
+	uint64_t low{0};
+	uint64_t high{0};
+	uint64_t size{0};
+	int32_t width{0};
+	int32_t height{0};
+	score_input input{score_input::encoded};
+
+	bool operator==(const score_key&) const = default;
+};
+
+struct score_key_hash {
+	size_t operator()(const score_key& key) const {
+		return key.low ^ (key.size * 0x9e3779b97f4a7c15ULL) ^ ((static_cast<uint64_t>(static_cast<uint32_t>(key.width)) << 32 | static_cast<uint32_t>(key.height)) * 0xc2b2ae3d27d4eb4fULL);
+	}
+};
+
+/**
+ * @brief Bounded LRU of model outputs keyed by the hash of the encoded image.
+ *
+ * The same bytes are sent repeatedly: duplicate GIF frames, flattened first frames, and the
+ * same attachment scanned for several guilds before the bot's own cache has been written.
+ * A hit skips both the decode and the inference.
+ */
+class score_cache {
+public:
+	/**
+	 * @brief Construct a new score cache
+	 *
+	 * @param capacity maximum number of entries, 0 disables the cache
+	 */
+	explicit score_cache(size_t capacity);
+
+	score_cache(const score_cache&) = delete;
+	score_cache& operator=(const score_cache&) = delete;
+
+	/**
+	 * @brief Hash a request body
+	 *
+	 * @param body encoded image or RGBA pixels
+	 * @param input how body is represented
+	 * @param width width in pixels of RGBA input, 0 for encoded input
+	 * @param height height in pixels of RGBA input, 0 for encoded input
+	 * @return score_key key
+	 */
+	static score_key make_key(std::string_view body, score_input input, int width, int height);
+
+	/**
+	 * @brief Look up a previous result, marking it most recently used
+	 *
+	 * @param key key from make_key()
+	 * @param scores receives INDEX_COUNT scores on a hit
+	 * @return true on a hit
+	 */
+	bool find(const score_key& key, float* scores);
+
+	/**
+	 * @brief Store a result, evicting the least recently used entry if full
+	 *
+	 * @param key key from make_key()
+	 * @param scores INDEX_COUNT scores
+	 */
+	void insert(const score_key& key, const float* scores);
+
+	size_t size() const;
+
+	size_t capacity() const;
+
+	uint64_t hits() const;
+
+	uint64_t misses() const;
+
+	uint64_t evictions() const;
+
+private:
+	struct entry {
+		score_key key;
+		float scores[INDEX_COUNT];
+	};
+
+	const size_t max_entries;
+	mutable std::mutex lock;
+	std::list<entry> lru;
+	std::unordered_map<score_key, std::list<entry>::iterator, score_key_hash> index;
+	std::atomic<uint64_t> hit_count{0};
+	std::atomic<uint64_t> miss_count{0};
+	std::atomic<uint64_t> eviction_count{0};
+};
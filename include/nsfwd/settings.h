@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <nsfwd/socket_protocol.h>
+
+/**
+ * @brief Runtime tuning for nsfwd, read from nsfwd.json in the directory above the build directory.
+ *
+ * nsfwd runs as its own user and cannot read the bot's config.json, so it has a small
+ * configuration file of its own. Every value is optional; a missing file or key keeps the
+ * previous hard-coded behaviour.
+ */
+struct nsfwd_settings {
+	/**
+	 * @brief Inference backend, "tensorflow" for the SavedModel in ../nsfw_model or "opencv" for an ONNX export
+	 */
+	std::string backend{"tensorflow"};
+
+	/**
+	 * @brief ONNX model used by the opencv backend
+	 */
+	std::string onnx_model{"../nsfw_model.onnx"};
+
+	/**
+	 * @brief Threads TensorFlow may use inside a single operation, 0 for the TensorFlow default.
+	 * For the opencv backend this sets OpenCV's thread count.
+	 */
+	int intra_op_threads{0};
+
+	/**
+	 * @brief Threads TensorFlow may use to run independent operations concurrently, 0 for the TensorFlow default
+	 */
+	int inter_op_threads{0};
+
+	/**
+	 * @brief Drogon IO threads, 0 for half of the available cores
+	 */
+	int http_threads{0};
+
+	/**
+	 * @brief CPU list the child is pinned to, in taskset format e.g. "0-3,8-11". Empty for no pinning.
+	 */
+	std::string cpu_affinity;
+
+	/**
+	 * @brief Seconds to wait for a replacement child to load the model and start listening
+	 * before the restart is abandoned and the old child is kept
+	 */
+	int restart_ready_timeout{180};
+
+	/**
+	 * @brief Seconds the old child keeps running after its replacement is ready, so requests
+	 * it has already accepted can complete
+	 */
+	int restart_drain_seconds{5};
+
+	/**
+	 * @brief Number of results kept in the in-memory score cache, 0 to disable it
+	 */
+	int score_cache_entries{65536};
+
+	/**
+	 * @brief Unix domain socket path tessd can use instead of HTTP. Empty to disable.
+	 */
+	std::string unix_socket{nsfw_socket::default_path};
+};
+
+/**
+ * @brief Load settings from a JSON file. Missing files and keys keep their defaults.
+ *
+ * @param settings_file path to settings file
+ */
+void load_settings(const std::string& settings_file);
+
+/**
+ * @brief Get the loaded settings
+ *
+ * @return const nsfwd_settings& settings
+ */
+const nsfwd_settings& get_settings();
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Local Unix domain socket protocol between tessd and nsfwd.
+ *
+ * This carries the same requests as the HTTP API without TCP or HTTP framing. A connection
+ * can be used for any number of requests, each a request_header followed by its payload,
+ * answered by a response_header followed by error_length bytes of error message.
+ *
+ * Decoded frames do not need to be re-encoded and copied through the socket: the client
+ * writes the RGBA pixels into a memfd, seals it against writes and resizing, and passes
+ * the descriptor with the header using SCM_RIGHTS. nsfwd refuses a memfd without
+ * F_SEAL_SHRINK and F_SEAL_WRITE, and maps it read-only.
+ */
+namespace nsfw_socket {
+
+	/**
+	 * @brief Default socket path. Both users need access to it, so it lives in /tmp.
+	 */
+	inline constexpr const char* default_path = "/tmp/beholder-nsfwd.sock";
+
+	inline constexpr uint32_t magic = 0x3146534e; // "NSF1"
+
+	enum request_type : uint32_t {
+		/**
+		 * @brief length bytes of encoded image follow the header
+		 */
+		request_encoded = 0,
+		/**
+		 * @brief A memfd of at least width * height * 4 bytes of RGBA is attached to the header
+		 */
+		request_rgba = 1,
+	};
+
+	struct request_header {
+		uint32_t magic{nsfw_socket::magic};
+		uint32_t type{request_encoded};
+		uint32_t width{0};
+		uint32_t height{0};
+		uint64_t length{0};
+	};
+
+	struct response_header {
+		uint32_t magic{nsfw_socket::magic};
+		/**
+		 * @brief Zero on success, otherwise the equivalent HTTP status
+		 */
+		uint32_t status{0};
+		/**
+		 * @brief drawing, hentai, neutral, porn, sexy
+		 */
+		float scores[5]{};
+		uint32_t error_length{0};
+	};
+
+	/**
+	 * @brief Largest encoded body accepted, matching the HTTP client body limit
+	 */
+	inline constexpr uint64_t max_length = 32 * 1024 * 1024;
+
+	/**
+	 * @brief Largest decoded frame accepted, matching tessd's own pixel limit
+	 */
+	inline constexpr uint64_t max_pixels = 33554432;
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+/**
+ * @brief Classify one image for the socket server.
+ *
+ * @param source label for the log
+ * @param data encoded image, or RGBA pixels if width and height are non-zero
+ * @param width RGBA width, 0 for encoded data
+ * @param height RGBA height, 0 for encoded data
+ * @param scores receives INDEX_COUNT scores
+ * @param error receives the error message on failure
+ * @return 0 on success, otherwise an HTTP status code
+ */
+using socket_classifier = std::function<uint32_t(std::string_view source, std::string_view data, int width, int height, float* scores, std::string& error)>;
+
+/**
+ * @brief Listen on a Unix domain socket for nsfw_socket requests, on a background thread.
+ *
+ * Any existing socket file at the path is replaced. When a replacement child does this
+ * during a restart, new connections go to it while the old child finishes the ones it has.
+ * Each connection has its own thread for I/O, but the classifier only runs on a fixed set
+ * of workers.
+ *
+ * @param path socket path
+ * @param classifier classifier to run for each request
+ * @param workers number of requests classified at once, normally the HTTP thread count
+ * @return true if the socket is listening
+ */
+bool start_socket_server(const std::string& path, socket_classifier classifier, size_t workers);
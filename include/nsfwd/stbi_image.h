@@ -5,6 +5,12 @@ class stbi_image {
 public:
 	stbi_image(std::string_view body);
 
+	/**
+	 * @brief Take already decoded RGBA pixels, e.g. a frame passed through shared memory.
+	 * The alpha channel is dropped, as it is when an encoded RGBA image is loaded.
+	 */
+	stbi_image(const unsigned char *rgba, int width, int height);
+
 	~stbi_image();
 
 	stbi_image(const stbi_image&) = delete;
@@ -1,5 +1,8 @@
 #pragma once
 #include <tensorflow/c/c_api.h>
+#include <nsfwd/tf_status.h>
+#include <cstdint>
+#include <string>
 
 class tf_session_options {
 public:
@@ -20,6 +23,33 @@ public:
 		return options;
 	}
 
+	/**
+	 * The C API only accepts a serialised ConfigProto, so the two thread pool sizes are
+	 * encoded by hand: intra_op_parallelism_threads is field 2 and inter_op_parallelism_threads
+	 * is field 5, both varints. A value of zero leaves TensorFlow's own default in place.
+	 */
+	void set_parallelism(int intra_op_threads, int inter_op_threads, tf_status& status) {
+		std::string proto;
+		append_varint_field(proto, 2, intra_op_threads);
+		append_varint_field(proto, 5, inter_op_threads);
+		if (!proto.empty()) {
+			TF_SetConfig(options, proto.data(), proto.size(), status);
+		}
+	}
+
 private:
 	TF_SessionOptions *options = nullptr;
-};
\ No newline at end of file
+
+	static void append_varint_field(std::string& proto, uint32_t field, int value) {
+		if (value <= 0) {
+			return;
+		}
+		uint64_t v = static_cast<uint64_t>(value);
+		proto += static_cast<char>(field << 3);
+		while (v >= 0x80) {
+			proto += static_cast<char>((v & 0x7f) | 0x80);
+			v >>= 7;
+		}
+		proto += static_cast<char>(v);
+	}
+};
@@ -34,6 +34,10 @@ public:
 		return TF_TensorData(tensor);
 	}
 
+	size_t byte_size() const {
+		return tensor ? TF_TensorByteSize(tensor) : 0;
+	}
+
 	template<typename T> T *as() {
 		return static_cast<T *>(TF_TensorData(tensor));
 	}
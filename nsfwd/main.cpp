@@ -1,45 +1,111 @@
 #include <malloc.h>
 #include <nsfwd/stbi_image.h>
-#include <nsfwd/tf_graph.h>
-#include <nsfwd/tf_session_options.h>
-#include <nsfwd/tf_buffer.h>
-#include <nsfwd/tf_session.h>
-#include <nsfwd/tf_tensor.h>
-#include <nsfwd/tf_status.h>
-#include <nsfwd/tf_operation.h>
+#include <nsfwd/inference_backend.h>
 #include <beholder/logger.h>
 #include <nsfwd/log_aggregator.h>
 #include <nsfwd/nsfwd.h>
+#include <nsfwd/settings.h>
+#include <nsfwd/score_cache.h>
+#include <nsfwd/socket_server.h>
+#include <beholder/proc/json_frame.h>
 #include <fmt/format.h>
 #include <drogon/drogon.h>
 #include <dpp/dpp.h>
 
 using namespace drogon;
 
-int run_server() {
+/**
+ * @brief Build the JSON reply for a set of scores
+ *
+ * @param scores INDEX_COUNT scores
+ * @return drogon::HttpResponsePtr response
+ */
+static drogon::HttpResponsePtr scores_response(const float* scores) {
+	auto resp = drogon::HttpResponse::newHttpResponse();
+	resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+	resp->setBody(fmt::format(
+		fmt::runtime("{{\"drawing\":{:.6f},\"hentai\":{:.6f},\"neutral\":{:.6f},\"porn\":{:.6f},\"sexy\":{:.6f}}}\n"),
+		scores[INDEX_DRAWING],
+		scores[INDEX_HENTAI],
+		scores[INDEX_NEUTRAL],
+		scores[INDEX_PORN],
+		scores[INDEX_SEXY]
+	));
+	return resp;
+}
 
-	server_log_init();
+int run_server() {
 
-	tf_status status;
-	tf_graph graph;
-	tf_session_options session_options;
-	tf_buffer meta_graph;
+	/* Pinned before logging, TensorFlow or drogon start any threads, so they all inherit the mask */
+	load_settings("../nsfwd.json");
+	const nsfwd_settings& settings = get_settings();
+	std::string affinity_error;
+	const bool pinned = set_cpu_affinity(settings.cpu_affinity, affinity_error);
 
-	const char *tags[] = { "serve" };
+	server_log_init();
+	if (!pinned) {
+		LOG_WARN << affinity_error;
+	}
 
-	tf_session session(TF_LoadSessionFromSavedModel(session_options, nullptr, "../nsfw_model", tags, 1, graph, meta_graph, status));
-	if (!status.ok()) {
-		LOG_FATAL << "Failed to load model: " << status.message();
+	std::string load_error;
+	std::unique_ptr<inference_backend> backend = make_inference_backend(settings, load_error);
+	if (!backend) {
+		LOG_FATAL << load_error;
 		return 1;
 	}
 
-	tf_operation input_op(graph, "serve_input_1");
-	tf_operation output_op(graph, "StatefulPartitionedCall");
+	LOG_INFO << "Loaded model (" << backend->name() << ")";
+
+	/* The first run of a graph allocates its kernels and buffers, which takes far longer than
+	 * a normal inference. Pay that cost now rather than on the first real request.
+	 */
+	{
+		alignas(16) static float blank[INPUT_SIZE_SSE]{};
+		float scores[INDEX_COUNT];
+		std::string error;
+		double start = dpp::utility::time_f();
+		if (!backend->run(blank, scores, error)) {
+			LOG_FATAL << "Warm-up inference failed: " << error;
+			return 1;
+		}
+		LOG_INFO << "Warm-up inference completed (" << fmt::format(fmt::runtime("{:.2f}"), (dpp::utility::time_f() - start) * 1000.0) << "ms)";
+	}
+
+	const size_t http_threads = settings.http_threads > 0 ? settings.http_threads : std::max(1U, std::thread::hardware_concurrency() / 2);
 
-	LOG_INFO << "Loaded model";
+	score_cache cache(std::max(0, settings.score_cache_entries));
 
-	app().setThreadNum(std::thread::hardware_concurrency() / 2).setClientMaxBodySize(32 * 1024 * 1024).registerHandler( "/",
-		[&input_op, &output_op, &session](const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
+	socket_classifier classify = [&backend, &cache](std::string_view source, std::string_view data, int width, int height, float* results, std::string& error) -> uint32_t {
+		double start = dpp::utility::time_f();
+		const score_key key = score_cache::make_key(data, width > 0 ? score_input::rgba : score_input::encoded, width, height);
+
+		if (cache.find(key, results)) {
+			LOG_INFO << source << " -> Cached (" << fmt::format(fmt::runtime("{:.2f}"), (dpp::utility::time_f() - start) * 1000.0) << "ms)";
+			return 0;
+		}
+
+		std::unique_ptr<stbi_image> image = width > 0 ? std::make_unique<stbi_image>(reinterpret_cast<const unsigned char*>(data.data()), width, height) : std::make_unique<stbi_image>(data);
+		if (!*image) {
+			error = "invalid image";
+			return drogon::k400BadRequest;
+		}
+
+		alignas(16) static thread_local float input[INPUT_SIZE_SSE];
+		image->resize_and_normalise(input);
+
+		if (!backend->run(input, results, error)) {
+			return drogon::k500InternalServerError;
+		}
+
+		cache.insert(key, results);
+
+		double end = dpp::utility::time_f();
+		LOG_INFO << source << " -> Image: " << image->get_width() << "x" << image->get_height() << "x" << image->get_channels() << " (" << fmt::format(fmt::runtime("{:.2f}"), (end - start) * 1000.0) << "ms)";
+		return 0;
+	};
+
+	app().setThreadNum(http_threads).setClientMaxBodySize(32 * 1024 * 1024).registerHandler( "/",
+		[&classify](const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
 
 			auto json_error = [&](drogon::HttpStatusCode code, std::string_view message) {
 				auto body = fmt::format(fmt::runtime("{{\"error\":\"{}\"}}"), message);
@@ -51,58 +117,47 @@ int run_server() {
 				callback(resp);
 			};
 
-			double start = dpp::utility::time_f();
+			float results[INDEX_COUNT];
+			std::string error;
 
-			stbi_image image(req->body());
-			if (!image) {
-				json_error(drogon::k400BadRequest, "invalid image");
+			uint32_t status = classify("POST /", req->body(), 0, 0, results, error);
+			if (status != 0) {
+				json_error(static_cast<drogon::HttpStatusCode>(status), error);
 				return;
 			}
 
-			alignas(16) static thread_local float input[INPUT_SIZE_SSE];
-			image.resize_and_normalise(input);
-
-			int64_t input_dims[] = { 1, INPUT_HEIGHT, INPUT_WIDTH, INPUT_CHANNELS };
-
-			tf_tensor input_tensor(TF_FLOAT, input_dims, 4, INPUT_SIZE * sizeof(float));
-			if (!input_tensor) {
-				json_error(drogon::k500InternalServerError, "Tensor allocation failed");
-				return;
-			}
-
-			input_tensor.copy_from(input, INPUT_SIZE * sizeof(float));
-
-			tf_tensor output_tensor;
-			tf_status status;
-
-			session.run(input_op, input_tensor, output_op, output_tensor, status);
-			if (!status.ok()) {
-				json_error(drogon::k500InternalServerError, "Inference failed: " + status.message());
-				return;
-			}
-
-			float *results = output_tensor.as<float>();
+			callback(scores_response(results));
+		},
+		{ drogon::Post });
 
-			auto reply_body = fmt::format(
-				fmt::runtime("{{\"drawing\":{:.6f},\"hentai\":{:.6f},\"neutral\":{:.6f},\"porn\":{:.6f},\"sexy\":{:.6f}}}\n"),
-				results[INDEX_DRAWING],
-				results[INDEX_HENTAI],
-				results[INDEX_NEUTRAL],
-				results[INDEX_PORN],
-				results[INDEX_SEXY]
-			);
+	app().registerHandler("/metrics",
+		[&cache](const drogon::HttpRequestPtr &req, std::function<void(const drogon::HttpResponsePtr &)> &&callback) {
 			auto resp = drogon::HttpResponse::newHttpResponse();
 			resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
-			resp->setBody(reply_body);
-
-			double end = dpp::utility::time_f();
-			LOG_INFO << "POST / -> Image: " << image.get_width() << "x" << image.get_height() << "x" << image.get_channels() << " (" << fmt::format(fmt::runtime("{:.2f}"), (end - start) * 1000.0) << "ms)";
-
+			resp->setBody(fmt::format(
+				fmt::runtime("{{\"cache_entries\":{},\"cache_capacity\":{},\"cache_hits\":{},\"cache_misses\":{},\"cache_evictions\":{}}}\n"),
+				cache.size(), cache.capacity(), cache.hits(), cache.misses(), cache.evictions()
+			));
 			callback(resp);
 		},
-		{ drogon::Post });
-
-	drogon::app().addListener("127.0.0.1", 6969).run();
+		{ drogon::Get });
+
+	app().getLoop()->runEvery(300.0, [&cache]() {
+		LOG_INFO << "Score cache: " << cache.size() << "/" << cache.capacity() << " entries, " << cache.hits() << " hits, " << cache.misses() << " misses, " << cache.evictions() << " evictions";
+	});
+
+	/* During a restart the replacement child binds the port and takes over the socket path
+	 * while the old one is still serving, and tells the supervisor when it is listening so
+	 * the old one can be stopped.
+	 */
+	drogon::app().registerBeginningAdvice([&settings, &classify, http_threads]() {
+		if (!settings.unix_socket.empty()) {
+			start_socket_server(settings.unix_socket, classify, http_threads);
+		}
+		proc::write_frame({{"stage", "ready"}});
+	});
+
+	drogon::app().enableReusePort(true).addListener("127.0.0.1", 6969).run();
 
 	return 0;
 }
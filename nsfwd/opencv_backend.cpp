@@ -0,0 +1,100 @@
+#include <nsfwd/inference_backend.h>
+#include <nsfwd/nsfwd.h>
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A cv::dnn::Net may only run one forward pass at a time, unlike a TensorFlow session.
+ * Each concurrent request borrows a net from a fixed pool, one per HTTP thread, loaded at
+ * startup so no request ever waits on the model being parsed. When every net is busy a
+ * request waits for one to be returned. Nets share no state, so each costs one copy of
+ * the weights, but an ONNX export is far smaller than the TensorFlow runtime.
+ */
+class opencv_backend : public inference_backend {
+public:
+	bool load(const nsfwd_settings& settings, std::string& error) {
+		model_path = settings.onnx_model;
+		if (settings.intra_op_threads > 0) {
+			cv::setNumThreads(settings.intra_op_threads);
+		}
+		const size_t pool_size = settings.http_threads > 0 ? settings.http_threads : std::max(1U, std::thread::hardware_concurrency() / 2);
+		try {
+			while (free_nets.size() < pool_size) {
+				free_nets.push_back(load_net());
+			}
+		} catch (const cv::Exception& e) {
+			error = "Failed to load model: " + std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
+	bool run(const float* input, float* scores, std::string& error) override {
+		std::unique_ptr<cv::dnn::Net> net = acquire();
+
+		bool ok = false;
+		try {
+			const int dims[] = { 1, INPUT_HEIGHT, INPUT_WIDTH, INPUT_CHANNELS };
+			cv::Mat blob(4, dims, CV_32F, const_cast<float*>(input));
+			net->setInput(blob);
+			cv::Mat output = net->forward();
+			if (output.total() != INDEX_COUNT || output.type() != CV_32F) {
+				error = "Unexpected model output size";
+			} else {
+				memcpy(scores, output.ptr<float>(), INDEX_COUNT * sizeof(float));
+				ok = true;
+			}
+		} catch (const cv::Exception& e) {
+			error = "Inference failed: " + std::string(e.what());
+		}
+
+		release(std::move(net));
+		return ok;
+	}
+
+	const char* name() const override {
+		return "opencv";
+	}
+
+private:
+	std::string model_path;
+	std::mutex lock;
+	std::condition_variable net_returned;
+	std::vector<std::unique_ptr<cv::dnn::Net>> free_nets;
+
+	std::unique_ptr<cv::dnn::Net> load_net() {
+		auto net = std::make_unique<cv::dnn::Net>(cv::dnn::readNetFromONNX(model_path));
+		net->setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+		net->setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+		return net;
+	}
+
+	std::unique_ptr<cv::dnn::Net> acquire() {
+		std::unique_lock<std::mutex> guard(lock);
+		net_returned.wait(guard, [this] { return !free_nets.empty(); });
+		auto net = std::move(free_nets.back());
+		free_nets.pop_back();
+		return net;
+	}
+
+	void release(std::unique_ptr<cv::dnn::Net> net) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			free_nets.push_back(std::move(net));
+		}
+		net_returned.notify_one();
+	}
+};
+
+std::unique_ptr<inference_backend> make_opencv_backend(const nsfwd_settings& settings, std::string& error) {
+	auto backend = std::make_unique<opencv_backend>();
+	if (!backend->load(settings, error)) {
+		return nullptr;
+	}
+	return backend;
+}
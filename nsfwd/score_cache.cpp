@@ -0,0 +1,71 @@
+#include <nsfwd/score_cache.h>
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#include <cstring>
+
+score_cache::score_cache(size_t capacity) : max_entries(capacity) {
+	index.reserve(capacity);
+}
+
+score_key score_cache::make_key(std::string_view body, score_input input, int width, int height) {
+	XXH128_hash_t hash = XXH3_128bits(body.data(), body.size());
+	return { hash.low64, hash.high64, body.size(), width, height, input };
+}
+
+bool score_cache::find(const score_key& key, float* scores) {
+	if (max_entries == 0) {
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = index.find(key);
+	if (found == index.end()) {
+		miss_count++;
+		return false;
+	}
+	lru.splice(lru.begin(), lru, found->second);
+	memcpy(scores, found->second->scores, sizeof(found->second->scores));
+	hit_count++;
+	return true;
+}
+
+void score_cache::insert(const score_key& key, const float* scores) {
+	if (max_entries == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = index.find(key);
+	if (found != index.end()) {
+		/* Two requests for the same image raced through inference */
+		lru.splice(lru.begin(), lru, found->second);
+		return;
+	}
+	if (lru.size() >= max_entries) {
+		index.erase(lru.back().key);
+		lru.pop_back();
+		eviction_count++;
+	}
+	lru.push_front(entry{ key, {} });
+	memcpy(lru.front().scores, scores, sizeof(lru.front().scores));
+	index.emplace(key, lru.begin());
+}
+
+size_t score_cache::size() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return lru.size();
+}
+
+size_t score_cache::capacity() const {
+	return max_entries;
+}
+
+uint64_t score_cache::hits() const {
+	return hit_count;
+}
+
+uint64_t score_cache::misses() const {
+	return miss_count;
+}
+
+uint64_t score_cache::evictions() const {
+	return eviction_count;
+}
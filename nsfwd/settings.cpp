@@ -0,0 +1,32 @@
+#include <nsfwd/settings.h>
+#include <dpp/json.h>
+#include <fstream>
+
+static nsfwd_settings settings;
+
+void load_settings(const std::string& settings_file) {
+	std::ifstream file(settings_file);
+	if (!file) {
+		return;
+	}
+
+	dpp::json document = dpp::json::parse(file, nullptr, false);
+	if (!document.is_object()) {
+		return;
+	}
+
+	settings.backend = document.value("backend", settings.backend);
+	settings.onnx_model = document.value("onnx_model", settings.onnx_model);
+	settings.intra_op_threads = document.value("intra_op_threads", settings.intra_op_threads);
+	settings.inter_op_threads = document.value("inter_op_threads", settings.inter_op_threads);
+	settings.http_threads = document.value("http_threads", settings.http_threads);
+	settings.cpu_affinity = document.value("cpu_affinity", settings.cpu_affinity);
+	settings.restart_ready_timeout = document.value("restart_ready_timeout", settings.restart_ready_timeout);
+	settings.restart_drain_seconds = document.value("restart_drain_seconds", settings.restart_drain_seconds);
+	settings.score_cache_entries = document.value("score_cache_entries", settings.score_cache_entries);
+	settings.unix_socket = document.value("unix_socket", settings.unix_socket);
+}
+
+const nsfwd_settings& get_settings() {
+	return settings;
+}
@@ -0,0 +1,286 @@
+#include <nsfwd/socket_server.h>
+#include <nsfwd/socket_protocol.h>
+#include <nsfwd/nsfwd.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Connections served at once. tessd keeps one open per scan, so this only
+ * needs to exceed the bot's concurrent scan limit.
+ */
+constexpr int max_connections = 256;
+
+static std::atomic<int> connections{0};
+
+/**
+ * @brief Classifications waiting for an inference worker. Connection threads only do I/O,
+ * so no more requests run inference at once than there are workers.
+ */
+static std::deque<std::function<void()>> work_queue;
+static std::mutex work_mutex;
+static std::condition_variable work_available;
+
+static void inference_worker() {
+	while (true) {
+		std::function<void()> work;
+		{
+			std::unique_lock<std::mutex> lock(work_mutex);
+			work_available.wait(lock, []() { return !work_queue.empty(); });
+			work = std::move(work_queue.front());
+			work_queue.pop_front();
+		}
+		work();
+	}
+}
+
+/**
+ * @brief Run the classifier on an inference worker and wait for it to finish
+ */
+static uint32_t classify_on_worker(const socket_classifier& classifier, std::string_view data, int width, int height, float* scores, std::string& error) {
+	std::packaged_task<uint32_t()> task([&]() {
+		return classifier("UDS", data, width, height, scores, error);
+	});
+	std::future<uint32_t> result = task.get_future();
+	{
+		std::lock_guard<std::mutex> lock(work_mutex);
+		work_queue.emplace_back([&task]() { task(); });
+	}
+	work_available.notify_one();
+	return result.get();
+}
+
+/**
+ * @brief Seals a passed memfd must carry before it is mapped
+ */
+constexpr int required_seals = F_SEAL_SHRINK | F_SEAL_WRITE;
+
+static bool read_exact(int fd, void* buffer, size_t length) {
+	auto* out = static_cast<char*>(buffer);
+	while (length > 0) {
+		ssize_t r = read(fd, out, length);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		out += r;
+		length -= r;
+	}
+	return true;
+}
+
+static bool write_exact(int fd, const void* buffer, size_t length) {
+	const auto* in = static_cast<const char*>(buffer);
+	while (length > 0) {
+		ssize_t w = send(fd, in, length, MSG_NOSIGNAL);
+		if (w <= 0) {
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		in += w;
+		length -= w;
+	}
+	return true;
+}
+
+/**
+ * @brief Read a request header and any descriptor passed with it
+ *
+ * @param fd connection
+ * @param header receives the header
+ * @param passed_fd receives the passed descriptor, or -1
+ * @return false on EOF or error
+ */
+static bool read_header(int fd, nsfw_socket::request_header& header, int& passed_fd) {
+	passed_fd = -1;
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+	iovec iov{ &header, sizeof(header) };
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t r;
+	do {
+		r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	} while (r < 0 && errno == EINTR);
+	if (r <= 0) {
+		return false;
+	}
+
+	for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+			memcpy(&passed_fd, CMSG_DATA(c), sizeof(int));
+		}
+	}
+
+	if (static_cast<size_t>(r) < sizeof(header) && !read_exact(fd, reinterpret_cast<char*>(&header) + r, sizeof(header) - r)) {
+		if (passed_fd >= 0) {
+			close(passed_fd);
+		}
+		return false;
+	}
+	return true;
+}
+
+static bool send_response(int fd, uint32_t status, const float* scores, const std::string& error) {
+	nsfw_socket::response_header response;
+	response.status = status;
+	if (status == 0) {
+		memcpy(response.scores, scores, sizeof(response.scores));
+	}
+	response.error_length = status == 0 ? 0 : error.length();
+	return write_exact(fd, &response, sizeof(response)) && write_exact(fd, error.data(), response.error_length);
+}
+
+static void serve_connection(int fd, const socket_classifier& classifier) {
+	nsfw_socket::request_header header;
+	int passed_fd = -1;
+	std::string body;
+
+	while (read_header(fd, header, passed_fd)) {
+		float scores[INDEX_COUNT]{};
+		std::string error;
+		uint32_t status = 0;
+
+		if (header.magic != nsfw_socket::magic) {
+			LOG_WARN << "Socket request with invalid magic";
+			if (passed_fd >= 0) {
+				close(passed_fd);
+			}
+			break;
+		}
+
+		if (header.type == nsfw_socket::request_encoded) {
+			if (passed_fd >= 0) {
+				close(passed_fd);
+			}
+			if (header.length == 0 || header.length > nsfw_socket::max_length) {
+				LOG_WARN << "Socket request with invalid length " << header.length;
+				break;
+			}
+			body.resize(header.length);
+			if (!read_exact(fd, body.data(), body.size())) {
+				break;
+			}
+			status = classify_on_worker(classifier, body, 0, 0, scores, error);
+		} else if (header.type == nsfw_socket::request_rgba && passed_fd >= 0) {
+			const uint64_t needed = static_cast<uint64_t>(header.width) * header.height * 4;
+			struct stat st{};
+			/* An unsealed memfd could be truncated while it is mapped, which would kill us with SIGBUS */
+			const int seals = fcntl(passed_fd, F_GET_SEALS);
+			if (seals < 0 || (seals & required_seals) != required_seals) {
+				status = 400;
+				error = "memfd not sealed";
+			} else if (header.width == 0 || header.height == 0 || static_cast<uint64_t>(header.width) * header.height > nsfw_socket::max_pixels
+			    || fstat(passed_fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < needed) {
+				status = 400;
+				error = "invalid image";
+			} else {
+				void* pixels = mmap(nullptr, needed, PROT_READ, MAP_SHARED, passed_fd, 0);
+				if (pixels == MAP_FAILED) {
+					status = 500;
+					error = "mmap failed";
+				} else {
+					status = classify_on_worker(classifier, std::string_view(static_cast<const char*>(pixels), needed), header.width, header.height, scores, error);
+					munmap(pixels, needed);
+				}
+			}
+			close(passed_fd);
+		} else {
+			if (passed_fd >= 0) {
+				close(passed_fd);
+			}
+			LOG_WARN << "Socket request with invalid type " << header.type;
+			break;
+		}
+
+		if (!send_response(fd, status, scores, error)) {
+			break;
+		}
+	}
+
+	close(fd);
+	connections--;
+}
+
+bool start_socket_server(const std::string& path, socket_classifier classifier, size_t workers) {
+	sockaddr_un address{};
+	if (path.length() >= sizeof(address.sun_path)) {
+		LOG_ERROR << "Socket path too long: " << path;
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, path.c_str(), path.length() + 1);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) {
+		LOG_ERROR << "Unable to create socket: " << strerror(errno);
+		return false;
+	}
+
+	/* Bind to a temporary name and rename over the real one, so there is never a moment
+	 * where the path is missing while a previous child is still serving on it.
+	 */
+	const std::string temporary = path + "." + std::to_string(getpid());
+	memcpy(address.sun_path, temporary.c_str(), temporary.length() + 1);
+	unlink(temporary.c_str());
+	if (temporary.length() >= sizeof(address.sun_path) || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		LOG_ERROR << "Unable to listen on " << path << ": " << strerror(errno);
+		close(listener);
+		return false;
+	}
+	/* tessd runs as a different user */
+	chmod(temporary.c_str(), 0666);
+	if (rename(temporary.c_str(), path.c_str()) != 0) {
+		LOG_ERROR << "Unable to move socket to " << path << ": " << strerror(errno);
+		unlink(temporary.c_str());
+		close(listener);
+		return false;
+	}
+
+	for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i) {
+		std::thread(inference_worker).detach();
+	}
+
+	std::thread([listener, classifier = std::move(classifier)]() {
+		while (true) {
+			int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno != EINTR) {
+					LOG_WARN << "accept failed: " << strerror(errno);
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				}
+				continue;
+			}
+			if (connections >= max_connections) {
+				LOG_WARN << "Too many socket connections, refusing";
+				close(fd);
+				continue;
+			}
+			connections++;
+			std::thread(serve_connection, fd, std::cref(classifier)).detach();
+		}
+	}).detach();
+
+	LOG_INFO << "Listening on " << path;
+	return true;
+}
@@ -79,6 +79,28 @@ stbi_image::stbi_image(std::string_view body) {
 	avifDecoderDestroy(decoder);
 }
 
+stbi_image::stbi_image(const unsigned char *rgba, int rgba_width, int rgba_height) {
+	if (!rgba || rgba_width <= 0 || rgba_height <= 0 || static_cast<size_t>(rgba_width) > SIZE_MAX / static_cast<size_t>(rgba_height) / 4) {
+		return;
+	}
+
+	const size_t pixels = static_cast<size_t>(rgba_width) * static_cast<size_t>(rgba_height);
+	image = static_cast<stbi_uc *>(STBI_MALLOC(pixels * INPUT_CHANNELS));
+	if (!image) {
+		return;
+	}
+
+	for (size_t i = 0; i < pixels; ++i) {
+		image[i * 3] = rgba[i * 4];
+		image[i * 3 + 1] = rgba[i * 4 + 1];
+		image[i * 3 + 2] = rgba[i * 4 + 2];
+	}
+
+	width = rgba_width;
+	height = rgba_height;
+	channels = INPUT_CHANNELS;
+}
+
 stbi_image::~stbi_image() {
 	stbi_image_free(image);
 }
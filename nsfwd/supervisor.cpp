@@ -1,15 +1,21 @@
 #include <beholder/logger.h>
 #include <nsfwd/nsfwd.h>
 #include <nsfwd/log_aggregator.h>
+#include <nsfwd/settings.h>
+#include <beholder/proc/json_frame.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <sched.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <dpp/dpp.h>
 
 constexpr size_t max_child_rss = 8ULL * 1024 * 1024 * 1024;
 
-static size_t ticks = 0;
-
 static size_t child_rss(pid_t pid) {
 	std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
 	size_t pages = 0;
@@ -18,32 +24,172 @@ static size_t child_rss(pid_t pid) {
 	return resident * sysconf(_SC_PAGESIZE);
 }
 
+static void log_warning(const std::string& message) {
+	dpp::log_t l;
+	l.severity = dpp::ll_warning;
+	l.message = message;
+	logger::log(l);
+}
+
+/**
+ * @brief Parse a taskset style CPU list such as "0-3,8,10-11"
+ *
+ * @param list CPU list
+ * @param set receives the CPUs
+ * @return true if the list was valid and non-empty
+ */
+static bool parse_cpu_list(const std::string& list, cpu_set_t& set) {
+	CPU_ZERO(&set);
+	for (const std::string& range : dpp::utility::tokenize(list, ",")) {
+		if (range.empty()) {
+			continue;
+		}
+		size_t dash = range.find('-');
+		int first = 0, last = 0;
+		try {
+			first = std::stoi(range.substr(0, dash));
+			last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		} catch (const std::exception&) {
+			return false;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE) {
+			return false;
+		}
+		for (int cpu = first; cpu <= last; ++cpu) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return CPU_COUNT(&set) > 0;
+}
+
+bool set_cpu_affinity(const std::string& list, std::string& error) {
+	if (list.empty()) {
+		return true;
+	}
+	cpu_set_t set;
+	if (!parse_cpu_list(list, set)) {
+		error = "nsfwd cpu_affinity is invalid, not pinning: " + list;
+		return false;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		error = "nsfwd failed to set CPU affinity: " + std::string(strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief A running nsfwd child and the thread draining its stdout into the log.
+ * The reader watches for the ready frame the child writes once it is serving.
+ */
+struct child_process {
+	spawn process;
+	std::thread reader;
+	std::atomic<bool> ready{false};
+	std::atomic<bool> finished{false};
+
+	explicit child_process(const char* const argv[]) : process(argv) {
+		reader = std::thread([this]() {
+			std::string line;
+			while (std::getline(process.stdout, line)) {
+				size_t marker = line.find(proc::json_marker);
+				if (marker == std::string::npos) {
+					log_child_line(line);
+					continue;
+				}
+				dpp::json frame = dpp::json::parse(line.substr(marker + proc::json_marker.length()), nullptr, false);
+				if (frame.is_object() && frame.value("stage", "") == "ready") {
+					ready = true;
+				}
+			}
+			finished = true;
+		});
+	}
+
+	/**
+	 * @brief Wait for the child to report it is serving
+	 *
+	 * @param timeout seconds to wait
+	 * @return true if the child is ready, false if it exited or timed out
+	 */
+	bool wait_ready(int timeout) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+		while (!ready && !finished && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		return ready && !finished;
+	}
+
+	/**
+	 * @brief Stop the child. It is asked to quit with SIGTERM, and killed if it
+	 * has not exited within a few seconds.
+	 */
+	void stop() {
+		pid_t pid = process.get_pid();
+		kill(pid, SIGTERM);
+		for (int i = 0; i < 100 && waitpid(pid, nullptr, WNOHANG) == 0; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		if (waitpid(pid, nullptr, WNOHANG) == 0) {
+			log_warning("nsfwd child " + std::to_string(pid) + " did not exit, killing it");
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0);
+		}
+		reader.join();
+	}
+
+	/**
+	 * @brief Reap a child which has already exited by itself
+	 */
+	void reap() {
+		process.wait();
+		reader.join();
+	}
+};
+
+static std::unique_ptr<child_process> start_child(const char* self) {
+	const char *args[] = { self, "--child", nullptr };
+	return std::make_unique<child_process>(args);
+}
+
 [[noreturn]] void run_supervisor(const char* self) {
 	logger::init("nsfwd-logs/nsfwd.log");
+	load_settings("../nsfwd.json");
+	const nsfwd_settings& settings = get_settings();
+
+	auto current = start_child(self);
+	time_t retry_after = 0;
 
 	while (true) {
-		const char *args[] = { self, "--child", nullptr };
-		spawn child(args);
-		std::string line;
+		std::this_thread::sleep_for(std::chrono::seconds(1));
 
-		while (std::getline(child.stdout, line)) {
-			log_child_line(line);
-			ticks++;
+		if (current->finished) {
+			/* Crashed or exited on its own, there is nothing left to hand over from */
+			log_warning("nsfwd child exited unexpectedly, restarting");
+			current->reap();
+			current = start_child(self);
+			continue;
+		}
 
-			if (ticks % 10) {
-				continue;
-			}
-			if (child_rss(child.get_pid()) > max_child_rss) {
-				dpp::log_t l;
-				l.severity = dpp::ll_warning;
-				l.message = "nsfwd child exceeded memory limit, restarting";
-				logger::log(l);
-
-				kill(child.get_pid(), SIGTERM);
-				break;
-			}
+		if (time(nullptr) < retry_after || child_rss(current->process.get_pid()) <= max_child_rss) {
+			continue;
+		}
+
+		/* Bring up the replacement while the old child is still serving. Both bind the
+		 * port with SO_REUSEPORT, so once the replacement is listening new connections
+		 * are shared between them, and the old child can be stopped after a short drain.
+		 */
+		log_warning("nsfwd child exceeded memory limit, starting replacement");
+		auto replacement = start_child(self);
+		if (!replacement->wait_ready(settings.restart_ready_timeout)) {
+			log_warning("nsfwd replacement child did not become ready, keeping the current child");
+			replacement->stop();
+			retry_after = time(nullptr) + 60;
+			continue;
 		}
 
-		child.wait();
+		std::this_thread::sleep_for(std::chrono::seconds(settings.restart_drain_seconds));
+		current->stop();
+		current = std::move(replacement);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,99 @@
+#include <nsfwd/inference_backend.h>
+#include <nsfwd/nsfwd.h>
+#include <nsfwd/tf_graph.h>
+#include <nsfwd/tf_session_options.h>
+#include <nsfwd/tf_buffer.h>
+#include <nsfwd/tf_session.h>
+#include <nsfwd/tf_tensor.h>
+#include <nsfwd/tf_status.h>
+#include <nsfwd/tf_operation.h>
+
+class tensorflow_backend : public inference_backend {
+public:
+	bool load(const nsfwd_settings& settings, std::string& error) {
+		tf_status status;
+		tf_session_options session_options;
+		tf_buffer meta_graph;
+
+		session_options.set_parallelism(settings.intra_op_threads, settings.inter_op_threads, status);
+		if (!status.ok()) {
+			error = "Failed to set session options: " + status.message();
+			return false;
+		}
+
+		const char *tags[] = { "serve" };
+
+		session = std::make_unique<tf_session>(TF_LoadSessionFromSavedModel(session_options, nullptr, "../nsfw_model", tags, 1, graph, meta_graph, status));
+		if (!status.ok()) {
+			error = "Failed to load model: " + status.message();
+			return false;
+		}
+
+		try {
+			input_op = std::make_unique<tf_operation>(graph, "serve_input_1");
+			output_op = std::make_unique<tf_operation>(graph, "StatefulPartitionedCall");
+		} catch (const std::exception& e) {
+			error = e.what();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool run(const float* input, float* scores, std::string& error) override {
+		int64_t input_dims[] = { 1, INPUT_HEIGHT, INPUT_WIDTH, INPUT_CHANNELS };
+
+		tf_tensor input_tensor(TF_FLOAT, input_dims, 4, INPUT_SIZE * sizeof(float));
+		if (!input_tensor) {
+			error = "Tensor allocation failed";
+			return false;
+		}
+
+		input_tensor.copy_from(input, INPUT_SIZE * sizeof(float));
+
+		tf_tensor output_tensor;
+		tf_status status;
+
+		session->run(*input_op, input_tensor, *output_op, output_tensor, status);
+		if (!status.ok()) {
+			error = "Inference failed: " + status.message();
+			return false;
+		}
+
+		if (output_tensor.byte_size() != INDEX_COUNT * sizeof(float)) {
+			error = "Unexpected model output size";
+			return false;
+		}
+
+		memcpy(scores, output_tensor.as<float>(), INDEX_COUNT * sizeof(float));
+		return true;
+	}
+
+	const char* name() const override {
+		return "tensorflow";
+	}
+
+private:
+	tf_graph graph;
+	std::unique_ptr<tf_session> session;
+	std::unique_ptr<tf_operation> input_op;
+	std::unique_ptr<tf_operation> output_op;
+};
+
+std::unique_ptr<inference_backend> make_tensorflow_backend(const nsfwd_settings& settings, std::string& error) {
+	auto backend = std::make_unique<tensorflow_backend>();
+	if (!backend->load(settings, error)) {
+		return nullptr;
+	}
+	return backend;
+}
+
+std::unique_ptr<inference_backend> make_inference_backend(const nsfwd_settings& settings, std::string& error) {
+	if (settings.backend == "tensorflow") {
+		return make_tensorflow_backend(settings, error);
+	} else if (settings.backend == "opencv") {
+		return make_opencv_backend(settings, error);
+	}
+	error = "Unknown inference backend: " + settings.backend;
+	return nullptr;
+}
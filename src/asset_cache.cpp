@@ -0,0 +1,157 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/asset_cache.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <deque>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+	constexpr size_t max_assets = 65536;
+
+	/**
+	 * @brief Verdicts kept per asset, the oldest is dropped beyond this
+	 */
+	constexpr size_t max_verdicts = 16;
+
+	/**
+	 * @brief Hosts which serve stickers and emoji. The key is the rest of the URL.
+	 */
+	constexpr std::string_view asset_hosts[] = {
+		"https://cdn.discordapp.com/",
+		"https://media.discordapp.net/",
+	};
+
+	constexpr std::string_view asset_kinds[] = {
+		"stickers/",
+		"emojis/",
+	};
+
+	std::unordered_map<std::string, asset_cache::entry> assets;
+
+	/**
+	 * @brief Keys in the order they were added, oldest first, for eviction
+	 */
+	std::deque<std::string> added_order;
+
+	/**
+	 * @brief Guards assets and added_order
+	 */
+	std::mutex assets_mutex;
+
+	/**
+	 * @brief Find or add the entry for a key. Call with assets_mutex held.
+	 */
+	asset_cache::entry& entry_for(const std::string& key, const std::string& hash) {
+		auto [found, added] = assets.try_emplace(key);
+		if (added) {
+			added_order.push_back(key);
+			while (assets.size() > max_assets) {
+				assets.erase(added_order.front());
+				added_order.pop_front();
+			}
+			found = assets.find(key);
+		}
+		if (found->second.hash != hash) {
+			found->second = { .hash = hash };
+		}
+		return found->second;
+	}
+}
+
+namespace asset_cache {
+
+	const url_cache::verdict* entry::find(dpp::snowflake guild_id, dpp::snowflake channel_id, uint64_t settings_version) const {
+		for (const url_cache::verdict& verdict : verdicts) {
+			if (verdict.guild_id == guild_id && verdict.channel_id == channel_id && verdict.settings_version == settings_version) {
+				return &verdict;
+			}
+		}
+		return nullptr;
+	}
+
+	std::optional<std::string> asset_key(const std::string& url) {
+		const std::string_view text(url);
+		for (std::string_view host : asset_hosts) {
+			if (!text.starts_with(host)) {
+				continue;
+			}
+			const std::string_view path = text.substr(host.size());
+			for (std::string_view kind : asset_kinds) {
+				if (!path.starts_with(kind)) {
+					continue;
+				}
+				const char* start = path.data() + kind.size();
+				const char* end = path.data() + path.size();
+				uint64_t id = 0;
+				auto [next, error] = std::from_chars(start, end, id);
+				/* The ID must be followed by an extension and nothing else. A query such
+				 * as ?size=16 can change the image served, so those are not cached.
+				 */
+				if (error != std::errc() || next == start || next == end || *next != '.' || id == 0) {
+					return std::nullopt;
+				}
+				const std::string_view extension(next + 1, end - next - 1);
+				if (extension.empty() || !std::all_of(extension.begin(), extension.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)); })) {
+					return std::nullopt;
+				}
+				return std::string(path);
+			}
+			return std::nullopt;
+		}
+		return std::nullopt;
+	}
+
+	std::optional<entry> get(const std::string& key) {
+		std::lock_guard<std::mutex> lock(assets_mutex);
+		auto found = assets.find(key);
+		if (found == assets.end()) {
+			return std::nullopt;
+		}
+		return found->second;
+	}
+
+	void store_hash(const std::string& key, const std::string& hash) {
+		std::lock_guard<std::mutex> lock(assets_mutex);
+		entry_for(key, hash);
+	}
+
+	void store_verdict(const std::string& key, const std::string& hash, const url_cache::verdict& result) {
+		std::lock_guard<std::mutex> lock(assets_mutex);
+		std::vector<url_cache::verdict>& verdicts = entry_for(key, hash).verdicts;
+		/* A newer settings version for the same channel replaces the old verdict */
+		std::erase_if(verdicts, [&result](const url_cache::verdict& verdict) {
+			return verdict.guild_id == result.guild_id && verdict.channel_id == result.channel_id;
+		});
+		if (verdicts.size() >= max_verdicts) {
+			verdicts.erase(verdicts.begin());
+		}
+		verdicts.push_back(result);
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(assets_mutex);
+		return assets.size();
+	}
+};
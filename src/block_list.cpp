@@ -0,0 +1,179 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/block_list.h>
+#include <beholder/database.h>
+#include <beholder/hex.h>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+
+namespace {
+
+	struct item {
+		uint64_t guild_id{0};
+		std::array<uint8_t, 32> hash{};
+
+		auto operator<=>(const item&) const = default;
+	};
+
+	/**
+	 * @brief A change made by the bot while a reload was running
+	 */
+	struct change {
+		item entry;
+		bool added{false};
+	};
+
+	/**
+	 * @brief Block list entries, sorted
+	 */
+	std::vector<item> items;
+
+	/**
+	 * @brief True once the first load has completed
+	 */
+	bool loaded{false};
+
+	/**
+	 * @brief True while load() is reading the table
+	 */
+	bool reloading{false};
+
+	/**
+	 * @brief Changes made while reloading, applied to the new list before it replaces the old one
+	 */
+	std::vector<change> changes_during_reload;
+
+	/**
+	 * @brief Guards everything above
+	 */
+	std::shared_mutex items_mutex;
+
+	/**
+	 * @brief Serialises load()
+	 */
+	std::mutex load_mutex;
+
+	/**
+	 * @brief Make an item from a binary hash, as stored in block_list_items
+	 */
+	std::optional<item> make_item(dpp::snowflake guild_id, std::string_view key) {
+		item i{ .guild_id = guild_id };
+		if (key.length() != i.hash.size()) {
+			return std::nullopt;
+		}
+		std::copy(key.begin(), key.end(), i.hash.begin());
+		return i;
+	}
+
+	/**
+	 * @brief Make an item from a hex hash, as reported by tessd
+	 */
+	std::optional<item> make_item_from_hex(dpp::snowflake guild_id, std::string_view hash) {
+		std::optional<std::string> key = hex::decode(hash);
+		return key ? make_item(guild_id, *key) : std::nullopt;
+	}
+
+	void apply(std::vector<item>& list, const change& c) {
+		auto position = std::lower_bound(list.begin(), list.end(), c.entry);
+		bool present = position != list.end() && *position == c.entry;
+		if (c.added && !present) {
+			list.insert(position, c.entry);
+		} else if (!c.added && present) {
+			list.erase(position);
+		}
+	}
+
+	void record(const change& c) {
+		std::unique_lock lock(items_mutex);
+		apply(items, c);
+		if (reloading) {
+			changes_during_reload.push_back(c);
+		}
+	}
+}
+
+namespace block_list {
+
+	void load() {
+		std::lock_guard<std::mutex> serialise(load_mutex);
+		{
+			std::unique_lock lock(items_mutex);
+			reloading = true;
+			changes_during_reload.clear();
+		}
+
+		db::result rows = db::execute("SELECT guild_id, hash FROM block_list_items");
+		std::vector<item> fresh;
+		fresh.reserve(rows.size());
+		for (size_t row = 0; row < rows.size(); ++row) {
+			std::optional<item> entry = make_item(rows.get<dpp::snowflake>(row, 0), rows.get<std::string_view>(row, 1));
+			if (entry) {
+				fresh.push_back(*entry);
+			}
+		}
+		std::sort(fresh.begin(), fresh.end());
+		fresh.erase(std::unique(fresh.begin(), fresh.end()), fresh.end());
+
+		std::unique_lock lock(items_mutex);
+		reloading = false;
+		if (!db::error().empty()) {
+			/* Keep what we have rather than replacing it with an empty list */
+			changes_during_reload.clear();
+			return;
+		}
+		for (const change& c : changes_during_reload) {
+			apply(fresh, c);
+		}
+		changes_during_reload.clear();
+		items = std::move(fresh);
+		loaded = true;
+	}
+
+	bool contains(dpp::snowflake guild_id, const std::string& hash) {
+		std::optional<item> entry = make_item_from_hex(guild_id, hash);
+		if (entry) {
+			std::shared_lock lock(items_mutex);
+			if (loaded) {
+				return std::binary_search(items.begin(), items.end(), *entry);
+			}
+		}
+		return !db::execute("SELECT 1 FROM block_list_items WHERE guild_id = ? AND hash = ?", {guild_id, db::hash_key(hash)}).empty();
+	}
+
+	void add(dpp::snowflake guild_id, const std::string& hash) {
+		if (std::optional<item> entry = make_item_from_hex(guild_id, hash)) {
+			record({ .entry = *entry, .added = true });
+		}
+	}
+
+	void remove(dpp::snowflake guild_id, const std::string& hash) {
+		if (std::optional<item> entry = make_item_from_hex(guild_id, hash)) {
+			record({ .entry = *entry, .added = false });
+		}
+	}
+
+	size_t size() {
+		std::shared_lock lock(items_mutex);
+		return items.size();
+	}
+};
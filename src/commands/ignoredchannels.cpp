@@ -19,6 +19,7 @@
  ************************************************************************************/
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
 #include <beholder/commands/ignoredchannels.h>
 #include <beholder/database.h>
 
@@ -31,9 +32,11 @@ dpp::slashcommand ignoredchannels_command::register_command(dpp::cluster& bot)
 		}
 		if (event.custom_id == "ignore_add_select_menu") {
 			db::query("INSERT INTO guild_ignored_channels (guild_id, channel_id) VALUES(?, ?) ON DUPLICATE KEY UPDATE channel_id = ?", { event.command.guild_id, event.values[0], event.values[0] });
+			guild_settings::invalidate(event.command.guild_id);
 			event.reply(dpp::message("✅ Ignored channel <#" + event.values[0] + ">").set_flags(dpp::m_ephemeral));
 		} else if (event.custom_id == "ignore_del_select_menu") {
 			db::query("DELETE FROM guild_ignored_channels WHERE guild_id = ? AND channel_id = ?", { event.command.guild_id, event.values[0] });
+			guild_settings::invalidate(event.command.guild_id);
 			if (db::affected_rows() == 1) {
 				event.reply(dpp::message("✅ No longer ignoring channel <#" + event.values[0] + ">").set_flags(dpp::m_ephemeral));
 			} else {
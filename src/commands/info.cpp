@@ -22,6 +22,7 @@
 #include <beholder/commands/info.h>
 #include <beholder/database.h>
 #include <beholder/listeners.h>
+#include <fmt/format.h>
 
 dpp::slashcommand info_command::register_command(dpp::cluster& bot)
 {
@@ -70,6 +71,8 @@ void info_command::route(const dpp::slashcommand_t &event) {
 		blocked_today = stats[0].at("images_deleted");
 	}
 
+	db::pool_statistics pool = db::pool_stats();
+
 	dpp::embed embed = dpp::embed()
 		.set_url("https://beholder.cc/")
 		.set_title("Beholder Information")
@@ -90,6 +93,7 @@ void info_command::route(const dpp::slashcommand_t &event) {
 		.add_field("Total Users", user_count, true)
 		.add_field("Log Channel", log_channel.length() ? "<#" + log_channel + ">" : "(not set)", true)
 		.add_field("Scans In Progress", std::to_string(tessd_process_count()), true)
+		.add_field("Database Pool", fmt::format(fmt::runtime("{}/{} in use"), pool.size - pool.idle, pool.size), true)
 		.add_field("Debugging", is_gdb() ? ":white_check_mark: Yes" : "<:wc_rs:667695516737470494> No", true)
 		.add_field("Guild Members Intent", ":white_check_mark: Yes", true)
 		.add_field("Message Content Intent", ":white_check_mark: Yes", true)
@@ -19,6 +19,7 @@
  ************************************************************************************/
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
 #include <beholder/commands/logchannel.h>
 #include <beholder/database.h>
 
@@ -33,6 +34,7 @@ dpp::slashcommand logchannel_command::register_command(dpp::cluster& bot)
 			}
 
 			db::query("INSERT INTO guild_config (guild_id, log_channel) VALUES(?, ?) ON DUPLICATE KEY UPDATE log_channel = ?", { event.command.guild_id, event.values[0], event.values[0] });
+			guild_settings::invalidate(event.command.guild_id);
 			event.reply(dpp::message("✅ Log channel set").set_flags(dpp::m_ephemeral));
 		}
 	});
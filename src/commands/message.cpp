@@ -19,6 +19,7 @@
  ************************************************************************************/
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
 #include <beholder/commands/message.h>
 #include <beholder/database.h>
 
@@ -32,6 +33,7 @@ dpp::slashcommand message_command::register_command(dpp::cluster& bot)
 				"INSERT INTO guild_config (guild_id, embed_title, embed_body) VALUES(?, ?, ?) ON DUPLICATE KEY UPDATE embed_title = ?, embed_body = ?",
 				{ event.command.guild_id, embed_title, embed_body, embed_title, embed_body }
 			);
+			guild_settings::invalidate(event.command.guild_id);
 			/* Replace @user with the user's mention for preview */
 			embed_body = replace_string(embed_body, "@user", "<@" + event.command.usr.id.str() + ">");
 			event.reply(
@@ -95,9 +97,11 @@ void message_command::route(const dpp::slashcommand_t &event)
 
 	} else if (subcommand.name == "enable") {
 		db::query("UPDATE guild_config SET embeds_disabled = 0 WHERE guild_id = ?", { event.command.guild_id });
+		guild_settings::invalidate(event.command.guild_id);
 		event.reply(dpp::message("✅ Messages __**will be sent**__ to the channel where beholder deletes images.").set_flags(dpp::m_ephemeral));
 	} else if (subcommand.name == "disable") {
 		db::query("UPDATE guild_config SET embeds_disabled = 1 WHERE guild_id = ?", { event.command.guild_id });
+		guild_settings::invalidate(event.command.guild_id);
 		event.reply(dpp::message("✅ Messages __**will not be sent**__ to the channel where beholder deletes images\nBeholder will still send audit log entries, if configured.").set_flags(dpp::m_ephemeral));
 	}
 }
\ No newline at end of file
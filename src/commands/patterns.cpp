@@ -19,6 +19,8 @@
  ************************************************************************************/
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
+#include <beholder/regex_set.h>
 #include <beholder/commands/patterns.h>
 
 dpp::slashcommand patterns_command::register_command(dpp::cluster& bot)
@@ -31,6 +33,7 @@ dpp::slashcommand patterns_command::register_command(dpp::cluster& bot)
 					dpp::command_option(dpp::co_channel, "channel", "Only apply this pattern to a specific channel", false)
 						.add_channel_type(dpp::CHANNEL_TEXT)
 				)
+				.add_option(dpp::command_option(dpp::co_boolean, "regex", "Treat the pattern as a regular expression", false))
 		)
 		.add_option(
 			dpp::command_option(dpp::co_sub_command, "delete", "Delete a pattern")
@@ -54,16 +57,28 @@ void patterns_command::route(const dpp::slashcommand_t &event)
 	bool has_channel = std::holds_alternative<dpp::snowflake>(channel_param);
 
 	if (action == "add") {
+		dpp::command_value regex_param = event.get_parameter("regex");
+		bool is_regex = std::holds_alternative<bool>(regex_param) && std::get<bool>(regex_param);
+
+		if (is_regex) {
+			if (std::optional<std::string> error = regex::regex_set::validate(pattern)) {
+				event.reply(dpp::message("❌ Invalid regular expression: " + *error).set_flags(dpp::m_ephemeral));
+				return;
+			}
+		}
+
+		const std::string pattern_type = is_regex ? "regex" : "glob";
+
 		if (has_channel) {
 			dpp::snowflake channel_id = std::get<dpp::snowflake>(channel_param);
 			db::query(
-				"INSERT INTO guild_patterns (guild_id, channel_id, pattern) VALUES(?, ?, ?)",
-				{ event.command.guild_id, channel_id, pattern }
+				"INSERT INTO guild_patterns (guild_id, channel_id, pattern, pattern_type) VALUES(?, ?, ?, ?)",
+				{ event.command.guild_id, channel_id, pattern, pattern_type }
 			);
 		} else {
 			db::query(
-				"INSERT INTO guild_patterns (guild_id, pattern) VALUES(?, ?)",
-				{ event.command.guild_id, pattern }
+				"INSERT INTO guild_patterns (guild_id, pattern, pattern_type) VALUES(?, ?, ?)",
+				{ event.command.guild_id, pattern, pattern_type }
 			);
 		}
 
@@ -72,6 +87,8 @@ void patterns_command::route(const dpp::slashcommand_t &event)
 			return;
 		}
 
+		guild_settings::invalidate(event.command.guild_id);
+
 		event.reply(dpp::message("✅ Pattern added").set_flags(dpp::m_ephemeral));
 		return;
 	}
@@ -95,6 +112,8 @@ void patterns_command::route(const dpp::slashcommand_t &event)
 			return;
 		}
 
+		guild_settings::invalidate(event.command.guild_id);
+
 		event.reply(dpp::message("✅ Pattern deleted").set_flags(dpp::m_ephemeral));
 	}
 }
@@ -19,6 +19,7 @@
  ************************************************************************************/
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
 #include <beholder/commands/roles.h>
 #include <beholder/database.h>
 
@@ -61,6 +62,7 @@ dpp::slashcommand roles_command::register_command(dpp::cluster& bot)
 			}
 
 			db::commit();
+			guild_settings::invalidate(event.command.guild_id);
 			event.reply(dpp::message("✅ Bypass roles set").set_flags(dpp::m_ephemeral));
 		}
 	});
@@ -22,6 +22,7 @@
 #include <beholder/reactor.h>
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/statistics.h>
 #include <beholder/commands/scan.h>
 
 dpp::slashcommand scan_command::register_command(dpp::cluster& bot)
@@ -49,11 +50,11 @@ void scan_command::route(const dpp::slashcommand_t& event)
 	dpp::snowflake file_id = std::get<dpp::snowflake>(event.get_parameter("file"));
 	dpp::attachment attach = event.command.get_resolved_attachment(file_id);
 
-	dpp::message_create_t msg;
-	msg.msg.guild_id = event.command.guild_id;
-	msg.msg.channel_id = event.command.channel_id;
+	scan_source source(attach, nullptr);
+	source.guild_id = event.command.guild_id;
+	source.channel_id = event.command.channel_id;
 
-	scanner_reactor::instance().submit(attach, *bot, msg, [event, bot, attach](const std::string& hash, const json& scan_response) {
+	scanner_reactor::instance().submit({source}, *bot, [event, bot, attach](const scan_source&, const std::string& hash, const json& scan_response) {
 		std::vector<std::string> matches;
 		std::vector<std::string> match_names;
 		bool is_blocked = false;
@@ -109,7 +110,7 @@ void scan_command::route(const dpp::slashcommand_t& event)
 		}
 
 		bot->log(dpp::ll_info, "Manual scan: " + attach.url);
-		INCREMENT_STATISTIC("images_scanned", event.command.guild_id);
+		statistics::increment(statistics::images_scanned, event.command.guild_id);
 
 		event.edit_response(msg);
 	});
@@ -21,11 +21,20 @@
 #include <beholder/beholder.h>
 #include <beholder/database.h>
 #include <beholder/config.h>
+#include <beholder/hex.h>
 #include <mysql/mysql.h>
 #include <fmt/format.h>
 #include <iostream>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <thread>
+#include <memory>
 #include <sstream>
 #include <type_traits>
 
@@ -70,30 +79,95 @@ namespace db {
 	};
 
 	/**
-	 * @brief MySQL database connection
+	 * @brief One pooled MySQL connection, with its own prepared statement cache.
+	 * Prepared statements belong to the connection they were prepared on.
 	 */
-	MYSQL connection;
+	struct connection {
+		/**
+		 * @brief MySQL connection handle
+		 */
+		MYSQL handle;
+
+		/**
+		 * @brief True if handle is connected
+		 */
+		bool connected{false};
+
+		/**
+		 * @brief True if the server dropped the connection during a query. Its statements may
+		 * still be in use by that query, so it is reset when it is next checked out or returned.
+		 */
+		bool needs_reset{false};
+
+		/**
+		 * @brief Query cache, a map of cached_query
+		 */
+		std::map<std::string, cached_query> cached_queries;
+	};
+
+	/**
+	 * @brief All pooled connections
+	 */
+	std::vector<std::unique_ptr<connection>> connections;
+
+	/**
+	 * @brief Connections not currently checked out
+	 */
+	std::vector<connection*> idle_connections;
+
+	/**
+	 * @brief Guards connections and idle_connections.
+	 * A connection may only be used by the thread which checked it out.
+	 */
+	std::mutex pool_mutex;
+
+	/**
+	 * @brief Signalled when a connection is returned to the pool
+	 */
+	std::condition_variable pool_available;
+
+	/**
+	 * @brief Credentials used to (re)connect pooled connections
+	 */
+	struct {
+		std::string host, user, pass, db;
+		int port{3306};
+	} credentials;
+
+	/**
+	 * @brief Number of connections created by connect(), set from config by init()
+	 */
+	size_t pool_size{8};
+
+	/**
+	 * @brief Connection held by this thread between transaction() and commit() or rollback()
+	 */
+	thread_local connection* pinned{nullptr};
 
 	/**
-	 * @brief Database mutex
-	 * one connection may only be accessed by one thread at a time!
+	 * @brief Last error string from MySQL, for the calling thread
 	 */
-	std::mutex db_mutex;
+	thread_local std::string last_error;
 
 	/**
-	 * @brief Last error string from MySQL
+	 * @brief Number of affected rows from the calling thread's last INSERT, UPDATE or DELETE
 	 */
-	std::string last_error;
+	thread_local size_t rows_affected{0};
 
 	/**
 	 * @brief Total number of queries since connection
 	 */
-	size_t query_total{0};
+	std::atomic<size_t> query_total{0};
+
+	/**
+	 * @brief Prepared statements across all connections
+	 */
+	std::atomic<size_t> statement_total{0};
 
 	/**
-	 * @brief Number of affected rows from last INSERT, UPDATE or DELETE
+	 * @brief Pool checkout counters
 	 */
-	size_t rows_affected{0};
+	std::atomic<uint64_t> checkout_total{0}, wait_total{0}, wait_microseconds{0}, max_wait_microseconds{0};
 
 	/**
 	 * @brief Creating D++ cluster, used for logging
@@ -101,9 +175,29 @@ namespace db {
 	dpp::cluster* creator{nullptr};
 
 	/**
-	 * @brief Query cache, a map of cached_query
+	 * @brief Threads running background() work and query_async() queries
+	 */
+	std::vector<std::thread> workers;
+
+	/**
+	 * @brief Work waiting for a worker thread
 	 */
-	std::map<std::string, cached_query> cached_queries;
+	std::deque<std::function<void()>> work_queue;
+
+	/**
+	 * @brief Guards work_queue and workers_stopping
+	 */
+	std::mutex work_mutex;
+
+	/**
+	 * @brief Signalled when work is queued or the workers are stopping
+	 */
+	std::condition_variable work_available;
+
+	/**
+	 * @brief Set by close() to end the worker threads
+	 */
+	bool workers_stopping{false};
 
 	/**
 	 * @brief Cached query result parameters
@@ -113,41 +207,23 @@ namespace db {
 		const paramlist parameters;
 	};
 
-	/**
-	 * @brief Cached query result records with expiry
-	 */
-	struct cached_query_result_set {
-		const resultset results;
-		const double expiry;
-	};
-
-	template<class> inline constexpr bool always_false_v = false;
-
 	struct cached_query_hash {
 		std::size_t operator()(const cached_query_results& k) const {
 			size_t x = std::hash<std::string>()(k.format);
+			/* Order matters, so each value is mixed into the running hash rather than
+			 * XORed with it. The type is included so that 1 and "1" differ.
+			 */
+			auto combine = [&x](size_t h) {
+				x ^= h + 0x9e3779b97f4a7c15ULL + (x << 6) + (x >> 2);
+			};
 			for (const auto& param : k.parameters) {
-				std::visit([&x](auto &&p) {
+				combine(param.index());
+				std::visit([&combine](auto &&p) {
 					using T = std::decay_t<decltype(p)>;
-					// float, std::string, uint64_t, int64_t, bool, int32_t, uint32_t, double
-					if constexpr (std::is_same_v<T, float>) {
-						x ^= std::hash<float>()(p);
-					} else if constexpr (std::is_same_v<T, std::string>) {
-						x ^= std::hash<std::string>()(p);
-					} else if constexpr (std::is_same_v<T, uint64_t>) {
-						x ^= std::hash<uint64_t>()(p);
-					} else if constexpr (std::is_same_v<T, int64_t>) {
-						x ^= std::hash<int64_t>()(p);
-					} else if constexpr (std::is_same_v<T, bool>) {
-						x ^= std::hash<bool>()(p);
-					} else if constexpr (std::is_same_v<T, int32_t>) {
-						x ^= std::hash<int32_t>()(p);
-					} else if constexpr (std::is_same_v<T, uint32_t>) {
-						x ^= std::hash<uint32_t>()(p);
-					} else if constexpr (std::is_same_v<T, double>) {
-						x ^= std::hash<double>()(p);
+					if constexpr (std::is_same_v<T, binary>) {
+						combine(std::hash<std::string>()(p.bytes));
 					} else {
-						static_assert(always_false_v<T>, "non-exhaustive visitor!");
+						combine(std::hash<T>()(p));
 					}
 				}, param);
 			}
@@ -157,63 +233,366 @@ namespace db {
 	
 	struct cached_query_equal {
 		bool operator()(const cached_query_results& lhs, const cached_query_results& rhs) const {
-			if (lhs.format != rhs.format || lhs.parameters.size() != rhs.parameters.size()) {
-				return false;
-			}
-			return lhs.parameters == rhs.parameters;
+			return lhs.format == rhs.format && lhs.parameters == rhs.parameters;
 		}
 	};
 
 	/**
-	 * @brief A map of cached, executed queries with results and expiries
+	 * @brief A cached resultset, its expiry, and the memory it is estimated to use
+	 */
+	struct cached_query_result_set {
+		cached_query_results key;
+		resultset results;
+		double expiry;
+		size_t bytes;
+	};
+
+	/**
+	 * @brief Cached resultsets, most recently used first
+	 */
+	std::list<cached_query_result_set> cached_query_lru;
+
+	/**
+	 * @brief Index into cached_query_lru
+	 */
+	std::unordered_map<cached_query_results, std::list<cached_query_result_set>::iterator, cached_query_hash, cached_query_equal> cached_query_res;
+
+	/**
+	 * @brief Guards cached_query_lru, cached_query_res and the counters below
+	 */
+	std::mutex cached_query_res_mutex;
+
+	/**
+	 * @brief Most memory the result cache may use, set from "result_cache_bytes" in the config
+	 */
+	size_t result_cache_limit{32 * 1024 * 1024};
+
+	/**
+	 * @brief Estimated memory used by the result cache
+	 */
+	size_t result_cache_bytes{0};
+
+	uint64_t result_cache_hits{0};
+	uint64_t result_cache_misses{0};
+	uint64_t result_cache_evictions{0};
+
+	/**
+	 * @brief Time of the last sweep for expired results
+	 */
+	double last_result_sweep{0};
+
+	/**
+	 * @brief Seconds between sweeps for expired results
+	 */
+	constexpr double result_sweep_interval = 30;
+
+	/**
+	 * @brief Estimate the memory held by a cached resultset. This counts string
+	 * contents and a fixed overhead for each map node, which is close enough to
+	 * keep the cache within its limit.
+	 */
+	size_t estimate_bytes(const cached_query_results& key, const resultset& results) {
+		constexpr size_t node_overhead = 64;
+		size_t bytes = sizeof(cached_query_result_set) + node_overhead * 2 + key.format.capacity();
+		for (const auto& param : key.parameters) {
+			bytes += sizeof(param);
+			if (const std::string* text = std::get_if<std::string>(&param)) {
+				bytes += text->capacity();
+			} else if (const binary* data = std::get_if<binary>(&param)) {
+				bytes += data->bytes.capacity();
+			}
+		}
+		for (const row& r : results) {
+			bytes += sizeof(row);
+			for (const auto& field : r) {
+				bytes += node_overhead + field.first.capacity() + field.second.capacity();
+			}
+		}
+		return bytes;
+	}
+
+	/**
+	 * @brief Remove a cached resultset. The caller holds cached_query_res_mutex.
+	 */
+	void erase_cached_result(std::list<cached_query_result_set>::iterator entry) {
+		result_cache_bytes -= entry->bytes;
+		cached_query_res.erase(entry->key);
+		cached_query_lru.erase(entry);
+	}
+
+	/**
+	 * @brief Remove every expired resultset. The caller holds cached_query_res_mutex.
 	 */
-	std::unordered_map<cached_query_results, cached_query_result_set, cached_query_hash, cached_query_equal> cached_query_res;
+	void sweep_cached_results(double now) {
+		for (auto entry = cached_query_lru.begin(); entry != cached_query_lru.end();) {
+			auto current = entry++;
+			if (now >= current->expiry) {
+				erase_cached_result(current);
+			}
+		}
+		last_result_sweep = now;
+	}
 
 	size_t cache_size() {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
-		return cached_queries.size();
+		return statement_total;
 	}
 	
 	size_t query_count() {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
 		return query_total;
 	}
 
+	result_cache_statistics result_cache_stats() {
+		std::lock_guard<std::mutex> cache_lock(cached_query_res_mutex);
+		return {
+			.entries = cached_query_lru.size(),
+			.bytes = result_cache_bytes,
+			.limit = result_cache_limit,
+			.hits = result_cache_hits,
+			.misses = result_cache_misses,
+			.evictions = result_cache_evictions,
+		};
+	}
+
+	pool_statistics pool_stats() {
+		std::lock_guard<std::mutex> pool_lock(pool_mutex);
+		return {
+			.size = connections.size(),
+			.idle = idle_connections.size(),
+			.checkouts = checkout_total,
+			.waits = wait_total,
+			.total_wait_ms = wait_microseconds / 1000.0,
+			.max_wait_ms = max_wait_microseconds / 1000.0,
+		};
+	}
+
+	/**
+	 * @brief Close a connection and free its prepared statements. The next
+	 * checkout of this connection will reconnect it.
+	 *
+	 * @param conn connection, which must be checked out by the caller
+	 */
+	void reset(connection* conn) {
+		for (const auto& cc : conn->cached_queries) {
+			mysql_stmt_close(cc.second.st);
+			delete[] cc.second.bindings;
+			delete[] cc.second.lengths;
+		}
+		statement_total -= conn->cached_queries.size();
+		conn->cached_queries = {};
+		if (conn->connected) {
+			mysql_close(&conn->handle);
+			conn->connected = false;
+		}
+		conn->needs_reset = false;
+	}
+
 	/**
 	 * @brief This is an internal connect function which has no locking, there is no public interface for this
 	 * 
-	 * @param host hostname
-	 * @param user username
-	 * @param pass password
-	 * @param db database
-	 * @param port port
-	 */
-	bool unsafe_connect(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, int port) {
-		if (mysql_init(&connection) != nullptr) {
-			mysql_options(&connection, MYSQL_INIT_COMMAND, CONNECT_STRING);
+	 * @param conn connection, which must be checked out by the caller or not yet in the pool
+	 */
+	bool unsafe_connect(connection* conn) {
+		if (mysql_init(&conn->handle) != nullptr) {
+			mysql_options(&conn->handle, MYSQL_INIT_COMMAND, CONNECT_STRING);
 			int opts = CLIENT_MULTI_RESULTS | CLIENT_MULTI_STATEMENTS | CLIENT_REMEMBER_OPTIONS | CLIENT_IGNORE_SIGPIPE;
-			bool result = mysql_real_connect(&connection, host.c_str(), user.c_str(), pass.c_str(), db.c_str(), port, NULL, opts);
+			conn->connected = mysql_real_connect(&conn->handle, credentials.host.c_str(), credentials.user.c_str(), credentials.pass.c_str(), credentials.db.c_str(), credentials.port, NULL, opts);
 			signal(SIGPIPE, SIG_IGN);
-			return result;
+			if (!conn->connected) {
+				last_error = mysql_error(&conn->handle);
+				mysql_close(&conn->handle);
+			}
+			return conn->connected;
 		} else {
 			last_error = "mysql_init() failed";
 			return false;
 		}
 	}
 
+	/**
+	 * @brief Make sure a checked out connection is usable, reconnecting it if it has died
+	 * 
+	 * @param conn connection
+	 * @return true if connected
+	 */
+	bool ensure_connected(connection* conn) {
+		if (conn->needs_reset) {
+			reset(conn);
+		}
+		if (conn->connected && mysql_ping(&conn->handle) == 0) {
+			return true;
+		}
+		if (conn->connected && creator) {
+			creator->log(dpp::ll_error, "SQL: Connection has died, reconnecting...");
+		}
+		reset(conn);
+		if (!unsafe_connect(conn)) {
+			if (creator) {
+				creator->log(dpp::ll_critical, fmt::format(fmt::runtime("Database connection error connecting to {}: {}"), credentials.db, last_error));
+			}
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Take a connection from the pool, waiting for one to be returned if all are in use
+	 * 
+	 * @return connection, or nullptr if there is no pool
+	 */
+	connection* checkout() {
+		std::unique_lock<std::mutex> pool_lock(pool_mutex);
+		checkout_total++;
+		if (idle_connections.empty() && !connections.empty()) {
+			wait_total++;
+			auto start = std::chrono::steady_clock::now();
+			pool_available.wait(pool_lock, []() { return !idle_connections.empty() || connections.empty(); });
+			uint64_t waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			wait_microseconds += waited;
+			if (waited > max_wait_microseconds) {
+				max_wait_microseconds = waited;
+			}
+		}
+		if (idle_connections.empty()) {
+			return nullptr;
+		}
+		connection* conn = idle_connections.back();
+		idle_connections.pop_back();
+		return conn;
+	}
+
+	/**
+	 * @brief Return a connection to the pool
+	 * 
+	 * @param conn connection
+	 */
+	void checkin(connection* conn) {
+		if (conn->needs_reset) {
+			reset(conn);
+		}
+		{
+			std::lock_guard<std::mutex> pool_lock(pool_mutex);
+			idle_connections.push_back(conn);
+		}
+		pool_available.notify_one();
+	}
+
+	/**
+	 * @brief Holds a connection for the duration of one query. Inside a transaction
+	 * this is the thread's pinned connection, which stays checked out afterwards.
+	 */
+	class connection_lease {
+		connection* conn{nullptr};
+		bool owned{false};
+	public:
+		connection_lease() {
+			if (pinned) {
+				conn = pinned;
+			} else {
+				conn = checkout();
+				owned = true;
+			}
+		}
+
+		~connection_lease() {
+			if (owned && conn) {
+				checkin(conn);
+			}
+		}
+
+		connection_lease(const connection_lease&) = delete;
+		connection_lease& operator=(const connection_lease&) = delete;
+
+		connection* get() const {
+			return conn;
+		}
+	};
+
 	bool connect(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, int port) {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
-		return unsafe_connect(host, user, pass, db, port);
+		std::lock_guard<std::mutex> pool_lock(pool_mutex);
+		credentials = { host, user, pass, db, port };
+		bool all_connected = true;
+		for (size_t i = connections.size(); i < std::max<size_t>(pool_size, 1); ++i) {
+			auto conn = std::make_unique<connection>();
+			all_connected = unsafe_connect(conn.get()) && all_connected;
+			idle_connections.push_back(conn.get());
+			connections.emplace_back(std::move(conn));
+		}
+		pool_available.notify_all();
+		return all_connected;
+	}
+
+	/**
+	 * @brief Run queued work until close() is called
+	 */
+	void worker_loop() {
+		dpp::utility::set_thread_name("db-worker");
+		while (true) {
+			std::function<void()> work;
+			{
+				std::unique_lock<std::mutex> work_lock(work_mutex);
+				work_available.wait(work_lock, []() { return workers_stopping || !work_queue.empty(); });
+				if (work_queue.empty()) {
+					return;
+				}
+				work = std::move(work_queue.front());
+				work_queue.pop_front();
+			}
+			try {
+				work();
+			}
+			catch (const std::exception& e) {
+				if (creator) {
+					creator->log(dpp::ll_error, std::string("SQL: Exception in background work: ") + e.what());
+				}
+			}
+		}
+	}
+
+	void background(std::function<void()> work) {
+		{
+			std::lock_guard<std::mutex> work_lock(work_mutex);
+			if (!workers.empty() && !workers_stopping) {
+				work_queue.emplace_back(std::move(work));
+				work_available.notify_one();
+				return;
+			}
+		}
+		/* No worker threads, e.g. before init() */
+		work();
+	}
+
+	void query_async(const std::string &format, const paramlist &parameters, query_callback callback) {
+		background([format, parameters, callback = std::move(callback)]() {
+			resultset results = query(format, parameters);
+			if (callback) {
+				callback(results, last_error);
+			}
+		});
+	}
+
+	dpp::async<query_result> co_query(const std::string &format, const paramlist &parameters) {
+		return dpp::async<query_result>{[format, parameters](auto&& resolve) {
+			query_async(format, parameters, [resolve](const resultset& results, const std::string& error) {
+				resolve(query_result{ .rows = results, .error = error, .affected_rows = affected_rows() });
+			});
+		}};
 	}
 
 	void init (dpp::cluster& bot) {
 		creator = &bot;
 		const json dbconf = config::get("database");
+		pool_size = dbconf.value("pool_size", pool_size);
+		result_cache_limit = dbconf.value("result_cache_bytes", result_cache_limit);
 		if (!db::connect(dbconf["host"], dbconf["username"], dbconf["password"], dbconf["database"], dbconf["port"])) {
-			creator->log(dpp::ll_critical, fmt::format(fmt::runtime("Database connection error connecting to {}: {}"), dbconf["database"].get<std::string>(), mysql_error(&connection)));
+			creator->log(dpp::ll_critical, fmt::format(fmt::runtime("Database connection error connecting to {}: {}"), dbconf["database"].get<std::string>(), last_error));
 			exit(2);
 		}
-		creator->log(dpp::ll_info, fmt::format(fmt::runtime("Connected to database: {}"), dbconf["database"].get<std::string>()));
+		creator->log(dpp::ll_info, fmt::format(fmt::runtime("Connected to database: {} ({} connections)"), dbconf["database"].get<std::string>(), connections.size()));
+		std::lock_guard<std::mutex> work_lock(work_mutex);
+		workers_stopping = false;
+		for (size_t i = workers.size(); i < connections.size(); ++i) {
+			workers.emplace_back(worker_loop);
+		}
 	}
 
 	/**
@@ -223,49 +602,107 @@ namespace db {
 	 * directly calling raw_query() and summoning Little Bobby Tables. Only
 	 * queries which return no result set are supported.
 	 * 
+	 * @param conn connection to run the query on, which the caller must hold
 	 * @return true query executed
 	 */
-	bool raw_query(const std::string& query) {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
-		return mysql_real_query(&connection, query.c_str(), query.length()) == 0;
+	bool raw_query(connection* conn, const std::string& query) {
+		if (!conn || !ensure_connected(conn)) {
+			return false;
+		}
+		return mysql_real_query(&conn->handle, query.c_str(), query.length()) == 0;
 	}
 
+	/**
+	 * @note The connection used for the transaction is pinned to the calling
+	 * thread, so every query this thread makes until commit() or rollback() is
+	 * part of the transaction.
+	 */
 	bool transaction() {
-		return raw_query("START TRANSACTION");
+		if (!pinned) {
+			pinned = checkout();
+		}
+		if (!raw_query(pinned, "START TRANSACTION")) {
+			if (pinned) {
+				checkin(pinned);
+				pinned = nullptr;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief End the calling thread's transaction, returning its connection to the pool
+	 * 
+	 * @param statement COMMIT or ROLLBACK
+	 * @return true if the statement executed
+	 */
+	bool end_transaction(const std::string& statement) {
+		if (!pinned) {
+			connection_lease lease;
+			return raw_query(lease.get(), statement);
+		}
+		bool result = raw_query(pinned, statement);
+		checkin(pinned);
+		pinned = nullptr;
+		return result;
 	}
 
 	bool commit() {
-		return raw_query("COMMIT");
+		return end_transaction("COMMIT");
 	}
 
 	bool rollback() {
-		return raw_query("ROLLBACK");
+		return end_transaction("ROLLBACK");
 	}
 
 	bool close() {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
-		mysql_close(&connection);
-		for (const auto& cc : cached_queries) {
-			mysql_stmt_close(cc.second.st);
-			delete[] cc.second.bindings;
-			delete[] cc.second.lengths;
+		{
+			/* Let the workers finish what is already queued */
+			std::lock_guard<std::mutex> work_lock(work_mutex);
+			workers_stopping = true;
+		}
+		work_available.notify_all();
+		for (std::thread& worker : workers) {
+			if (worker.joinable()) {
+				worker.join();
+			}
+		}
+		workers.clear();
+
+		std::unique_lock<std::mutex> pool_lock(pool_mutex);
+		/* Wait for queries in progress on other threads to finish */
+		pool_available.wait(pool_lock, []() { return idle_connections.size() == connections.size(); });
+		for (auto& conn : connections) {
+			reset(conn.get());
 		}
-		cached_queries = {};
+		idle_connections.clear();
+		connections.clear();
+		pool_lock.unlock();
+		pool_available.notify_all();
 		mysql_library_end();
 		return true;
 	}
 
 	const std::string& error() {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
 		return last_error;
 	}
 
-	void log_error(const std::string& format, const std::string& error) {
+	binary hash_key(std::string_view hash) {
+		std::optional<std::string> bytes = hex::decode(hash);
+		return { .bytes = bytes ? std::move(*bytes) : std::string(hash) };
+	}
+
+	std::string hash_hex(std::string_view key) {
+		return hex::encode(key);
+	}
+
+	void log_error(connection* conn, const std::string& format, const std::string& error) {
 		if (!format.empty()) {
 			last_error = fmt::format(fmt::runtime("{} (query: {})"), error, format);
 			if (error == "Lost connection to MySQL server during query") {
-				db::close();
-				db::init(*creator);
+				/* Not reset here, the failed query still holds its statement */
+				conn->needs_reset = true;
 			}
 		} else {
 			last_error = error;
@@ -274,47 +711,156 @@ namespace db {
 	}
 
 	size_t affected_rows() {
-		std::lock_guard<std::mutex> db_lock(db_mutex);
 		return rows_affected;
 	}
 
 	resultset query(const std::string &format, const paramlist &parameters, double lifetime) {
 		double now = dpp::utility::time_f();
 		cached_query_results r{ .format = format, .parameters = parameters };
-		auto f = cached_query_res.find(r);
-		if (f != cached_query_res.end()) {
-			if (now < f->second.expiry) {
-				return f->second.results;
+		{
+			std::lock_guard<std::mutex> cache_lock(cached_query_res_mutex);
+			auto f = cached_query_res.find(r);
+			if (f != cached_query_res.end()) {
+				if (now < f->second->expiry) {
+					result_cache_hits++;
+					cached_query_lru.splice(cached_query_lru.begin(), cached_query_lru, f->second);
+					return f->second->results;
+				}
+				erase_cached_result(f->second);
 			}
-			cached_query_res.erase(f);
+			result_cache_misses++;
 		}
-		cached_query_result_set rs{ .results = query(format, parameters), .expiry = now + lifetime };
-		cached_query_res.emplace(r, rs);
-		return rs.results;
+		resultset results = query(format, parameters);
+		if (!last_error.empty()) {
+			/* Don't cache a failure */
+			return results;
+		}
+		size_t bytes = estimate_bytes(r, results);
+		std::lock_guard<std::mutex> cache_lock(cached_query_res_mutex);
+		if (now - last_result_sweep >= result_sweep_interval) {
+			sweep_cached_results(now);
+		}
+		if (bytes > result_cache_limit) {
+			return results;
+		}
+		auto existing = cached_query_res.find(r);
+		if (existing != cached_query_res.end()) {
+			/* Another thread cached the same query while this one ran it */
+			erase_cached_result(existing->second);
+		}
+		while (result_cache_bytes + bytes > result_cache_limit && !cached_query_lru.empty()) {
+			erase_cached_result(std::prev(cached_query_lru.end()));
+			result_cache_evictions++;
+		}
+		cached_query_lru.push_front({ .key = r, .results = results, .expiry = now + lifetime, .bytes = bytes });
+		cached_query_res.emplace(r, cached_query_lru.begin());
+		result_cache_bytes += bytes;
+		return results;
 	}
 
 	resultset query(const std::string &format, const paramlist &parameters) {
+		return execute(format, parameters).to_resultset();
+	}
 
+	/**
+	 * @brief Output buffer for one result column
+	 */
+	struct column_buffer {
 		/**
-		 * One DB handle can't query the database from multiple threads at the same time.
-		 * To prevent corruption of results, put a lock guard on queries.
+		 * @brief Text buffer, used for columns not fetched in binary
 		 */
-		std::lock_guard<std::mutex> db_lock(db_mutex);
-		resultset rv;
+		std::vector<char> text;
 
-		if (mysql_ping(&connection)) {
-			creator->log(dpp::ll_error, "SQL: Connection has died, reconnecting...");
-			for (const auto& cc : cached_queries) {
-				mysql_stmt_close(cc.second.st);
-				delete[] cc.second.bindings;
-				delete[] cc.second.lengths;
-			}
-			cached_queries = {};
-			const json dbconf = config::get("database");
-			if (!db::unsafe_connect(dbconf["host"], dbconf["username"], dbconf["password"], dbconf["database"], dbconf["port"])) {
-				creator->log(dpp::ll_critical, fmt::format(fmt::runtime("Database connection error connecting to {}: {}"), dbconf["database"].get<std::string>(), mysql_error(&connection)));
-				return rv;
+		/**
+		 * @brief Binary integer value
+		 */
+		int64_t integer{0};
+
+		/**
+		 * @brief Binary floating point value
+		 */
+		double real{0};
+
+		unsigned long length{0};
+		bool is_null{false};
+		bool is_unsigned{false};
+	};
+
+	/**
+	 * @brief Bind a result column to its buffer. Integer and floating point columns
+	 * are fetched in binary, so they are never formatted to text and parsed back.
+	 */
+	void bind_column(MYSQL_BIND& binding, column_buffer& buffer, MYSQL_FIELD& field) {
+		switch (field.type) {
+			case MYSQL_TYPE_TINY:
+			case MYSQL_TYPE_SHORT:
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:
+			case MYSQL_TYPE_LONGLONG:
+			case MYSQL_TYPE_YEAR:
+				buffer.is_unsigned = (field.flags & UNSIGNED_FLAG) != 0;
+				binding.buffer_type = MYSQL_TYPE_LONGLONG;
+				binding.buffer = &buffer.integer;
+				binding.buffer_length = sizeof(buffer.integer);
+				binding.is_unsigned = buffer.is_unsigned;
+				break;
+			case MYSQL_TYPE_FLOAT:
+			case MYSQL_TYPE_DOUBLE:
+				binding.buffer_type = MYSQL_TYPE_DOUBLE;
+				binding.buffer = &buffer.real;
+				binding.buffer_length = sizeof(buffer.real);
+				break;
+			default:
+				/* FIX: Cap max length of retrieved field at 128k, else it will try and new[]
+				 * a 4gb buffer, which is really REALLY slow!
+				 */
+				field.length = std::min(field.length, 131072UL);
+				buffer.text.resize(field.length);
+				binding.buffer_type = MYSQL_TYPE_VAR_STRING;
+				binding.buffer = buffer.text.data();
+				binding.buffer_length = field.length;
+				break;
+		}
+		binding.is_null = &buffer.is_null;
+		binding.length = &buffer.length;
+	}
+
+	/**
+	 * @brief Append a fetched column value to a result
+	 */
+	void add_column(result& rv, const MYSQL_BIND& binding, const column_buffer& buffer) {
+		if (buffer.is_null) {
+			rv.add_null();
+		} else if (binding.buffer_type == MYSQL_TYPE_LONGLONG) {
+			if (buffer.is_unsigned) {
+				rv.add_uint64(static_cast<uint64_t>(buffer.integer));
+			} else {
+				rv.add_int64(buffer.integer);
 			}
+		} else if (binding.buffer_type == MYSQL_TYPE_DOUBLE) {
+			rv.add_double(buffer.real);
+		} else {
+			rv.add_text(std::string_view(buffer.text.data(), std::min<unsigned long>(buffer.length, buffer.text.size())));
+		}
+	}
+
+	result execute(const std::string &format, const paramlist &parameters) {
+
+		/**
+		 * One DB handle can't query the database from multiple threads at the same time.
+		 * Each query checks out a connection from the pool for its duration.
+		 */
+		connection_lease lease;
+		connection* conn = lease.get();
+		result rv;
+
+		if (!conn) {
+			last_error = "No database connection";
+			return rv;
+		}
+
+		if (!ensure_connected(conn)) {
+			return rv;
 		}
 
 		/**
@@ -333,16 +879,16 @@ namespace db {
 		 * and we don't need to call mysql_stmt_init() and mysql_stmt_prepare().
 		 */
 		cached_query cc;
-		auto f = cached_queries.find(format);
-		if (f != cached_queries.end()) {
+		auto f = conn->cached_queries.find(format);
+		if (f != conn->cached_queries.end()) {
 			/* Query already exists in prepared statement cache */
 			cc = f->second;
 		} else {
 
 			/* Query doesn't exist yet, initialise a prepared statement and allocate char buffers */
-			cc.st = mysql_stmt_init(&connection);
+			cc.st = mysql_stmt_init(&conn->handle);
 			if (mysql_stmt_prepare(cc.st, format.c_str(), format.length())) {
-				log_error(format, mysql_stmt_error(cc.st));
+				log_error(conn, format, mysql_stmt_error(cc.st));
 				mysql_stmt_close(cc.st);
 				return rv;
 			}
@@ -350,7 +896,7 @@ namespace db {
 			/* Check the parameter count provided matches that which MySQL expects */
 			size_t expected_param_count = mysql_stmt_param_count(cc.st);
 			if (parameters.size() != expected_param_count) {
-				log_error(format, "Incorrect number of parameters: " + format + " (" + std::to_string(parameters.size()) + " vs " + std::to_string(expected_param_count) + ")");
+				log_error(conn, format, "Incorrect number of parameters: " + format + " (" + std::to_string(parameters.size()) + " vs " + std::to_string(expected_param_count) + ")");
 				mysql_stmt_close(cc.st);
 				return rv;			
 			}
@@ -369,7 +915,8 @@ namespace db {
 			cc.expects_results = (q.size() > 0 && (q[0] == "select" || q[0] == "show" || q[0] == "describe" || q[0] == "explain"));
 
 			/* Store to cache */
-			cached_queries.emplace(format, cc);
+			conn->cached_queries.emplace(format, cc);
+			statement_total++;
 			creator->log(dpp::ll_debug, "SQL: New cached prepared statement: " + format);
 		}
 
@@ -383,13 +930,16 @@ namespace db {
 			for (const auto& param : parameters) {
 				std::visit([&cc, &v](auto &&p) {
 					using T = std::decay_t<decltype(p)>;
+					cc.bindings[v].buffer_type = MYSQL_TYPE_VAR_STRING;
 					if constexpr (std::is_same_v<T, std::string>) {
 						cc.bufs.emplace_back(p);
+					} else if constexpr (std::is_same_v<T, binary>) {
+						cc.bufs.emplace_back(p.bytes);
+						cc.bindings[v].buffer_type = MYSQL_TYPE_BLOB;
 					} else {
 						cc.bufs.emplace_back(std::to_string(p));
 					}
 					cc.lengths[v] = cc.bufs[v].length();
-					cc.bindings[v].buffer_type = MYSQL_TYPE_VAR_STRING;
 					cc.bindings[v].buffer = const_cast<char*>(cc.bufs[v].c_str());
 					cc.bindings[v].buffer_length = cc.bufs[v].length() + 1;
 					cc.bindings[v].is_null = nullptr;
@@ -400,7 +950,7 @@ namespace db {
 
 			/* Bind parameters to statement */
 			if (mysql_stmt_bind_param(cc.st, (MYSQL_BIND*)cc.bindings)) {
-				log_error(format, mysql_stmt_error(cc.st));
+				log_error(conn, format, mysql_stmt_error(cc.st));
 				return rv;
 			}
 		}
@@ -413,7 +963,7 @@ namespace db {
 			 */
 			result = mysql_stmt_execute(cc.st);
 			if (result) {
-				log_error(format, mysql_stmt_error(cc.st));
+				log_error(conn, format, mysql_stmt_error(cc.st));
 			} else {
 				rows_affected = mysql_stmt_affected_rows(cc.st);
 			}
@@ -426,33 +976,20 @@ namespace db {
 			if (a_res) {
 				field_count = mysql_stmt_field_count(cc.st);
 				MYSQL_FIELD *fields = mysql_fetch_fields(a_res);
-				MYSQL_BIND bindings[field_count];
-				char* string_buffers[field_count];
-				unsigned long lengths[field_count];
-				bool is_null[field_count];
-				std::memset(bindings, 0, sizeof(bindings));
-				std::memset(is_null, 0, sizeof(is_null));
-				std::memset(lengths, 0, sizeof(lengths));
+				std::vector<MYSQL_BIND> bindings(field_count);
+				std::vector<column_buffer> buffers(field_count);
+				std::vector<std::string> names;
+				names.reserve(field_count);
+				std::memset(bindings.data(), 0, sizeof(MYSQL_BIND) * field_count);
 				for (unsigned long i = 0; i < field_count; ++i) {
-					/* FIX: Cap max length of retrieved field at 128k, else it will try and new[]
-					 * a 4gb buffer, which is really REALLY slow!
-					 */
-					fields[i].length = std::min(fields[i].length, 131072UL);
-					string_buffers[i] = new char[fields[i].length];
-					memset(string_buffers[i], 0, fields[i].length);
-					bindings[i].buffer_type = MYSQL_TYPE_VAR_STRING;
-					bindings[i].buffer = string_buffers[i];
-					bindings[i].buffer_length = fields[i].length;
-					bindings[i].is_null = &is_null[i];
-					bindings[i].length = &lengths[i];
+					bind_column(bindings[i], buffers[i], fields[i]);
+					names.emplace_back(fields[i].name ? fields[i].name : "");
 				}
+				rv.set_columns(std::move(names));
 
-				result = mysql_stmt_bind_result(cc.st, (MYSQL_BIND*)&bindings);
+				result = mysql_stmt_bind_result(cc.st, bindings.data());
 				if (result) {
-					log_error(format, mysql_stmt_error(cc.st));
-					for (unsigned long i = 0; i < field_count; ++i) {
-						delete[] string_buffers[i];
-					}
+					log_error(conn, format, mysql_stmt_error(cc.st));
 					mysql_free_result(a_res);
 					return rv;
 				}
@@ -460,38 +997,32 @@ namespace db {
 				result = mysql_stmt_execute(cc.st);
 				if (result == 0) {
 
+					/* Buffer the whole resultset client side, so the row count is known up front */
+					mysql_stmt_store_result(cc.st);
+					rv.reserve(mysql_stmt_num_rows(cc.st), 0);
+
 					/* Build resultset */
 					while (true) {
 						result = mysql_stmt_fetch(cc.st); 
 						if (result == MYSQL_NO_DATA) {
 							/* End of resultset */
 							break; 
-						} else if (result != 0) {
+						} else if (result != 0 && result != MYSQL_DATA_TRUNCATED) {
 							/* Error retrieving resultset, e.g. disconnected */
-							log_error(format, mysql_stmt_error(cc.st));
+							log_error(conn, format, mysql_stmt_error(cc.st));
 							break; 
 						}
 
-						/* Build row*/
-						if (mysql_num_fields(a_res)) {
-							long s_field_count = 0;
-							db::row thisrow;
-							while (s_field_count < mysql_num_fields(a_res)) {
-								std::string a = (fields[s_field_count].name ? fields[s_field_count].name : "");
-								std::string b = is_null[s_field_count] ? "" : std::string(string_buffers[s_field_count], lengths[s_field_count]);
-								thisrow[a] = b;
-								s_field_count++;
-							}
-							rv.emplace_back(thisrow);
+						/* Build row */
+						for (unsigned long i = 0; i < field_count; ++i) {
+							add_column(rv, bindings[i], buffers[i]);
 						}
 					}
+					mysql_stmt_free_result(cc.st);
 				}
 				mysql_free_result(a_res);
-				for (unsigned long i = 0; i < field_count; ++i) {
-					delete[] string_buffers[i];
-				}
 			} else {
-				log_error(format, mysql_stmt_error(cc.st));
+				log_error(conn, format, mysql_stmt_error(cc.st));
 			}
 		}
 
@@ -0,0 +1,184 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/database_result.h>
+#include <charconv>
+#include <stdexcept>
+
+namespace db {
+
+	size_t result::column(std::string_view name) const {
+		for (size_t index = 0; index < names.size(); ++index) {
+			if (names[index] == name) {
+				return index;
+			}
+		}
+		throw std::out_of_range("No such column: " + std::string(name));
+	}
+
+	const result::cell& result::at(size_t row, size_t column) const {
+		if (column >= names.size() || row >= size()) {
+			throw std::out_of_range("Result index out of range");
+		}
+		return cells[row * names.size() + column];
+	}
+
+	bool result::is_null(size_t row, size_t column) const {
+		return at(row, column).type == cell_type::null_value;
+	}
+
+	std::string_view result::text(size_t row, size_t column) const {
+		const cell& c = at(row, column);
+		return std::string_view(arena).substr(c.offset, c.length);
+	}
+
+	int64_t result::get_int64(size_t row, size_t column) const {
+		const cell& c = at(row, column);
+		switch (c.type) {
+			case cell_type::int64_value:
+				return c.native.i;
+			case cell_type::uint64_value:
+				return static_cast<int64_t>(c.native.u);
+			case cell_type::double_value:
+				return static_cast<int64_t>(c.native.d);
+			case cell_type::text_value: {
+				int64_t value{0};
+				std::string_view t = text(row, column);
+				if (std::from_chars(t.data(), t.data() + t.size(), value).ec != std::errc()) {
+					return static_cast<int64_t>(get_double(row, column));
+				}
+				return value;
+			}
+			default:
+				return 0;
+		}
+	}
+
+	uint64_t result::get_uint64(size_t row, size_t column) const {
+		const cell& c = at(row, column);
+		switch (c.type) {
+			case cell_type::uint64_value:
+				return c.native.u;
+			case cell_type::int64_value:
+				return static_cast<uint64_t>(c.native.i);
+			case cell_type::double_value:
+				return static_cast<uint64_t>(c.native.d);
+			case cell_type::text_value: {
+				uint64_t value{0};
+				std::string_view t = text(row, column);
+				if (std::from_chars(t.data(), t.data() + t.size(), value).ec != std::errc()) {
+					return static_cast<uint64_t>(get_double(row, column));
+				}
+				return value;
+			}
+			default:
+				return 0;
+		}
+	}
+
+	double result::get_double(size_t row, size_t column) const {
+		const cell& c = at(row, column);
+		switch (c.type) {
+			case cell_type::double_value:
+				return c.native.d;
+			case cell_type::int64_value:
+				return static_cast<double>(c.native.i);
+			case cell_type::uint64_value:
+				return static_cast<double>(c.native.u);
+			case cell_type::text_value: {
+				/* DECIMAL columns, such as SUM() results, arrive as text */
+				double value{0};
+				std::string_view t = text(row, column);
+				if (std::from_chars(t.data(), t.data() + t.size(), value).ec != std::errc()) {
+					return 0;
+				}
+				return value;
+			}
+			default:
+				return 0;
+		}
+	}
+
+	resultset result::to_resultset() const {
+		resultset rows;
+		rows.reserve(size());
+		for (size_t r = 0; r < size(); ++r) {
+			row& converted = rows.emplace_back();
+			for (size_t c = 0; c < names.size(); ++c) {
+				converted.emplace(names[c], std::string(text(r, c)));
+			}
+		}
+		return rows;
+	}
+
+	void result::set_columns(std::vector<std::string> column_names) {
+		names = std::move(column_names);
+	}
+
+	void result::reserve(size_t rows, size_t text_bytes) {
+		cells.reserve(rows * names.size());
+		arena.reserve(text_bytes);
+	}
+
+	void result::append_text(cell& c, std::string_view value) {
+		c.offset = static_cast<uint32_t>(arena.size());
+		c.length = static_cast<uint32_t>(value.size());
+		arena.append(value);
+	}
+
+	void result::add_null() {
+		cell& c = cells.emplace_back();
+		c.offset = static_cast<uint32_t>(arena.size());
+	}
+
+	void result::add_text(std::string_view value) {
+		cell& c = cells.emplace_back();
+		c.type = cell_type::text_value;
+		append_text(c, value);
+	}
+
+	/* Numbers are also rendered into the arena, so text access works for every column */
+
+	void result::add_int64(int64_t value) {
+		cell& c = cells.emplace_back();
+		c.type = cell_type::int64_value;
+		c.native.i = value;
+		char buffer[24];
+		auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+		append_text(c, std::string_view(buffer, end - buffer));
+	}
+
+	void result::add_uint64(uint64_t value) {
+		cell& c = cells.emplace_back();
+		c.type = cell_type::uint64_value;
+		c.native.u = value;
+		char buffer[24];
+		auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+		append_text(c, std::string_view(buffer, end - buffer));
+	}
+
+	void result::add_double(double value) {
+		cell& c = cells.emplace_back();
+		c.type = cell_type::double_value;
+		c.native.d = value;
+		char buffer[32];
+		auto end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+		append_text(c, std::string_view(buffer, end - buffer));
+	}
+};
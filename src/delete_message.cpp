@@ -21,6 +21,7 @@
 #include <dpp/unicode_emoji.h>
 #include <beholder/beholder.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
 #include <mutex>
 #include <set>
 
@@ -48,29 +49,33 @@ namespace {
 
 }
 
-bool delete_message_and_warn(std::string hash, std::string image, dpp::cluster& bot, const dpp::message_create_t ev, const dpp::attachment attach, const std::string text)
+bool message_delete_attempted(dpp::snowflake message_id)
 {
-	bot.log(dpp::ll_info, "in delete_message_and_warn; cid=" + ev.msg.channel_id.str() + " mid=" + ev.msg.id.str() + " hash=" + hash);
+	std::lock_guard<std::mutex> lock(deleted_message_mutex);
+	return deleted_message_ids.contains(message_id);
+}
+
+bool delete_message_and_warn(const std::string& hash, const std::string& image, dpp::cluster& bot, const scan_source& source, const std::string& text)
+{
+	bot.log(dpp::ll_info, "in delete_message_and_warn; cid=" + source.channel_id.str() + " mid=" + source.message_id.str() + " hash=" + hash);
 
-	const bool should_delete = mark_message_delete_attempted(ev.msg.id);
+	const bool should_delete = mark_message_delete_attempted(source.message_id);
 	if (!should_delete) {
-		bot.log(dpp::ll_info, "message already deleted or delete already attempted; mid=" + ev.msg.id.str() + " hash=" + hash);
+		bot.log(dpp::ll_info, "message already deleted or delete already attempted; mid=" + source.message_id.str() + " hash=" + hash);
 		return false;
 	}
 
-	bot.message_delete(ev.msg.id, ev.msg.channel_id, [hash, &bot, ev, attach, text, image, should_delete](const auto& cc) {
+	bot.message_delete(source.message_id, source.channel_id, [hash, &bot, source, text, image, should_delete](const auto& cc) {
 
 		bool delete_failed = cc.is_error();
 
-		db::resultset logchannel = db::query("SELECT log_channel, embed_title, embed_body FROM guild_config WHERE guild_id = ?", {ev.msg.guild_id});
-		db::resultset channel_settings = db::query(
-			"SELECT * FROM channel_settings WHERE guild_id = ? AND channel_id IN (?, 0) ORDER BY channel_id = ? DESC LIMIT 1",
-			{ev.msg.guild_id, ev.msg.channel_id, ev.msg.channel_id}
-		);
+		const guild_settings::snapshot_ptr settings = guild_settings::get(source.guild_id);
+		const guild_settings::channel_settings* channel_settings = settings->channel(source.channel_id);
+		const dpp::snowflake log_channel = settings->log_channel;
 
-		if (logchannel.size() == 0 || (channel_settings.size() && channel_settings[0].at("warn") == "1")) {
-			std::string message_body = logchannel.size() == 0 ? "" : logchannel[0].at("embed_body");
-			std::string message_title = logchannel.size() == 0 ? "" : logchannel[0].at("embed_title");
+		if (!settings->has_config || (channel_settings && channel_settings->warn)) {
+			std::string message_body = settings->embed_body;
+			std::string message_title = settings->embed_title;
 
 			if (message_body.empty()) {
 				message_body = "This message contained disallowed image content!\n\nModerators can configure this message using `/message content`";
@@ -78,10 +83,10 @@ bool delete_message_and_warn(std::string hash, std::string image, dpp::cluster&
 			if (message_title.empty()) {
 				message_title = "Please set a title using `/message content`";
 			}
-			message_body = replace_string(message_body, "@user", ev.msg.author.get_mention());
+			message_body = replace_string(message_body, "@user", source.author_mention());
 
 			bot.message_create(
-				dpp::message(ev.msg.channel_id, "")
+				dpp::message(source.channel_id, "")
 					.add_embed(
 						dpp::embed()
 							.set_description(message_body)
@@ -94,122 +99,120 @@ bool delete_message_and_warn(std::string hash, std::string image, dpp::cluster&
 			);
 		}
 
-		if (channel_settings.size()) {
-			uint8_t action = atoi(channel_settings[0].at("action").c_str());
-			uint64_t silence_length = atoi(channel_settings[0].at("silence_length").c_str());
-			uint64_t ban_length = atoi(channel_settings[0].at("ban_length").c_str());
+		if (channel_settings) {
+			uint8_t action = channel_settings->action;
+			uint64_t silence_length = channel_settings->silence_length;
+			uint64_t ban_length = channel_settings->ban_length;
 			switch (action) {
 				case action::act_nothing:
 					bot.log(dpp::ll_info, "Automatic action: Nothing");
 					break;
 				case action::act_silence:
 					bot.log(dpp::ll_info, "Automatic action: Silence");
-					bot.guild_member_timeout(ev.msg.guild_id, ev.msg.author.id, time(nullptr) + (silence_length * 60), [&bot, ev, logchannel, silence_length](const auto& cc) {
-						if (logchannel.size() && logchannel[0].at("log_channel").length()) {
-							dpp::snowflake log_channel(logchannel[0].at("log_channel"));
+					bot.guild_member_timeout(source.guild_id, source.author_id, time(nullptr) + (silence_length * 60), [&bot, author_id = source.author_id, log_channel, silence_length](const auto& cc) {
+						if (!log_channel.empty()) {
 							if (cc.is_error()) {
 								bot.log(dpp::ll_info, "Automatic action: Silence failed; " + cc.get_error().human_readable + " - message to " + log_channel.str());
 								bot.message_create(dpp::message(log_channel, ":no_entry: Unable to timeout user: " + cc.get_error().human_readable));
 								return;
 							}
 							bot.log(dpp::ll_info, "Automatic action: Timed out");
-							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" + ev.msg.author.id.str() + "> has been **timed out** for **" + std::to_string(silence_length) + " minutes**."));
+							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" + author_id.str() + "> has been **timed out** for **" + std::to_string(silence_length) + " minutes**."));
 						}
 					});
 
 					break;
 				case action::act_kick:
 					bot.log(dpp::ll_info, "Automatic action: Kick");
-					bot.guild_member_kick(ev.msg.guild_id, ev.msg.author.id, [&bot, ev, logchannel](const auto& cc) {
-						if (logchannel.size() && logchannel[0].at("log_channel").length()) {
-							dpp::snowflake log_channel(logchannel[0].at("log_channel"));
+					bot.guild_member_kick(source.guild_id, source.author_id, [&bot, author_id = source.author_id, log_channel](const auto& cc) {
+						if (!log_channel.empty()) {
 							if (cc.is_error()) {
 								bot.log(dpp::ll_info, "Automatic action: Kick failed; " + cc.get_error().human_readable + " - message to " + log_channel.str());
 								bot.message_create(dpp::message(log_channel, ":no_entry: Unable to kick user: " + cc.get_error().human_readable));
 								return;
 							}
 							bot.log(dpp::ll_info, "Automatic action: Kicked");
-							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" +  ev.msg.author.id.str() + "> has been **kicked**."));
+							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" +  author_id.str() + "> has been **kicked**."));
 						}
 					});
 					break;
 				case action::act_ban:
 					bot.log(dpp::ll_info, "Automatic action: Ban");
-					bot.guild_ban_add(ev.msg.guild_id, ev.msg.author.id, ban_length * 60 * 60, [&bot, ev, logchannel, ban_length](const auto& cc) {
-						if (logchannel.size() && logchannel[0].at("log_channel").length()) {
-							dpp::snowflake log_channel(logchannel[0].at("log_channel"));
+					bot.guild_ban_add(source.guild_id, source.author_id, ban_length * 60 * 60, [&bot, author_id = source.author_id, log_channel, ban_length](const auto& cc) {
+						if (!log_channel.empty()) {
 							if (cc.is_error()) {
 								bot.log(dpp::ll_info, "Automatic action: Ban failed; " + cc.get_error().human_readable + " - message to " + log_channel.str());
 								bot.message_create(dpp::message(log_channel, ":no_entry: Unable to ban user: " + cc.get_error().human_readable));
 								return;
 							}
 							bot.log(dpp::ll_info, "Automatic action: Banned");
-							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" + ev.msg.author.id.str() + "> has been **banned**. Messages for the past " + std::to_string(ban_length) + " hours deleted."));
+							bot.message_create(dpp::message(log_channel, ":white_check_mark: User <@" + author_id.str() + "> has been **banned**. Messages for the past " + std::to_string(ban_length) + " hours deleted."));
 						}
 					});
 					break;
 			}
 		}
 
-		if (logchannel.size() && logchannel[0].at("log_channel").length()) {
-			dpp::snowflake log_channel(logchannel[0].at("log_channel"));
+		if (!log_channel.empty()) {
 
 			if (delete_failed) {
-				bot.message_create(dpp::message(log_channel, "Failed to delete message: " + dpp::utility::message_url(ev.msg.guild_id, ev.msg.channel_id, ev.msg.id) + ": " + cc.get_error().human_readable));
+				bot.message_create(dpp::message(log_channel, "Failed to delete message: " + dpp::utility::message_url(source.guild_id, source.channel_id, source.message_id) + ": " + cc.get_error().human_readable));
 				return;
 			}
 
 			dpp::message delete_msg;
 			delete_msg.set_channel_id(log_channel).add_embed(
 				dpp::embed()
-					.set_description("**Attachment:** `" + attach.filename + "`\n🔗 [Image link](" + attach.url + ")")
-					.add_field("Sent By", "`" + ev.msg.author.format_username() + "`", true)
-					.add_field("Mention", ev.msg.author.get_mention(), true)
-					.add_field("In Channel", "<#" + ev.msg.channel_id.str() + ">", true)
+					.set_description("**Attachment:** `" + source.filename + "`\n🔗 [Image link](" + source.url + ")")
+					.add_field("Sent By", "`" + source.author_name() + "`", true)
+					.add_field("Mention", source.author_mention(), true)
+					.add_field("In Channel", "<#" + source.channel_id.str() + ">", true)
 					.set_title("🚫 Image Deleted!")
 					.set_color(colours::good)
 					.set_url("https://beholder.cc/")
-					.set_footer("Powered by Beholder - Message ID " + std::to_string(ev.msg.id), bot.me.get_avatar_url())
+					.set_footer("Powered by Beholder - Message ID " + std::to_string(source.message_id), bot.me.get_avatar_url())
 			);
 			delete_msg.embeds[0].add_field("Matched Pattern", "```\n" + text + "\n```", false);
-			delete_msg.add_component(
-				dpp::component()
-					.add_component(dpp::component()
-					       .set_label("Block")
-					       .set_type(dpp::cot_button)
-					       .set_emoji(dpp::unicode_emoji::no_entry)
-					       .set_style(dpp::cos_danger)
-					       .set_id("BL;*;" + hash)
-					)
-					.add_component(dpp::component()
-					       .set_label("Unblock")
-					       .set_type(dpp::cot_button)
-					       .set_emoji(dpp::unicode_emoji::white_check_mark)
-					       .set_style(dpp::cos_success)
-					       .set_id("UB;*;" + hash)
-					)
-					.add_component(dpp::component()
-					       .set_label("Kick User")
-					       .set_type(dpp::cot_button)
-					       .set_emoji(dpp::unicode_emoji::foot)
-					       .set_style(dpp::cos_primary)
-					       .set_id("KI;*;" + ev.msg.author.id.str())
-					)
-					.add_component(dpp::component()
-					       .set_label("Timeout User")
-					       .set_type(dpp::cot_button)
-					       .set_emoji(dpp::unicode_emoji::clock)
-					       .set_style(dpp::cos_primary)
-					       .set_id("TI;*;" + ev.msg.author.id.str())
-					)
-					.add_component(dpp::component()
-					       .set_label("Ban User")
-					       .set_type(dpp::cot_button)
-					       .set_emoji(dpp::unicode_emoji::cop)
-					       .set_style(dpp::cos_primary)
-					       .set_id("BA;*;" + ev.msg.author.id.str())
-					)
+			dpp::component actions;
+			if (!hash.empty()) {
+				/* Images deleted for their host were never downloaded, so have no hash to block */
+				actions.add_component(dpp::component()
+				       .set_label("Block")
+				       .set_type(dpp::cot_button)
+				       .set_emoji(dpp::unicode_emoji::no_entry)
+				       .set_style(dpp::cos_danger)
+				       .set_id("BL;*;" + hash)
+				)
+				.add_component(dpp::component()
+				       .set_label("Unblock")
+				       .set_type(dpp::cot_button)
+				       .set_emoji(dpp::unicode_emoji::white_check_mark)
+				       .set_style(dpp::cos_success)
+				       .set_id("UB;*;" + hash)
+				);
+			}
+			actions.add_component(dpp::component()
+			       .set_label("Kick User")
+			       .set_type(dpp::cot_button)
+			       .set_emoji(dpp::unicode_emoji::foot)
+			       .set_style(dpp::cos_primary)
+			       .set_id("KI;*;" + source.author_id.str())
+			)
+			.add_component(dpp::component()
+			       .set_label("Timeout User")
+			       .set_type(dpp::cot_button)
+			       .set_emoji(dpp::unicode_emoji::clock)
+			       .set_style(dpp::cos_primary)
+			       .set_id("TI;*;" + source.author_id.str())
+			)
+			.add_component(dpp::component()
+			       .set_label("Ban User")
+			       .set_type(dpp::cot_button)
+			       .set_emoji(dpp::unicode_emoji::cop)
+			       .set_style(dpp::cos_primary)
+			       .set_id("BA;*;" + source.author_id.str())
 			);
+			delete_msg.add_component(actions);
 			bot.message_create(delete_msg);
 		}
 	});
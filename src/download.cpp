@@ -19,9 +19,18 @@
  ************************************************************************************/
 #include <dpp/dpp.h>
 #include <beholder/beholder.h>
+#include <beholder/config.h>
 #include <beholder/database.h>
+#include <beholder/statistics.h>
+#include <beholder/guild_settings.h>
+#include <beholder/scan_cache.h>
+#include <beholder/url_cache.h>
+#include <beholder/asset_cache.h>
+#include <beholder/block_list.h>
 #include <beholder/whitelist.h>
+#include <beholder/scanned_items.h>
 #include <beholder/proc/json_frame.h>
+#include <nsfwd/socket_protocol.h>
 #include <CxxUrl/url.hpp>
 #include <fmt/format.h>
 #include <beholder/reactor.h>
@@ -42,17 +51,6 @@
 
 extern char **environ;
 
-static std::vector<std::string> get_ocr_patterns(dpp::snowflake guild_id, dpp::snowflake channel_id) {
-	std::vector<std::string> patterns;
-	db::resultset rows = db::query("SELECT pattern FROM guild_patterns WHERE guild_id = ? AND (channel_id = ? OR channel_id IS NULL)", {guild_id, channel_id});
-
-	for (const db::row& row : rows) {
-		patterns.emplace_back(row.at("pattern"));
-	}
-
-	return patterns;
-}
-
 double safe_stod(const std::string& s) {
 	errno = 0;
 	char* end = nullptr;
@@ -98,54 +96,32 @@ std::vector<std::string> parse_language_list(const std::string& value)
 	return languages;
 }
 
-static premium_scan_config get_premium_scan_config(dpp::snowflake guild_id, dpp::snowflake channel_id)
+static premium_scan_config get_premium_scan_config(const guild_settings::snapshot& settings, dpp::snowflake channel_id)
 {
 	premium_scan_config config;
 
-	db::resultset premium = db::query(
-		"SELECT 1 FROM premium_credits WHERE guild_id = ? AND active = 1 LIMIT 1",
-		{guild_id}
-	);
-
-	config.premium = !premium.empty();
+	config.premium = settings.premium;
 
 	if (!config.premium) {
 		return config;
 	}
 
-	db::resultset settings = db::query(
-		"SELECT prem_profanity_filter_enable, prem_anim_scan_enable, prem_video_scan_enable "
-		"FROM channel_settings "
-		"WHERE guild_id = ? AND channel_id IN (?, 0) "
-		"ORDER BY channel_id = ? DESC "
-		"LIMIT 1",
-		{guild_id, channel_id, channel_id}
-	);
+	const guild_settings::channel_settings* channel = settings.channel(channel_id);
 
-	if (settings.empty()) {
+	if (!channel) {
 		config.animated_scan_enabled = true;
 		config.video_scan_enabled = true;
 	} else {
-		config.profanity_enabled = db_bool(settings[0].at("prem_profanity_filter_enable"), false);
-		config.animated_scan_enabled = db_bool(settings[0].at("prem_anim_scan_enable"), true);
-		config.video_scan_enabled = db_bool(settings[0].at("prem_video_scan_enable"), true);
+		config.profanity_enabled = channel->prem_profanity_filter_enable;
+		config.animated_scan_enabled = channel->prem_anim_scan_enable;
+		config.video_scan_enabled = channel->prem_video_scan_enable;
 	}
 
 	if (!config.profanity_enabled) {
 		return config;
 	}
 
-	db::resultset guild_config = db::query(
-		"SELECT prem_languages FROM guild_config WHERE guild_id = ? LIMIT 1",
-		{guild_id}
-	);
-
-	if (guild_config.empty()) {
-		config.profanity_enabled = false;
-		return config;
-	}
-
-	config.languages = parse_language_list(guild_config[0].at("prem_languages"));
+	config.languages = settings.languages;
 
 	if (config.languages.empty()) {
 		config.profanity_enabled = false;
@@ -154,17 +130,10 @@ static premium_scan_config get_premium_scan_config(dpp::snowflake guild_id, dpp:
 	return config;
 }
 
-static json get_basic_nsfw_config(dpp::cluster& bot, dpp::snowflake guild_id, dpp::snowflake channel_id) {
-	db::resultset settings = db::query(
-		"SELECT basic_nsfw_suggestive, basic_nsfw_porn, basic_nsfw_drawing, basic_nsfw_hentai "
-		"FROM channel_settings "
-		"WHERE guild_id = ? AND channel_id IN (?, 0) "
-		"ORDER BY channel_id = ? DESC "
-		"LIMIT 1",
-		{guild_id, channel_id, channel_id}
-	);
+static json get_basic_nsfw_config(const guild_settings::snapshot& settings, dpp::snowflake channel_id) {
+	const guild_settings::channel_settings* channel = settings.channel(channel_id);
 
-	if (settings.empty()) {
+	if (!channel) {
 		return {
 			{"suggestive", 0.9},
 			{"porn", 0.9},
@@ -174,27 +143,24 @@ static json get_basic_nsfw_config(dpp::cluster& bot, dpp::snowflake guild_id, dp
 	}
 
 	return {
-		{"suggestive", safe_stod(settings[0].at("basic_nsfw_suggestive"))},
-		{"porn", safe_stod(settings[0].at("basic_nsfw_porn"))},
-		{"drawing", safe_stod(settings[0].at("basic_nsfw_drawing"))},
-		{"hentai", safe_stod(settings[0].at("basic_nsfw_hentai"))}
+		{"suggestive", channel->basic_nsfw_suggestive},
+		{"porn", channel->basic_nsfw_porn},
+		{"drawing", channel->basic_nsfw_drawing},
+		{"hentai", channel->basic_nsfw_hentai}
 	};
 }
 
 static json get_scan_cache(const std::string& hash) {
 	json cache = json::object();
+	scan_cache::entry cached = scan_cache::get(hash);
 
-	db::resultset ocr = db::query("SELECT ocr FROM scan_cache WHERE hash = ?", {hash});
-
-	if (!ocr.empty()) {
-		cache["ocr"] = ocr[0].at("ocr");
+	if (cached.ocr) {
+		cache["ocr"] = *cached.ocr;
 	}
 
-	db::resultset basic = db::query("SELECT basic FROM basic_cache WHERE hash = ?", {hash});
-
-	if (!basic.empty()) {
+	if (cached.basic) {
 		try {
-			cache["basic"] = json::parse(basic[0].at("basic"));
+			cache["basic"] = json::parse(*cached.basic);
 		} catch (const json::exception&) {
 		}
 	}
@@ -211,14 +177,14 @@ static void write_scan_cache(const std::string& hash, const json& response, dpp:
 
 	if (cache.contains("ocr") && cache.at("ocr").is_string()) {
 		const std::string ocr = cache.at("ocr").get<std::string>();
-		db::query("INSERT INTO scan_cache (hash, ocr) VALUES(?,?) ON DUPLICATE KEY UPDATE ocr = ?", {hash, ocr, ocr});
-		INCREMENT_STATISTIC("cache_miss", guild_id);
+		scan_cache::put_ocr(hash, ocr);
+		statistics::increment(statistics::cache_miss, guild_id);
 	}
 
 	if (cache.contains("basic_nsfw") && cache.at("basic_nsfw").is_object()) {
 		const std::string basic = cache.at("basic_nsfw").dump();
-		db::query("INSERT INTO basic_cache (hash, basic) VALUES(?,?) ON DUPLICATE KEY UPDATE basic = ?", {hash, basic, basic});
-		INCREMENT_STATISTIC("cache_miss", guild_id);
+		scan_cache::put_basic(hash, basic);
+		statistics::increment(statistics::cache_miss, guild_id);
 	}
 }
 
@@ -230,9 +196,9 @@ static void increment_block_stat(const json& response, dpp::snowflake guild_id)
 	const std::string scanner = response.at("scanner").get<std::string>();
 
 	if (scanner == "ocr") {
-		INCREMENT_STATISTIC("images_ocr", guild_id);
+		statistics::increment(statistics::images_ocr, guild_id);
 	} else if (scanner == "basic_nsfw") {
-		INCREMENT_STATISTIC("images_nsfw", guild_id);
+		statistics::increment(statistics::images_nsfw, guild_id);
 	}
 }
 
@@ -265,54 +231,117 @@ bool get_profanity_result(const json& response)
 	return false;
 }
 
-bool handle_scan_response(json response, std::string hash, dpp::cluster& bot, const dpp::message_create_t ev, const dpp::attachment attach)
+std::string get_ocr_text(const json& response)
+{
+	if (!response.contains("results") || !response.at("results").is_array()) {
+		return "";
+	}
+
+	for (const auto& result : response.at("results")) {
+		if (result.is_object() &&
+		    result.contains("scanner") &&
+		    result.at("scanner") == "ocr" &&
+		    result.contains("raw") &&
+		    result.at("raw").is_object() &&
+		    result.at("raw").contains("text") &&
+		    result.at("raw").at("text").is_string()) {
+			return result.at("raw").at("text").get<std::string>();
+		}
+	}
+
+	return "";
+}
+
+bool handle_scan_response(const json& response, const std::string& hash, dpp::cluster& bot, const scan_source& source)
 {
 	bot.log(dpp::ll_info, "Scan hash: " + hash);
 	if (!response.contains("stage") || response.at("stage") != "scan") {
 		bot.log(dpp::ll_warning, "tessd returned non-scan response");
 		return false;
 	}
-	write_scan_cache(hash, response, ev.msg.guild_id);
+	write_scan_cache(hash, response, source.guild_id);
 	if (get_profanity_result(response)) {
 		bot.log(dpp::ll_warning, "delete and warn; profanity found; hash=" + hash);
-		INCREMENT_STATISTIC("images_ocr", ev.msg.guild_id);
-		return delete_message_and_warn(hash, "", bot, ev, attach, "Swear word or slur detected");
+		statistics::increment(statistics::images_ocr, source.guild_id);
+		return delete_message_and_warn(hash, "", bot, source, "Swear word or slur detected");
 	}
 	if (!response.contains("status") || response.at("status") != "blocked") {
+		/* Regular expression patterns are compiled once per guild here, rather than per scan in tessd */
+		const guild_settings::snapshot_ptr settings = guild_settings::get(source.guild_id);
+		if (std::optional<std::string> pattern = settings->match_regexes(source.channel_id, get_ocr_text(response))) {
+			bot.log(dpp::ll_warning, "delete and warn; regex pattern matched; hash=" + hash);
+			statistics::increment(statistics::images_ocr, source.guild_id);
+			return delete_message_and_warn(hash, "", bot, source, *pattern);
+		}
 		bot.log(dpp::ll_warning, "tessd status: not blocked: " + response.dump());
 		return false;
 	}
 	const std::string text = response.contains("text") && response.at("text").is_string() ? response.at("text").get<std::string>() : "Image blocked";
 	bot.log(dpp::ll_warning, "delete and warn; hash=" + hash);
-	increment_block_stat(response, ev.msg.guild_id);
-	return delete_message_and_warn(hash, "", bot, ev, attach, text);
+	increment_block_stat(response, source.guild_id);
+	return delete_message_and_warn(hash, "", bot, source, text);
+}
+
+static json make_block_list_response(const std::string& hash) {
+	return {
+		{"stage", "scan"},
+		{"status", "blocked"},
+		{"hash", hash},
+		{"scanner", "block_list"},
+		{"scanner_name", "Admin Block List"},
+		{"text", "Image is on the block list"},
+		{"trigger", 1.0},
+		{"threshold", 1.0},
+		{"results", json::array({
+			{
+				{"scanner", "block_list"},
+				{"scanner_name", "Admin Block List"},
+				{"enabled", true},
+				{"blocked", true},
+				{"text", "Image is on the block list"},
+				{"trigger", 1.0},
+				{"threshold", 1.0},
+				{"raw", json::object()}
+			}
+		})},
+		{"cache", json::object()}
+	};
 }
 
-json make_fetch_request(const dpp::attachment& attach) {
+json make_fetch_item(const scan_source& source) {
 	json request = {
-		{"action", "fetch"},
-		{"url", attach.url},
-		{"filename", attach.filename}
+		{"url", source.url},
+		{"filename", source.filename}
 	};
 
-	if (attach.width) {
-		request["width"] = attach.width;
+	if (source.width) {
+		request["width"] = source.width;
 	}
 
-	if (attach.height) {
-		request["height"] = attach.height;
+	if (source.height) {
+		request["height"] = source.height;
 	}
 
-	if (attach.size) {
-		request["size"] = attach.size;
+	if (source.size) {
+		request["size"] = source.size;
 	}
 
 	return request;
 }
 
-json make_continue_request(dpp::cluster& bot, dpp::snowflake guild_id, dpp::snowflake channel_id, const std::string& hash)
+/**
+ * @brief The "nsfwd_socket" config value, which must match "unix_socket" in nsfwd.json.
+ * nsfwd runs as its own user and its settings file may not be readable by the bot.
+ */
+const std::string& nsfwd_socket()
+{
+	static const std::string path = config::get().value("nsfwd_socket", std::string(nsfw_socket::default_path));
+	return path;
+}
+
+json make_continue_request(const guild_settings::snapshot& settings, dpp::snowflake channel_id)
 {
-	const premium_scan_config premium = get_premium_scan_config(guild_id, channel_id);
+	const premium_scan_config premium = get_premium_scan_config(settings, channel_id);
 
 	json request = {
 		{"action", "continue"},
@@ -321,22 +350,42 @@ json make_continue_request(dpp::cluster& bot, dpp::snowflake guild_id, dpp::snow
 		{"prem_anim_scan_enable", premium.animated_scan_enabled},
 		{"prem_video_scan_enable", premium.video_scan_enabled},
 		{"prem_languages", premium.premium ? premium.languages : std::vector<std::string>{"en"} },
-		{"ocr_patterns", get_ocr_patterns(guild_id, channel_id)},
-		{"basic_nsfw", get_basic_nsfw_config(bot, guild_id, channel_id)},
-		{"cache", get_scan_cache(hash)}
+		{"ocr_patterns", settings.patterns_for(channel_id)},
+		{"ocr_required", settings.has_regexes_for(channel_id)},
+		{"basic_nsfw", get_basic_nsfw_config(settings, channel_id)},
+		{"items", json::array()}
 	};
 
 	return request;
 }
 
-scan_request::scan_request(const dpp::attachment& attach, const dpp::message_create_t& ev, dpp::cluster& bot, scan_callback callback) : attach(attach), ev(ev), bot(&bot), callback(callback)
+scan_request::scan_request(std::vector<scan_source> sources, dpp::cluster& bot, scan_callback callback) : sources(std::move(sources)), bot(&bot), callback(std::move(callback))
 {
 }
 
-scan_job::scan_job(const scan_request& request) : attach(request.attach), ev(request.ev), bot(request.bot), callback(request.callback)
+scan_item::scan_item(scan_source source)
+	: source(std::move(source)),
+	asset_key(asset_cache::asset_key(this->source.url).value_or("")),
+	url_key(asset_key.empty() ? url_cache::canonical_key(this->source.url) : "")
 {
 }
 
+scan_job::scan_job(const scan_request& request) : bot(request.bot), callback(request.callback)
+{
+	items.reserve(request.sources.size());
+	for (const scan_source& source : request.sources) {
+		items.emplace_back(source);
+	}
+}
+
+/**
+ * @brief True if the message an image came from has been deleted, so the rest of it need not be scanned
+ */
+static bool cancelled(const scan_source& source)
+{
+	return !source.message_id.empty() && message_delete_attempted(source.message_id);
+}
+
 int pidfd_open(pid_t pid) {
 	return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
 }
@@ -360,10 +409,24 @@ std::string make_json_frame(const json& frame) {
 	return std::string(proc::json_marker) + frame.dump() + "\n";
 }
 
-void scanner_reactor::submit(const dpp::attachment& attach, dpp::cluster& bot, const dpp::message_create_t& ev, scan_callback callback) {
+void scanner_reactor::submit(std::vector<scan_source> sources, dpp::cluster& bot, scan_callback callback) {
+	/* A tessd process holds all of its images in memory at once */
+	std::vector<std::vector<scan_source>> batches;
+	size_t batch_size = 0;
+	for (scan_source& source : sources) {
+		if (batches.empty() || batches.back().size() >= max_batch_items || batch_size + source.size > max_size) {
+			batches.emplace_back();
+			batch_size = 0;
+		}
+		batch_size += source.size;
+		batches.back().emplace_back(std::move(source));
+	}
+
 	{
 		std::lock_guard<std::mutex> lock(queue_mutex);
-		requests.emplace_back(attach, ev, bot, callback);
+		for (std::vector<scan_source>& batch : batches) {
+			requests.emplace_back(std::move(batch), bot, callback);
+		}
 	}
 
 	uint64_t value = 1;
@@ -458,6 +521,7 @@ void scanner_reactor::run()
 
 			if (fd == queue_fd) {
 				drain_queue_fd();
+				run_completions();
 				start_queued_jobs();
 				continue;
 			}
@@ -489,6 +553,31 @@ void scanner_reactor::drain_queue_fd()
 	}
 }
 
+void scanner_reactor::post(std::function<void()> completion)
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		completions.emplace_back(std::move(completion));
+	}
+
+	uint64_t value = 1;
+	write(queue_fd, &value, sizeof(value));
+}
+
+void scanner_reactor::run_completions()
+{
+	std::deque<std::function<void()>> ready;
+
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		ready.swap(completions);
+	}
+
+	for (auto& completion : ready) {
+		completion();
+	}
+}
+
 void scanner_reactor::start_queued_jobs()
 {
 	while (true) {
@@ -501,7 +590,7 @@ void scanner_reactor::start_queued_jobs()
 				return;
 			}
 
-			request = std::make_unique<scan_request>(requests.front());
+			request = std::make_unique<scan_request>(std::move(requests.front()));
 			requests.pop_front();
 		}
 
@@ -510,11 +599,90 @@ void scanner_reactor::start_queued_jobs()
 }
 
 void scanner_reactor::start_job(const scan_request& request)
+{
+	if (request.sources.empty() || cancelled(request.sources.front())) {
+		return;
+	}
+
+	/* Stickers and custom emoji are cached by ID and file type, Discord attachments by URL.
+	 * Both give the content hash and the verdicts it has had so far.
+	 */
+	std::vector<std::optional<asset_cache::entry>> cached(request.sources.size());
+	bool any_cached = false;
+	for (size_t index = 0; index < request.sources.size(); ++index) {
+		const std::string& url = request.sources[index].url;
+		if (std::optional<std::string> asset = asset_cache::asset_key(url)) {
+			cached[index] = asset_cache::get(*asset);
+			if (cached[index]) {
+				request.bot->log(dpp::ll_info, "Asset cache hit: " + *asset + " hash=" + cached[index]->hash);
+			}
+		} else {
+			const std::string url_key = url_cache::canonical_key(url);
+			std::optional<url_cache::entry> url_entry = url_key.empty() ? std::nullopt : url_cache::get(url_key);
+			if (url_entry) {
+				request.bot->log(dpp::ll_info, "URL cache hit: " + url_key + " hash=" + url_entry->hash);
+				cached[index] = asset_cache::entry{ .hash = url_entry->hash };
+				if (url_entry->last_verdict) {
+					cached[index]->verdicts.push_back(*url_entry->last_verdict);
+				}
+			}
+		}
+		any_cached = any_cached || cached[index].has_value();
+	}
+
+	if (!any_cached) {
+		spawn_job(request);
+		return;
+	}
+
+	/* We already know some of the hashes. Check the block list, and reuse the last verdict
+	 * if it was made under the same settings. Only the rest need to be fetched.
+	 */
+	db::background([this, request, cached = std::move(cached)]() {
+		const dpp::snowflake guild_id = request.sources.front().guild_id;
+		const dpp::snowflake channel_id = request.sources.front().channel_id;
+		const guild_settings::snapshot_ptr settings = guild_settings::get(guild_id);
+		std::vector<scan_source> remaining;
+
+		for (size_t index = 0; index < request.sources.size(); ++index) {
+			const scan_source& source = request.sources[index];
+			if (!cached[index]) {
+				remaining.emplace_back(source);
+				continue;
+			}
+
+			if (block_list::contains(guild_id, cached[index]->hash)) {
+				if (request.callback) {
+					request.callback(source, cached[index]->hash, make_block_list_response(cached[index]->hash));
+				}
+			} else if (const url_cache::verdict* verdict = cached[index]->find(guild_id, channel_id, settings->version)) {
+				if (request.callback) {
+					request.callback(source, cached[index]->hash, *verdict->response);
+				}
+				statistics::increment(statistics::images_scanned, guild_id);
+			} else {
+				remaining.emplace_back(source);
+				continue;
+			}
+
+			if (cancelled(source)) {
+				return;
+			}
+		}
+
+		if (remaining.empty()) {
+			return;
+		}
+
+		post([this, remaining = scan_request(std::move(remaining), *request.bot, request.callback)]() {
+			spawn_job(remaining);
+		});
+	});
+}
+
+void scanner_reactor::spawn_job(const scan_request& request)
 {
 	std::shared_ptr<scan_job> job = std::make_shared<scan_job>(request);
-	job->attach = request.attach;
-	job->ev = request.ev;
-	job->bot = request.bot;
 
 	int child_stdin[2]{-1, -1};
 	int child_stdout[2]{-1, -1};
@@ -550,18 +718,27 @@ void scanner_reactor::start_job(const scan_request& request)
 	posix_spawn_file_actions_addclose(&actions, child_stdout[0]);
 	posix_spawn_file_actions_addclose(&actions, child_stdout[1]);
 
+	/* The bot blocks SIGINT and SIGTERM in all of its threads, tessd gets a clean mask */
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t no_signals;
+	sigemptyset(&no_signals);
+	posix_spawnattr_setsigmask(&attributes, &no_signals);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
 	const char* const argv[] = {"./tessd", nullptr};
 
 	result = posix_spawn(
 		&job->pid,
 		argv[0],
 		&actions,
-		nullptr,
+		&attributes,
 		const_cast<char* const*>(argv),
 		environ
 	);
 
 	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attributes);
 
 	close(child_stdin[0]);
 	close(child_stdout[1]);
@@ -590,8 +767,17 @@ void scanner_reactor::start_job(const scan_request& request)
 	set_nonblocking(job->stdout_fd);
 	set_nonblocking(job->pid_fd);
 
+	json fetch = {
+		{"action", "fetch"},
+		{"nsfwd_socket", nsfwd_socket()},
+		{"items", json::array()}
+	};
+	for (const scan_item& item : job->items) {
+		fetch["items"].push_back(make_fetch_item(item.source));
+	}
+
 	job->stage = scan_stage::writing_fetch;
-	job->output_buffer = make_json_frame(make_fetch_request(job->attach));
+	job->output_buffer = make_json_frame(fetch);
 	job->output_offset = 0;
 
 	job->bot->log(dpp::ll_info, fmt::format(fmt::runtime("spawned tessd; pid={}"), job->pid));
@@ -640,7 +826,7 @@ void scanner_reactor::handle_child_stdin(const std::shared_ptr<scan_job>& job)
 
 	if (job->stage == scan_stage::writing_continue) {
 		job->stage = scan_stage::waiting_scan;
-		remove_fd(job->stdin_fd);
+		disable_fd(job->stdin_fd);
 		return;
 	}
 
@@ -724,73 +910,192 @@ void scanner_reactor::process_frame(const std::shared_ptr<scan_job>& job, const
 
 void scanner_reactor::process_hash_frame(const std::shared_ptr<scan_job>& job, const json& frame)
 {
-	if (!frame.contains("stage") || frame.at("stage") != "hash" || !frame.contains("hash") || !frame.at("hash").is_string()) {
+	/* tessd's alarm handler writes a frame with no item and exits. No item has been
+	 * answered before the lookup, so every one of them fails with that frame.
+	 */
+	if (!frame.contains("item") && frame.contains("stage")) {
+		job->bot->log(dpp::ll_warning, "tessd failed while fetching: " + frame.dump());
+		close_job_io(job);
+		job->stage = scan_stage::waiting_exit;
+		if (job->callback) {
+			for (const scan_item& item : job->items) {
+				job->callback(item.source, item.hash, frame);
+			}
+		}
+		return;
+	}
+
+	if (!frame.contains("item") || !frame.at("item").is_number_unsigned() || frame.at("item").get<size_t>() >= job->items.size() || !frame.contains("stage")) {
 		job->bot->log(dpp::ll_warning, "tessd returned invalid hash frame: " + frame.dump());
 		close_job_io(job);
 		return;
 	}
 
-	job->hash = frame.at("hash").get<std::string>();
-	job->bot->log(dpp::ll_info, "read hash response");
-
-	db::resultset block_list = db::query("SELECT hash FROM block_list_items WHERE guild_id = ? AND hash = ?", {job->ev.msg.guild_id, job->hash});
-
-	if (!block_list.empty()) {
-		json response = {
-			{"stage", "scan"},
-			{"status", "blocked"},
-			{"hash", job->hash},
-			{"scanner", "block_list"},
-			{"scanner_name", "Admin Block List"},
-			{"text", "Image is on the block list"},
-			{"trigger", 1.0},
-			{"threshold", 1.0},
-			{"results", json::array({
-				{
-					{"scanner", "block_list"},
-					{"scanner_name", "Admin Block List"},
-					{"enabled", true},
-					{"blocked", true},
-					{"text", "Image is on the block list"},
-					{"trigger", 1.0},
-					{"threshold", 1.0},
-					{"raw", json::object()}
-				}
-			})},
-			{"cache", json::object()}
-		};
+	scan_item& item = job->items[frame.at("item").get<size_t>()];
+
+	if (frame.at("stage") == "hash" && frame.contains("hash") && frame.at("hash").is_string()) {
+		item.hash = frame.at("hash").get<std::string>();
+		job->bot->log(dpp::ll_info, "read hash response");
+
+		if (!item.asset_key.empty()) {
+			asset_cache::store_hash(item.asset_key, item.hash);
+		} else if (!item.url_key.empty()) {
+			url_cache::store_hash(item.url_key, item.hash);
+		}
+	} else {
+		job->bot->log(dpp::ll_info, "tessd could not fetch " + item.source.url + ": " + frame.dump());
+		item.error = frame;
+	}
+
+	if (++job->hashes_received < job->items.size()) {
+		return;
+	}
+
+	/* The block list and settings lookups run on a database worker so this thread
+	 * keeps servicing other children. The frame to send is posted back here.
+	 */
+	job->stage = scan_stage::waiting_lookup;
+	db::background([this, job]() {
+		lookup_batch(job);
+	});
+}
+
+void scanner_reactor::lookup_batch(const std::shared_ptr<scan_job>& job)
+{
+	const scan_source& first = job->items.front().source;
+	const guild_settings::snapshot_ptr settings = guild_settings::get(first.guild_id);
+	job->settings_version = settings->version;
+	json request = make_continue_request(*settings, first.channel_id);
+	bool fetched = false;
+
+	for (size_t index = 0; index < job->items.size(); ++index) {
+		const scan_item& item = job->items[index];
+
+		if (item.hash.empty()) {
+			if (job->callback) {
+				job->callback(item.source, "", item.error);
+			}
+			continue;
+		}
+
+		fetched = true;
+
+		if (!block_list::contains(item.source.guild_id, item.hash)) {
+			job->scan_order.emplace_back(index);
+			request["items"].push_back({
+				{"item", index},
+				{"cache", get_scan_cache(item.hash)}
+			});
+			continue;
+		}
 
 		if (job->callback) {
-			job->callback(job->hash, response);
+			job->callback(item.source, item.hash, make_block_list_response(item.hash));
+		}
+
+		if (cancelled(item.source)) {
+			job->scan_order.clear();
+			break;
 		}
+	}
+
+	if (!fetched) {
+		/* tessd exits by itself when it could fetch nothing */
+		return;
+	}
+
+	if (job->scan_order.empty()) {
+		post([this, job]() {
+			send_frame(job, scan_stage::writing_stop, {{"action", "stop"}});
+		});
+		return;
+	}
+
+	post([this, job, request]() {
+		send_frame(job, scan_stage::writing_continue, request);
+	});
+}
 
-		job->stage = scan_stage::writing_stop;
-		job->output_buffer = make_json_frame({{"action", "stop"}});
-		job->output_offset = 0;
-		modify_or_add_stdin(job);
+void scanner_reactor::send_frame(const std::shared_ptr<scan_job>& job, scan_stage stage, const json& frame)
+{
+	if (job->stdin_fd == -1) {
+		/* tessd went away while the lookup was running */
 		return;
 	}
 
-	job->stage = scan_stage::writing_continue;
-	job->output_buffer = make_json_frame(make_continue_request(*job->bot, job->ev.msg.guild_id, job->ev.msg.channel_id, job->hash));
+	job->stage = stage;
+	job->output_buffer = make_json_frame(frame);
 	job->output_offset = 0;
 	modify_or_add_stdin(job);
 }
 
 void scanner_reactor::process_scan_frame(const std::shared_ptr<scan_job>& job, const json& frame)
 {
-	job->result_received = true;
+	/* tessd scans the items in the order they were sent in the continue frame. Only the
+	 * timeout frame has no item, and tessd has exited once it is sent.
+	 */
+	const bool timed_out = !frame.contains("item");
+	if (job->scans_received >= job->scan_order.size() || (!timed_out && (!frame.at("item").is_number_unsigned() || frame.at("item").get<size_t>() != job->scan_order[job->scans_received]))) {
+		job->bot->log(dpp::ll_warning, "tessd returned invalid scan frame: " + frame.dump());
+		close_job_io(job);
+		return;
+	}
+
+	const size_t index = job->scan_order[job->scans_received++];
+	const scan_item& item = job->items[index];
+	const bool last = timed_out || job->scans_received == job->scan_order.size();
 	job->bot->log(dpp::ll_info, "handle scan response");
 
-	if (job->callback) {
-		job->callback(job->hash, frame);
+	if ((!item.asset_key.empty() || !item.url_key.empty()) && frame.contains("stage") && frame.at("stage") == "scan") {
+		/* The cached copy must not write the scan cache again when it is replayed */
+		json response = frame;
+		response["cache"] = json::object();
+		const url_cache::verdict verdict{
+			.guild_id = item.source.guild_id,
+			.channel_id = item.source.channel_id,
+			.settings_version = job->settings_version,
+			.response = std::make_shared<const json>(std::move(response)),
+		};
+		if (!item.asset_key.empty()) {
+			asset_cache::store_verdict(item.asset_key, item.hash, verdict);
+		} else {
+			url_cache::store_verdict(item.url_key, item.hash, verdict);
+		}
 	}
 
-	INCREMENT_STATISTIC("images_scanned", job->ev.msg.guild_id);
+	/* Handling the response writes to the database and Discord, keep it off this thread.
+	 * tessd waits for it before scanning the next item, which is skipped if this one
+	 * got the message deleted.
+	 */
+	job->stage = last ? scan_stage::waiting_exit : scan_stage::waiting_lookup;
+	db::background([this, job, index, frame, last]() {
+		const scan_item& item = job->items[index];
 
-	job->bot->log(dpp::ll_info, "handle scan response done");
+		if (job->callback) {
+			job->callback(item.source, item.hash, frame);
+		}
 
-	remove_fd(job->stdout_fd);
+		statistics::increment(statistics::images_scanned, item.source.guild_id);
+
+		job->bot->log(dpp::ll_info, "handle scan response done");
+
+		if (last) {
+			return;
+		}
+
+		const bool stop = cancelled(item.source);
+		post([this, job, stop]() {
+			if (stop) {
+				send_frame(job, scan_stage::writing_stop, {{"action", "stop"}});
+			} else {
+				send_frame(job, scan_stage::writing_continue, {{"action", "next"}});
+			}
+		});
+	});
+
+	if (last) {
+		remove_fd(job->stdout_fd);
+	}
 }
 
 void scanner_reactor::modify_or_add_stdin(const std::shared_ptr<scan_job>& job)
@@ -824,33 +1129,67 @@ void scanner_reactor::close_job_io(const std::shared_ptr<scan_job>& job)
 	remove_fd(job->stdout_fd);
 }
 
-void download_image(const dpp::attachment attach, dpp::cluster& bot, const dpp::message_create_t ev)
+/**
+ * @brief Hosts from the "denied_hosts" config list, whose images are deleted without being fetched
+ */
+const host_matcher& denied_hosts()
 {
-	std::string lower_url = attach.url;
-	std::string path;
-	try {
-		Url u(attach.url);
-		path = u.path();
-		if ((u.scheme() != "http" && u.scheme() != "https") || u.host().empty()) {
-			bot.log(dpp::ll_info, "Not a URL: " + attach.url);
-			return;
+	static const host_matcher matcher([] {
+		std::vector<std::string> patterns;
+		const json list = config::get().value("denied_hosts", json::array());
+		for (const json& pattern : list) {
+			if (pattern.is_string()) {
+				patterns.emplace_back(pattern.get<std::string>());
+			}
+		}
+		return patterns;
+	}());
+	return matcher;
+}
+
+void download_images(std::vector<scan_source> sources, dpp::cluster& bot)
+{
+	std::vector<scan_source> batch;
+
+	for (scan_source& source : sources) {
+		if (scanned_items::scanned(source)) {
+			continue;
+		}
+
+		try {
+			Url u(source.url);
+			if ((u.scheme() != "http" && u.scheme() != "https") || u.host().empty()) {
+				bot.log(dpp::ll_info, "Not a URL: " + source.url);
+				continue;
+			}
+		} catch (const std::exception& e) {
+			bot.log(dpp::ll_info, "Not a URL: " + source.url + ": " + std::string(e.what()));
+			continue;
 		}
-	} catch (const std::exception& e) {
-		bot.log(dpp::ll_info, "Not a URL: " + attach.url + ": " + std::string(e.what()));
-		return;
-	}
 
-	bot.log(dpp::ll_info, "Scan image: " + attach.url);
+		bot.log(dpp::ll_info, "Scan image: " + source.url);
 
-	for (int index = 0; whitelist[index] != nullptr; ++index) {
-		if (match(attach.url.c_str(), whitelist[index])) {
-			bot.log(dpp::ll_info, "Image " + attach.url + " is whitelisted by " + std::string(whitelist[index]) + "; not scanning");
+		if (std::optional<size_t> denied = denied_hosts().find(source.url)) {
+			/* The whole message goes, so nothing else in it needs scanning */
+			bot.log(dpp::ll_info, "Image " + source.url + " is on a denied host " + denied_hosts().pattern(*denied) + "; deleting without scanning");
+			delete_message_and_warn("", "", bot, source, "Denied host: " + denied_hosts().pattern(*denied));
 			return;
 		}
+
+		if (std::optional<size_t> whitelisted = whitelisted_urls().find(source.url)) {
+			bot.log(dpp::ll_info, "Image " + source.url + " is whitelisted by " + whitelisted_urls().pattern(*whitelisted) + "; not scanning");
+			continue;
+		}
+
+		if (source.width * source.height > 33554432) {
+			bot.log(dpp::ll_info, "Image dimensions of " + std::to_string(source.width) + "x" + std::to_string(source.height) + " too large");
+			continue;
+		}
+
+		batch.emplace_back(std::move(source));
 	}
 
-	if (attach.width * attach.height > 33554432) {
-		bot.log(dpp::ll_info, "Image dimensions of " + std::to_string(attach.width) + "x" + std::to_string(attach.height) + " too large");
+	if (batch.empty()) {
 		return;
 	}
 
@@ -859,7 +1198,15 @@ void download_image(const dpp::attachment attach, dpp::cluster& bot, const dpp::
 		return;
 	}
 
-	scanner_reactor::instance().submit(attach, bot, ev, [&bot, ev, attach](const std::string& hash, const json& response) {
-		handle_scan_response(response, hash, bot, ev, attach);
+	/* Only images actually submitted are recorded, so anything skipped is scanned if the message is edited */
+	std::erase_if(batch, [](const scan_source& source) {
+		return !scanned_items::first_scan(source);
+	});
+	if (batch.empty()) {
+		return;
+	}
+
+	scanner_reactor::instance().submit(std::move(batch), bot, [&bot](const scan_source& source, const std::string& hash, const json& response) {
+		handle_scan_response(response, hash, bot, source);
 	});
 }
@@ -0,0 +1,334 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/guild_settings.h>
+#include <beholder/database.h>
+#include <beholder/pattern_matcher.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+	/**
+	 * @brief Number of independently updated maps the cache is split into
+	 */
+	constexpr size_t shard_count = 64;
+
+	/**
+	 * @brief Snapshots older than this are dropped even if no change was seen.
+	 * This catches anything the version poll misses, such as a change committed
+	 * with a timestamp behind the poll's watermark.
+	 */
+	constexpr time_t max_snapshot_age = 600;
+
+	using guild_map = std::unordered_map<dpp::snowflake, guild_settings::snapshot_ptr>;
+
+	/**
+	 * @brief One part of the cache. Readers atomically load the current map and never
+	 * lock; writers copy the map under write_mutex and publish the copy.
+	 */
+	struct shard {
+		std::shared_ptr<const guild_map> guilds{std::make_shared<guild_map>()};
+
+		/**
+		 * @brief Serialises writers
+		 */
+		std::mutex write_mutex;
+
+		/**
+		 * @brief Incremented whenever entries are removed, so a load which started
+		 * before an invalidation does not publish stale settings. Guarded by write_mutex.
+		 */
+		uint64_t generation{0};
+	};
+
+	shard shards[shard_count];
+
+	/**
+	 * @brief guild_settings_version.updated_at of the newest change seen, as a unix timestamp
+	 */
+	double poll_watermark{0};
+
+	/**
+	 * @brief Guards poll_watermark
+	 */
+	std::mutex poll_mutex;
+
+	shard& shard_for(dpp::snowflake guild_id) {
+		/* The low bits of a snowflake are a per-process counter, the timestamp spreads better */
+		return shards[(static_cast<uint64_t>(guild_id) >> 22) % shard_count];
+	}
+
+	std::shared_ptr<const guild_map> current(shard& s) {
+		return std::atomic_load_explicit(&s.guilds, std::memory_order_acquire);
+	}
+
+	guild_settings::snapshot_ptr find(dpp::snowflake guild_id) {
+		auto guilds = current(shard_for(guild_id));
+		auto found = guilds->find(guild_id);
+		return found == guilds->end() ? nullptr : found->second;
+	}
+
+	uint64_t generation(shard& s) {
+		std::lock_guard<std::mutex> lock(s.write_mutex);
+		return s.generation;
+	}
+
+	void publish(dpp::snowflake guild_id, const guild_settings::snapshot_ptr& settings, uint64_t loaded_generation) {
+		shard& s = shard_for(guild_id);
+		std::lock_guard<std::mutex> lock(s.write_mutex);
+		if (s.generation != loaded_generation) {
+			return;
+		}
+		auto guilds = std::make_shared<guild_map>(*current(s));
+		(*guilds)[guild_id] = settings;
+		std::atomic_store_explicit(&s.guilds, std::shared_ptr<const guild_map>(std::move(guilds)), std::memory_order_release);
+	}
+
+	/**
+	 * @brief Remove entries from a shard
+	 *
+	 * @param s shard
+	 * @param invalidating true if settings have changed, so that loads already running are not published
+	 * @param remove predicate, true for entries to remove
+	 */
+	template<typename Predicate> void remove_if(shard& s, bool invalidating, Predicate remove) {
+		std::lock_guard<std::mutex> lock(s.write_mutex);
+		if (invalidating) {
+			s.generation++;
+		}
+		auto existing = current(s);
+		if (std::none_of(existing->begin(), existing->end(), remove)) {
+			return;
+		}
+		auto guilds = std::make_shared<guild_map>();
+		guilds->reserve(existing->size());
+		for (const auto& entry : *existing) {
+			if (!remove(entry)) {
+				guilds->emplace(entry);
+			}
+		}
+		std::atomic_store_explicit(&s.guilds, std::shared_ptr<const guild_map>(std::move(guilds)), std::memory_order_release);
+	}
+
+	guild_settings::snapshot_ptr load(dpp::snowflake guild_id) {
+		auto settings = std::make_shared<guild_settings::snapshot>();
+		settings->guild_id = guild_id;
+		settings->loaded_at = time(nullptr);
+
+		/* Read the version first, so a change made while the rest loads is seen as newer */
+		db::result version = db::execute("SELECT version FROM guild_settings_version WHERE guild_id = ?", {guild_id});
+		if (!version.empty()) {
+			settings->version = version.get<uint64_t>(0, "version");
+		}
+
+		db::result config = db::execute("SELECT log_channel, embeds_disabled, embed_title, embed_body, prem_languages FROM guild_config WHERE guild_id = ?", {guild_id});
+		if (!config.empty()) {
+			settings->has_config = true;
+			settings->log_channel = config.get<dpp::snowflake>(0, "log_channel");
+			settings->embeds_disabled = config.get<bool>(0, "embeds_disabled");
+			settings->embed_title = config.get<std::string>(0, "embed_title");
+			settings->embed_body = config.get<std::string>(0, "embed_body");
+			settings->languages = parse_language_list(config.get<std::string>(0, "prem_languages"));
+		}
+
+		settings->premium = !db::execute("SELECT 1 FROM premium_credits WHERE guild_id = ? AND active = 1 LIMIT 1", {guild_id}).empty();
+
+		db::result channels = db::execute(
+			"SELECT channel_id, warn, action, silence_length, ban_length, "
+			"basic_nsfw_suggestive, basic_nsfw_porn, basic_nsfw_drawing, basic_nsfw_hentai, "
+			"prem_profanity_filter_enable, prem_anim_scan_enable, prem_video_scan_enable "
+			"FROM channel_settings WHERE guild_id = ?",
+			{guild_id}
+		);
+		for (size_t row = 0; row < channels.size(); ++row) {
+			guild_settings::channel_settings channel;
+			channel.warn = channels.get<bool>(row, "warn");
+			channel.action = channels.get<uint8_t>(row, "action");
+			channel.silence_length = channels.get<uint64_t>(row, "silence_length");
+			channel.ban_length = channels.get<uint64_t>(row, "ban_length");
+			channel.basic_nsfw_suggestive = channels.get<double>(row, "basic_nsfw_suggestive");
+			channel.basic_nsfw_porn = channels.get<double>(row, "basic_nsfw_porn");
+			channel.basic_nsfw_drawing = channels.get<double>(row, "basic_nsfw_drawing");
+			channel.basic_nsfw_hentai = channels.get<double>(row, "basic_nsfw_hentai");
+			channel.prem_profanity_filter_enable = db_bool(channels.get<std::string>(row, "prem_profanity_filter_enable"), false);
+			channel.prem_anim_scan_enable = db_bool(channels.get<std::string>(row, "prem_anim_scan_enable"), true);
+			channel.prem_video_scan_enable = db_bool(channels.get<std::string>(row, "prem_video_scan_enable"), true);
+			settings->channels[channels.get<dpp::snowflake>(row, "channel_id")] = channel;
+		}
+
+		/* Normalised here, once per snapshot, so tessd can compile them as they are */
+		db::result patterns = db::execute("SELECT pattern, channel_id, pattern_type FROM guild_patterns WHERE guild_id = ?", {guild_id});
+		settings->patterns.reserve(patterns.size());
+		std::vector<std::string> regexes;
+		for (size_t row = 0; row < patterns.size(); ++row) {
+			std::string text = pattern_matcher::normalise(patterns.get<std::string_view>(row, "pattern"));
+			if (text.empty()) {
+				continue;
+			}
+			const bool is_regex = patterns.get<std::string_view>(row, "pattern_type") == "regex";
+			if (is_regex) {
+				settings->regex_patterns.push_back(settings->patterns.size());
+				regexes.push_back(text);
+			}
+			settings->patterns.push_back({
+				.text = std::move(text),
+				.channel_id = patterns.get<dpp::snowflake>(row, "channel_id"),
+				.is_regex = is_regex,
+			});
+		}
+
+		/* Compiled once per snapshot, so scans reuse it until the guild's patterns change */
+		if (!regexes.empty()) {
+			settings->regexes = std::make_shared<const regex::regex_set>(regexes);
+		}
+
+		db::result ignored = db::execute("SELECT channel_id FROM guild_ignored_channels WHERE guild_id = ?", {guild_id});
+		for (size_t row = 0; row < ignored.size(); ++row) {
+			settings->ignored_channels.emplace(ignored.get<dpp::snowflake>(row, 0));
+		}
+
+		db::result roles = db::execute("SELECT role_id FROM guild_bypass_roles WHERE guild_id = ?", {guild_id});
+		for (size_t row = 0; row < roles.size(); ++row) {
+			settings->bypass_roles.emplace_back(roles.get<dpp::snowflake>(row, 0));
+		}
+
+		return settings;
+	}
+}
+
+namespace guild_settings {
+
+	const channel_settings* snapshot::channel(dpp::snowflake channel_id) const {
+		auto found = channels.find(channel_id);
+		if (found == channels.end()) {
+			found = channels.find(dpp::snowflake(0));
+		}
+		return found == channels.end() ? nullptr : &found->second;
+	}
+
+	std::vector<std::string> snapshot::patterns_for(dpp::snowflake channel_id) const {
+		std::vector<std::string> texts;
+		for (const pattern& p : patterns) {
+			if (!p.is_regex && (p.channel_id.empty() || p.channel_id == channel_id)) {
+				texts.emplace_back(p.text);
+			}
+		}
+		return texts;
+	}
+
+	bool snapshot::has_regexes_for(dpp::snowflake channel_id) const {
+		return std::any_of(regex_patterns.begin(), regex_patterns.end(), [this, channel_id](size_t index) {
+			return patterns[index].channel_id.empty() || patterns[index].channel_id == channel_id;
+		});
+	}
+
+	std::optional<std::string> snapshot::match_regexes(dpp::snowflake channel_id, const std::string& text) const {
+		if (!regexes || text.empty()) {
+			return std::nullopt;
+		}
+		for (size_t index : regexes->match(text)) {
+			const pattern& p = patterns[regex_patterns[index]];
+			if (p.channel_id.empty() || p.channel_id == channel_id) {
+				return p.text;
+			}
+		}
+		return std::nullopt;
+	}
+
+	bool snapshot::bypasses(const std::vector<dpp::snowflake>& roles) const {
+		for (const dpp::snowflake& role : bypass_roles) {
+			if (std::find(roles.begin(), roles.end(), role) != roles.end()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	snapshot_ptr get(dpp::snowflake guild_id) {
+		snapshot_ptr settings = find(guild_id);
+		if (settings) {
+			return settings;
+		}
+		uint64_t loaded_generation = generation(shard_for(guild_id));
+		settings = load(guild_id);
+		publish(guild_id, settings, loaded_generation);
+		return settings;
+	}
+
+	dpp::async<snapshot_ptr> co_get(dpp::snowflake guild_id) {
+		return dpp::async<snapshot_ptr>{[guild_id](auto&& resolve) {
+			snapshot_ptr settings = find(guild_id);
+			if (settings) {
+				resolve(settings);
+				return;
+			}
+			db::background([guild_id, resolve]() {
+				resolve(get(guild_id));
+			});
+		}};
+	}
+
+	void invalidate(dpp::snowflake guild_id) {
+		remove_if(shard_for(guild_id), true, [guild_id](const guild_map::value_type& entry) {
+			return entry.first == guild_id;
+		});
+	}
+
+	void poll_changes() {
+		std::lock_guard<std::mutex> lock(poll_mutex);
+
+		if (poll_watermark == 0) {
+			/* Use the database's clock, not ours, so the two can't drift apart */
+			db::result now = db::execute("SELECT UNIX_TIMESTAMP(NOW(6)) AS now");
+			if (!now.empty()) {
+				poll_watermark = now.get<double>(0, "now");
+			}
+		} else {
+			db::result changes = db::execute(
+				"SELECT guild_id, version, UNIX_TIMESTAMP(updated_at) AS updated FROM guild_settings_version WHERE updated_at >= FROM_UNIXTIME(?)",
+				{poll_watermark}
+			);
+			for (size_t row = 0; row < changes.size(); ++row) {
+				dpp::snowflake guild_id = changes.get<dpp::snowflake>(row, "guild_id");
+				snapshot_ptr cached = find(guild_id);
+				if (cached && cached->version != changes.get<uint64_t>(row, "version")) {
+					invalidate(guild_id);
+				}
+				poll_watermark = std::max(poll_watermark, changes.get<double>(row, "updated"));
+			}
+		}
+
+		time_t expired = time(nullptr) - max_snapshot_age;
+		for (shard& s : shards) {
+			remove_if(s, false, [expired](const guild_map::value_type& entry) {
+				return entry.second->loaded_at < expired;
+			});
+		}
+	}
+
+	size_t size() {
+		size_t total = 0;
+		for (shard& s : shards) {
+			total += current(s)->size();
+		}
+		return total;
+	}
+};
@@ -0,0 +1,243 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/host_matcher.h>
+#include <algorithm>
+
+namespace {
+
+	inline char fold(char c) {
+		return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+	}
+
+	std::string lower(std::string_view text) {
+		std::string out(text);
+		std::transform(out.begin(), out.end(), out.begin(), fold);
+		return out;
+	}
+
+	/**
+	 * @brief Wildcard match, '*' for any run of characters and '?' for any one, ignoring case
+	 */
+	bool glob(std::string_view text, std::string_view mask) {
+		size_t t = 0, m = 0, star = std::string_view::npos, resume = 0;
+		while (t < text.size()) {
+			if (m < mask.size() && mask[m] == '*') {
+				star = m++;
+				resume = t;
+			} else if (m < mask.size() && (mask[m] == '?' || fold(mask[m]) == fold(text[t]))) {
+				m++;
+				t++;
+			} else if (star != std::string_view::npos) {
+				m = star + 1;
+				t = ++resume;
+			} else {
+				return false;
+			}
+		}
+		while (m < mask.size() && mask[m] == '*') {
+			m++;
+		}
+		return m == mask.size();
+	}
+
+	struct url_parts {
+		std::string_view scheme;
+		std::string_view host;
+		std::string_view path;
+	};
+
+	/**
+	 * @brief Split "[scheme://]authority[path]" without validating it. User info and
+	 * the port are dropped from the authority, leaving the host.
+	 */
+	url_parts split_url(std::string_view url) {
+		url_parts parts;
+		size_t separator = url.find("://");
+		if (separator != std::string_view::npos && url.find_first_of("/?#") > separator) {
+			parts.scheme = url.substr(0, separator);
+			url.remove_prefix(separator + 3);
+		}
+		size_t path_start = url.find_first_of("/?#");
+		if (path_start == std::string_view::npos) {
+			path_start = url.size();
+		}
+		std::string_view authority = url.substr(0, path_start);
+		parts.path = url.substr(path_start);
+
+		size_t at = authority.rfind('@');
+		if (at != std::string_view::npos) {
+			authority.remove_prefix(at + 1);
+		}
+		size_t colon = authority.rfind(':');
+		if (colon != std::string_view::npos && authority.find(']', colon) == std::string_view::npos) {
+			authority = authority.substr(0, colon);
+		}
+		while (!authority.empty() && authority.back() == '.') {
+			authority.remove_suffix(1);
+		}
+		parts.host = authority;
+		return parts;
+	}
+
+	/**
+	 * @brief Host labels from right to left
+	 */
+	std::vector<std::string_view> reversed_labels(std::string_view host) {
+		std::vector<std::string_view> labels;
+		size_t end = host.size();
+		while (true) {
+			size_t dot = host.rfind('.', end == 0 ? 0 : end - 1);
+			if (end == 0 || dot == std::string_view::npos) {
+				labels.push_back(host.substr(0, end));
+				break;
+			}
+			labels.push_back(host.substr(dot + 1, end - dot - 1));
+			end = dot;
+		}
+		return labels;
+	}
+}
+
+host_matcher::host_matcher(const std::vector<std::string>& pattern_list) : patterns(pattern_list) {
+	rules.resize(patterns.size());
+	nodes.emplace_back();
+
+	for (size_t index = 0; index < patterns.size(); ++index) {
+		if (patterns[index].empty()) {
+			continue;
+		}
+		const std::string folded = lower(patterns[index]);
+		const url_parts parts = split_url(folded);
+		rule& r = rules[index];
+		r.scheme = std::string(parts.scheme);
+		r.path = std::string(parts.path);
+		r.path_prefix = !r.path.empty() && r.path.back() == '*' && r.path.find_first_of("*?") == r.path.size() - 1;
+		if (r.path_prefix) {
+			r.path.pop_back();
+		}
+
+		const std::vector<std::string_view> labels = reversed_labels(parts.host);
+		uint32_t state = 0;
+		bool subdomains = false;
+		for (size_t depth = 0; depth < labels.size(); ++depth) {
+			if (labels[depth] == "*" && depth + 1 == labels.size() && depth > 0) {
+				subdomains = true;
+				break;
+			}
+			state = add_child(state, std::string(labels[depth]));
+		}
+		(subdomains ? nodes[state].subdomains : nodes[state].exact).push_back(static_cast<uint32_t>(index));
+	}
+}
+
+const std::string& host_matcher::pattern(size_t index) const {
+	return patterns.at(index);
+}
+
+size_t host_matcher::size() const {
+	return patterns.size();
+}
+
+uint32_t host_matcher::child(uint32_t state, std::string_view label) const {
+	const auto& children = nodes[state].children;
+	auto found = std::lower_bound(children.begin(), children.end(), label, [](const std::pair<std::string, uint32_t>& entry, std::string_view l) {
+		return entry.first < l;
+	});
+	return (found != children.end() && found->first == label) ? found->second : 0;
+}
+
+uint32_t host_matcher::add_child(uint32_t state, const std::string& label) {
+	const bool wildcard = label.find_first_of("*?") != std::string::npos;
+	if (wildcard) {
+		for (const auto& [existing, next] : nodes[state].wildcard_children) {
+			if (existing == label) {
+				return next;
+			}
+		}
+	} else if (uint32_t existing = child(state, label)) {
+		return existing;
+	}
+
+	const uint32_t added = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	if (wildcard) {
+		nodes[state].wildcard_children.emplace_back(label, added);
+		return added;
+	}
+	auto& children = nodes[state].children;
+	auto position = std::lower_bound(children.begin(), children.end(), label, [](const std::pair<std::string, uint32_t>& entry, const std::string& l) {
+		return entry.first < l;
+	});
+	children.insert(position, {label, added});
+	return added;
+}
+
+void host_matcher::collect(uint32_t state, const std::vector<std::string_view>& labels, size_t depth, std::vector<uint32_t>& found) const {
+	const node& current = nodes[state];
+	if (depth == labels.size()) {
+		found.insert(found.end(), current.exact.begin(), current.exact.end());
+		return;
+	}
+	found.insert(found.end(), current.subdomains.begin(), current.subdomains.end());
+	if (uint32_t next = child(state, labels[depth])) {
+		collect(next, labels, depth + 1, found);
+	}
+	for (const auto& [mask, next] : current.wildcard_children) {
+		if (glob(labels[depth], mask)) {
+			collect(next, labels, depth + 1, found);
+		}
+	}
+}
+
+bool host_matcher::path_matches(const rule& r, std::string_view path) const {
+	if (r.path.empty() && !r.path_prefix) {
+		return true;
+	}
+	if (r.path_prefix) {
+		return path.size() >= r.path.size() && std::equal(r.path.begin(), r.path.end(), path.begin(), [](char a, char b) {
+			return a == fold(b);
+		});
+	}
+	return glob(path, r.path);
+}
+
+std::optional<size_t> host_matcher::find(std::string_view url) const {
+	const url_parts parts = split_url(url);
+	if (parts.host.empty()) {
+		return std::nullopt;
+	}
+	const std::string host = lower(parts.host);
+
+	std::vector<uint32_t> found;
+	collect(0, reversed_labels(host), 0, found);
+	if (found.empty()) {
+		return std::nullopt;
+	}
+
+	std::sort(found.begin(), found.end());
+	const std::string scheme = lower(parts.scheme);
+	for (uint32_t index : found) {
+		const rule& r = rules[index];
+		if ((r.scheme.empty() || r.scheme == scheme) && path_matches(r, parts.path)) {
+			return index;
+		}
+	}
+	return std::nullopt;
+}
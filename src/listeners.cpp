@@ -17,11 +17,16 @@
  * limitations under the License.
  *
  ************************************************************************************/
-#include <set>
 #include <fmt/format.h>
-#include <CxxUrl/url.hpp>
 #include <beholder/listeners.h>
 #include <beholder/database.h>
+#include <beholder/guild_settings.h>
+#include <beholder/statistics.h>
+#include <beholder/scan_cache.h>
+#include <beholder/block_list.h>
+#include <beholder/message_urls.h>
+#include <beholder/scan_source.h>
+#include <beholder/regex_set.h>
 #include <beholder/beholder.h>
 #include <beholder/command.h>
 #include <beholder/sarcasm.h>
@@ -185,6 +190,29 @@ namespace listeners {
 		return out;
 	}
 
+	/**
+	 * @brief Update the bot's presence with server and image counts
+	 * 
+	 * @param bot cluster pointer. This is a coroutine, so it takes a pointer rather
+	 * than a reference which might not outlive the first suspension.
+	 */
+	dpp::job set_presence(dpp::cluster* bot) {
+		auto counts_query = db::co_query("SELECT COUNT(*) as guild_total FROM guild_cache");
+		auto stats_query = db::co_query("SELECT SUM(images_scanned) as images_scanned, SUM(images_blocked + images_ocr + images_nsfw) AS images_deleted FROM guild_statistics");
+		db::resultset counts = (co_await counts_query).rows;
+		db::resultset stats = (co_await stats_query).rows;
+		if (counts.empty()) {
+			co_return;
+		}
+		std::string guild_count = counts[0].at("guild_total");
+		std::string scanned{"0"}, blocked{"0"};
+		if (!stats.empty()) {
+			scanned = stats[0].at("images_scanned");
+			blocked = stats[0].at("images_deleted");
+		}
+		bot->set_presence(dpp::presence(dpp::ps_online, dpp::at_custom, fmt::format(fmt::runtime("Protecting {} servers. {} images scanned, {} removed."), comma(guild_count), comma(scanned), comma(blocked))));
+	}
+
 	void on_ready(const dpp::ready_t &event) {
 		dpp::cluster& bot = *event.owner;
 		if (dpp::run_once<struct register_bot_commands>()) {
@@ -201,20 +229,8 @@ namespace listeners {
 				register_command<scan_command>(bot),
 			});
 
-			auto set_presence = [&bot]() {
-				db::resultset counts = db::query("SELECT COUNT(*) as guild_total FROM guild_cache");
-				std::string guild_count = counts[0].at("guild_total");
-				std::string scanned{"0"}, blocked{"0"};
-				db::resultset stats = db::query("SELECT SUM(images_scanned) as images_scanned, SUM(images_blocked + images_ocr + images_nsfw) AS images_deleted FROM guild_statistics");
-				if (!stats.empty()) {
-					scanned = stats[0].at("images_scanned");
-					blocked = stats[0].at("images_deleted");
-				}
-				bot.set_presence(dpp::presence(dpp::ps_online, dpp::at_custom, fmt::format(fmt::runtime("Protecting {} servers. {} images scanned, {} removed."), comma(guild_count), comma(scanned), comma(blocked))));
-			};
-
-			bot.start_timer([&bot, set_presence](dpp::timer t) {
-				set_presence();
+			bot.start_timer([&bot](dpp::timer t) {
+				set_presence(&bot);
 			}, 240);
 			bot.start_timer([&bot](dpp::timer t) {
 				post_botlists(bot);
@@ -222,8 +238,55 @@ namespace listeners {
 			bot.start_timer([&bot](dpp::timer t) {
 				welcome_new_guilds(bot);
 			}, 30);
-
-			set_presence();
+			bot.start_timer([](dpp::timer t) {
+				db::background(&guild_settings::poll_changes);
+			}, 10);
+			bot.start_timer([](dpp::timer t) {
+				/* Picks up block list changes made outside the bot */
+				db::background(&block_list::load);
+			}, 300);
+			bot.start_timer([&bot](dpp::timer t) {
+				db::background([&bot]() {
+					size_t deleted = scan_cache::expire_database();
+					if (deleted) {
+						bot.log(dpp::ll_info, "Scan cache: expired " + std::to_string(deleted) + " database rows");
+					}
+				});
+			}, 600);
+			bot.start_timer([](dpp::timer t) {
+				db::background([]() {
+					statistics::flush();
+				});
+			}, 5);
+			bot.start_timer([&bot](dpp::timer t) {
+				db::pool_statistics pool = db::pool_stats();
+				bot.log(dpp::ll_info, fmt::format(
+					fmt::runtime("SQL pool: {}/{} in use, {} checkouts, {} waited, {:.2f}ms total wait, {:.2f}ms longest wait, {} queries, {} prepared statements"),
+					pool.size - pool.idle, pool.size, pool.checkouts, pool.waits, pool.total_wait_ms, pool.max_wait_ms, db::query_count(), db::cache_size()
+				));
+				db::result_cache_statistics cache = db::result_cache_stats();
+				bot.log(dpp::ll_info, fmt::format(
+					fmt::runtime("SQL result cache: {} entries, {}/{} KB, {} hits, {} misses, {} evictions"),
+					cache.entries, cache.bytes / 1024, cache.limit / 1024, cache.hits, cache.misses, cache.evictions
+				));
+				regex::set_statistics regexes = regex::regex_set::stats();
+				bot.log(dpp::ll_info, fmt::format(
+					fmt::runtime("Regex patterns: {} compiles in {:.2f}ms, {} matches in {:.2f}ms, {} patterns using TRE"),
+					regexes.compiles, regexes.compile_ms, regexes.matches, regexes.match_ms, regexes.fallback_patterns
+				));
+				message_urls::prefilter_statistics messages = message_urls::stats();
+				bot.log(dpp::ll_info, fmt::format(
+					fmt::runtime("Message pre-filter: {} checked, {} skipped with nothing to scan"),
+					messages.checked, messages.skipped
+				));
+				scan_cache::statistics scans = scan_cache::stats();
+				bot.log(dpp::ll_info, fmt::format(
+					fmt::runtime("Scan cache: {} in memory, {} KB on disk, {} memory hits, {} disk hits, {} database hits, {} misses"),
+					scans.memory_entries, scans.file_bytes / 1024, scans.memory_hits, scans.file_hits, scans.database_hits, scans.misses
+				));
+			}, 300);
+
+			set_presence(&bot);
 			welcome_new_guilds(bot);
 
 			register_botlist<topgg>();
@@ -247,6 +310,7 @@ namespace listeners {
 			db::query("DELETE FROM channel_settings WHERE guild_id = ?", { event.deleted.id });
 			db::query("DELETE FROM guild_config WHERE guild_id = ?", { event.deleted.id });
 			db::query("DELETE FROM guild_statistics WHERE guild_id = ?", { event.deleted.id });
+			guild_settings::invalidate(event.deleted.id);
 			event.owner->log(dpp::ll_info, "Removed from guild: " + event.deleted.id.str());
 		}
 	}
@@ -256,15 +320,27 @@ namespace listeners {
 	void on_button_add_block_list(const dpp::button_click_t &event, const std::vector<std::string>& parts, dpp::cluster& bot, const db::resultset& logchannel) {
 		/* Block */
 		std::string hash = parts[2];
-		db::query("INSERT INTO block_list_items (guild_id, hash) VALUES(?,?) ON DUPLICATE KEY UPDATE hash = ?", {event.command.guild_id, hash, hash});
-		event.reply(":no_entry: This image has been **added to the block list** by " + event.command.usr.get_mention() + ". It will be **instantly deleted** without performing any further checks.");
+		db::query_async("INSERT INTO block_list_items (guild_id, hash) VALUES(?,?) ON DUPLICATE KEY UPDATE hash = ?", {event.command.guild_id, db::hash_key(hash), db::hash_key(hash)}, [event, hash](const db::resultset&, const std::string& error) {
+			if (!error.empty()) {
+				event.reply(dpp::message(event.command.channel_id, "Unable to update the block list, please try again later.").set_flags(dpp::m_ephemeral));
+				return;
+			}
+			block_list::add(event.command.guild_id, hash);
+			event.reply(":no_entry: This image has been **added to the block list** by " + event.command.usr.get_mention() + ". It will be **instantly deleted** without performing any further checks.");
+		});
 	}
 
 	void on_button_remove_block_list(const dpp::button_click_t &event, const std::vector<std::string>& parts, dpp::cluster& bot, const db::resultset& logchannel) {
 		/* Unblock */
 		std::string hash = parts[2];
-		db::query("DELETE FROM block_list_items WHERE guild_id = ? AND hash = ?", {event.command.guild_id, hash});
-		event.reply(":white_check_mark: This image has been **removed from the block list** by " + event.command.usr.get_mention() + ". It will now be **checked normally**.");
+		db::query_async("DELETE FROM block_list_items WHERE guild_id = ? AND hash = ?", {event.command.guild_id, db::hash_key(hash)}, [event, hash](const db::resultset&, const std::string& error) {
+			if (!error.empty()) {
+				event.reply(dpp::message(event.command.channel_id, "Unable to update the block list, please try again later.").set_flags(dpp::m_ephemeral));
+				return;
+			}
+			block_list::remove(event.command.guild_id, hash);
+			event.reply(":white_check_mark: This image has been **removed from the block list** by " + event.command.usr.get_mention() + ". It will now be **checked normally**.");
+		});
 	}
 
 	void on_button_kick_member(const dpp::button_click_t &event, const std::vector<std::string>& parts, dpp::cluster& bot, const db::resultset& logchannel) {
@@ -303,7 +379,7 @@ namespace listeners {
 		});
 	}
 
-	void on_button_click(const dpp::button_click_t &event) {
+	dpp::task<void> on_button_click(dpp::button_click_t event) {
 		dpp::permission p = event.command.get_resolved_permission(event.command.usr.id);
 		dpp::permission bot_permissions = event.command.app_permissions;
 
@@ -326,21 +402,21 @@ namespace listeners {
 		dpp::cluster& bot = *(event.owner);
 		std::vector<std::string> parts = dpp::utility::tokenize(event.custom_id, ";");
 		bot.log(dpp::ll_info, "Button click with id: " + event.custom_id);
-		db::resultset logchannel = db::query("SELECT embeds_disabled, log_channel, embed_title, embed_body FROM guild_config WHERE guild_id = ?", { event.command.guild_id });
+		db::resultset logchannel = (co_await db::co_query("SELECT embeds_disabled, log_channel, embed_title, embed_body FROM guild_config WHERE guild_id = ?", { event.command.guild_id })).rows;
 		if (!logchannel.size() || parts.size() < 3) {
 			event.reply(dpp::message(event.command.channel_id, "There's something weird about this button, or your server's configuration is missing.").set_flags(dpp::m_ephemeral));
-			return;
+			co_return;
 		}
 		auto check = permissions_per_section.find(parts[0]);
 		if (check == permissions_per_section.end()) {
 			event.reply(dpp::message(event.command.channel_id, "Missing permissions information in the bot for this interaction. This is a bug, please contact the developer.").set_flags(dpp::m_ephemeral));
-			return;
+			co_return;
 		} else if (check->second.permission_user && !p.has(check->second.permission_user)) {
 			event.reply(dpp::message(event.command.channel_id, "You require the " + std::string(check->second.name) + " permission to " + std::string(check->second.check)).set_flags(dpp::m_ephemeral));
-			return;
+			co_return;
 		} else if (check->second.permission_bot && !bot_permissions.has(check->second.permission_bot)) {
 			event.reply(dpp::message(event.command.channel_id, "I do not have the " + std::string(check->second.name) + " permission to " + std::string(check->second.check)).set_flags(dpp::m_ephemeral));
-			return;
+			co_return;
 		}
 		check->second.handler(event, parts, bot, logchannel);
 	}
@@ -359,49 +435,44 @@ namespace listeners {
 		route_command(event);
 	}
 
-	void on_message_update(const dpp::message_update_t& event) {
+	dpp::task<void> on_message_update(dpp::message_update_t event) {
 		if (event.msg.author.is_bot() || event.msg.author.id.empty()) {
-			return;
+			co_return;
 		}
 
 		constexpr double one_week = 7 * 24 * 60 * 60;
 		if (dpp::utility::time_f() - event.msg.id.get_creation_time() > one_week) {
 			event.owner->log(dpp::ll_debug, "Dropped message edit " + event.msg.id.str() + " older than one week");
-			return;
+			co_return;
 		}
 
-		try {
-			dpp::json j = dpp::json::parse(event.raw_event).at("d");
-			if (!j.contains("member") || !j["member"].is_object()) {
-				event.owner->log(dpp::ll_debug, "Dropped message edit " +event.msg.id.str() + " without member details");
-				return;
-			}
-			if (!j["member"].contains("roles") || !j["member"]["roles"].is_array()) {
-				event.owner->log(dpp::ll_debug, "Dropped message edit " +event.msg.id.str() + " without member role list");
-				return;
-			}
-		}
-		catch (const std::exception &e) {
-			event.owner->log(dpp::ll_warning, "Dropped message edit " +event.msg.id.str() + " with invalid raw JSON");
-			return;
+		/* D++ only fills in the member, and its guild ID, when the update carries member details.
+		 * Updates where Discord adds an embed to a link do not, and the roles needed for the
+		 * bypass check are unknown without them.
+		 */
+		if (event.msg.member.guild_id.empty()) {
+			event.owner->log(dpp::ll_debug, "Dropped message edit " + event.msg.id.str() + " without member details");
+			co_return;
 		}
 
-		/* Message update is mapped to message creation.
-		 * The effect is the same, the message is simply re-scanned.
+		/* Message update is mapped to message creation. Attachments and URLs
+		 * already scanned for this message are skipped, so only new ones are scanned.
 		 */
 		dpp::message_create_t c(event.owner, event.shard, event.raw_event);
 		c.msg = event.msg;
-		on_message_create(c);
+		co_await on_message_create(c);
 	}
 
-	void on_message_create(const dpp::message_create_t &event) {
+	dpp::task<void> on_message_create(dpp::message_create_t event) {
 		auto guild_member = event.msg.member;
 
 		/* If the author is a bot or webhook, stop the event (no checking). */
 		if (event.msg.author.is_bot() || event.msg.author.id.empty()) {
-			return;
+			co_return;
 		}
 
+		const bool scannable = message_urls::has_scannable_content(event.msg);
+
 		/* Check if we are mentioned in the message, if so send a sarcastic reply */
 		for (const auto& ping : event.msg.mentions) {
 			if (ping.first.id == event.owner->me.id) {
@@ -413,141 +484,46 @@ namespace listeners {
 			}
 		}
 
-		/* Check for channels that are ignored */
-		db::resultset bypass_channel = db::query("SELECT * FROM guild_ignored_channels WHERE guild_id = ? AND channel_id = ?", { event.msg.guild_id, event.msg.channel_id });
-		if (bypass_channel.size() > 0) {
-			return;
+		/* Most messages are plain chat, which needs no settings or database access at all */
+		if (!scannable) {
+			co_return;
 		}
 
-		/* Loop through all bypass roles in database */
-		db::resultset bypass_roles = db::query("SELECT * FROM guild_bypass_roles WHERE guild_id = ?", { event.msg.guild_id });
-		for (const db::row& role : bypass_roles) {
-			const auto& roles = guild_member.get_roles();
-			if (std::find(roles.begin(), roles.end(), dpp::snowflake(role.at("role_id"))) != roles.end()) {
-				/* Stop the event if user is in a bypass role */
-				return;
-			}
-		}
+		/* Cached settings are returned immediately, otherwise they load on a
+		 * database worker and this cluster thread is free while they do
+		 */
+		guild_settings::snapshot_ptr settings = co_await guild_settings::co_get(event.msg.guild_id);
 
-		/* Check each attachment in the message, if any */
-		if (event.msg.attachments.size() > 0) {
-			for (const dpp::attachment& attach : event.msg.attachments) {
-				download_image(attach, *event.owner, event);
-			}
+		/* Check for channels that are ignored */
+		if (settings->ignored_channels.contains(event.msg.channel_id)) {
+			co_return;
 		}
 
-		/* Split the message by spaces and newlines */
-		std::vector<std::string> parts = dpp::utility::tokenize(replace_string(event.msg.content, "\n", " "), " ");
+		/* Stop the event if user is in a bypass role */
+		if (settings->bypasses(guild_member.get_roles())) {
+			co_return;
+		}
 
-		/* Check for images in the embeds of the message, if any. Found urls and
-		 * scannable content are appended into the parts vector for scanning as text content.
-		 *
-		 * You might be asking "we do we look in embeds, if we ignore messages from other bots, and embeds can
-		 * only be legally sent by bots?" There are two reasons for this: Firstly, when a user sends a link
-		 * that can be automatically embedded by Discord, such as a YouTube link, an embed is automatically generated
-		 * and associated with the message. The second reason is detecting misbehaviour by selfbots.
+		/* The scans of every image in the message share this one immutable copy of it,
+		 * and otherwise carry only the IDs and the image's own URL
 		 */
-		if (event.msg.embeds.size() > 0) {
-			for (const dpp::embed& embed : event.msg.embeds) {
-				if (!embed.url.empty()) {
-					parts.emplace_back(embed.url);
-				}
-				if (embed.thumbnail.has_value() && !embed.thumbnail->url.empty()) {
-					parts.emplace_back(embed.thumbnail->url);
-				}
-				if (embed.footer.has_value() && !embed.footer->icon_url.empty()) {
-					parts.emplace_back(embed.footer->icon_url);
-				}
-				if (embed.image.has_value() && !embed.image->url.empty()) {
-					parts.emplace_back(embed.image->url);
-				}
-				if (embed.video.has_value() && !embed.video->url.empty()) {
-					parts.emplace_back(embed.video->url);
-				}
-				if (embed.author.has_value()) {
-					if (!embed.author->icon_url.empty()) {
-						parts.emplace_back(embed.author->icon_url);
-					}
-					if (!embed.author->url.empty()) {
-						parts.emplace_back(embed.author->url);
-					}
-				}
-				auto spaced = dpp::utility::tokenize(replace_string(embed.description, "\n", " "), " ");
-				if (!spaced.empty()) {
-					parts.insert(parts.end(), spaced.begin(), spaced.end());
-				}
-				for (const dpp::embed_field& field : embed.fields) {
-					auto spaced = dpp::utility::tokenize(replace_string(field.value, "\n", " "), " ");
-					if (!spaced.empty()) {
-						parts.insert(parts.end(), spaced.begin(), spaced.end());
-					}
-				}
-			}
-		}
+		const std::shared_ptr<const dpp::message> message = std::make_shared<const dpp::message>(std::move(event.msg));
 
-		/* Extract sticker urls, if any stickers are in the image */
-		if (event.msg.stickers.size() > 0) {
-			for (const dpp::sticker& sticker : event.msg.stickers) {
-				if (!sticker.id.empty()) {
-					parts.emplace_back(sticker.get_url());
-				}
-			}
+		/* Check each attachment in the message, if any */
+		std::vector<scan_source> sources;
+		for (const dpp::attachment& attach : message->attachments) {
+			sources.emplace_back(attach, message);
 		}
 
-		std::set<std::string> seen_urls;
-		/* Check each word in the message looking for URLs */
-		for (std::string& possibly_url : parts) {
-			std::string original_url = possibly_url;
-			possibly_url = dpp::lowercase(possibly_url);
-
-			size_t url_pos = possibly_url.find("<http");
-			size_t offset = 1;
-			char closing_wrapper = '>';
-
-			if (url_pos == std::string::npos) {
-				url_pos = possibly_url.find("[http");
-				offset = 1;
-				closing_wrapper = ']';
-			}
-
-			if (url_pos == std::string::npos) {
-				url_pos = possibly_url.find("http");
-				offset = 0;
-				closing_wrapper = '\0';
-			}
-
-			if (url_pos == std::string::npos) {
-				continue;
-			}
-
-			possibly_url = possibly_url.substr(url_pos + offset);
-			original_url = original_url.substr(url_pos + offset);
-
-			if (closing_wrapper != '\0') {
-				size_t wrapper_end = possibly_url.find(closing_wrapper);
-
-				if (wrapper_end != std::string::npos) {
-					possibly_url = possibly_url.substr(0, wrapper_end);
-					original_url = original_url.substr(0, wrapper_end);
-				}
-			}
-
-			if (!seen_urls.insert(original_url).second) {
-				continue;
-			}
-
-			dpp::attachment attach((dpp::message*)&event.msg);
-			attach.url = original_url;
-
-			try {
-				Url u(original_url);
-				attach.filename = fs::path(u.path()).filename();
-			}
-			catch (const std::exception&) {
-				attach.filename = fs::path(original_url).filename();
-			}
-
-			download_image(attach, *event.owner, event);
+		/* Check each URL in the message content, its embeds and its stickers */
+		const message_urls::found links = message_urls::extract(*message);
+		for (std::string_view url : links.urls) {
+			sources.emplace_back(url, message);
 		}
+
+		/* Everything is scanned together, and whatever is left stops once the message is deleted.
+		 * Anything already scanned from an earlier version of the message is skipped.
+		 */
+		download_images(std::move(sources), *event.owner);
 	}
 }
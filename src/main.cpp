@@ -23,10 +23,25 @@
 #include <beholder/database.h>
 #include <beholder/logger.h>
 #include <beholder/config.h>
+#include <beholder/statistics.h>
+#include <beholder/scan_cache.h>
+#include <beholder/block_list.h>
+#include <csignal>
+#include <thread>
 
 int main(int argc, char const *argv[])
 {
 	std::srand(time(NULL));
+
+	/* SIGINT and SIGTERM are blocked here, before any other thread starts, so every
+	 * thread inherits the mask and they are only received by the shutdown thread below
+	 */
+	sigset_t shutdown_signals;
+	sigemptyset(&shutdown_signals);
+	sigaddset(&shutdown_signals, SIGINT);
+	sigaddset(&shutdown_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &shutdown_signals, nullptr);
+
 	config::init("../config.json");
 	logger::init(config::get("log"));
 
@@ -46,6 +61,17 @@ int main(int argc, char const *argv[])
 	bot.on_ready(&listeners::on_ready);
 
 	db::init(bot);
+	scan_cache::init(bot);
+	db::background(&block_list::load);
+
+	std::thread([&bot, shutdown_signals]() {
+		int signal_number{0};
+		sigwait(&shutdown_signals, &signal_number);
+		bot.log(dpp::ll_info, "Shutting down on signal " + std::to_string(signal_number) + ", flushing statistics");
+		statistics::flush();
+		db::close();
+		std::_Exit(0);
+	}).detach();
 
 	/* Start bot */
 	bot.start(dpp::st_wait);
@@ -0,0 +1,272 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/message_urls.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <unordered_set>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+	inline bool is_space(char c) {
+		return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+	}
+
+	/**
+	 * @brief Length of the "http://" or "https://" at the start of text, in any case, or 0
+	 */
+	size_t scheme_length(std::string_view text) {
+		constexpr std::string_view http = "http";
+		if (text.size() < 7) {
+			return 0;
+		}
+		for (size_t i = 0; i < http.size(); ++i) {
+			if ((text[i] | 0x20) != http[i]) {
+				return 0;
+			}
+		}
+		size_t length = http.size();
+		if ((text[length] | 0x20) == 's') {
+			length++;
+		}
+		return text.substr(length).starts_with("://") ? length + 3 : 0;
+	}
+
+	/**
+	 * @brief The bracket which closes a URL starting at pos, or 0 if it is not wrapped
+	 */
+	char closing_bracket(std::string_view text, size_t pos) {
+		if (pos == 0) {
+			return 0;
+		}
+		switch (text[pos - 1]) {
+			case '<':
+				return '>';
+			case '[':
+				return ']';
+			case '(':
+				return (pos >= 2 && text[pos - 2] == ']') ? ')' : 0;
+			default:
+				return 0;
+		}
+	}
+
+	struct custom_emoji {
+		uint64_t id{0};
+		bool animated{false};
+
+		/**
+		 * @brief Position just after the closing '>'
+		 */
+		size_t end{0};
+	};
+
+	/**
+	 * @brief Find the next custom emoji, <:name:id> or <a:name:id>, at or after pos
+	 */
+	std::optional<custom_emoji> next_custom_emoji(std::string_view text, size_t pos) {
+		while ((pos = text.find('<', pos)) != std::string_view::npos) {
+			size_t at = pos + 1;
+			const bool animated = at < text.size() && text[at] == 'a';
+			at += animated ? 1 : 0;
+			pos++;
+			if (at >= text.size() || text[at] != ':') {
+				continue;
+			}
+			const size_t name_start = ++at;
+			while (at < text.size() && (std::isalnum(static_cast<unsigned char>(text[at])) || text[at] == '_')) {
+				at++;
+			}
+			if (at == name_start || at >= text.size() || text[at] != ':') {
+				continue;
+			}
+			const char* id_start = text.data() + at + 1;
+			uint64_t id = 0;
+			auto [id_end, error] = std::from_chars(id_start, text.data() + text.size(), id);
+			if (error != std::errc() || id_end == id_start || id_end == text.data() + text.size() || *id_end != '>') {
+				continue;
+			}
+			return custom_emoji{ .id = id, .animated = animated, .end = static_cast<size_t>(id_end - text.data()) + 1 };
+		}
+		return std::nullopt;
+	}
+
+	std::atomic<uint64_t> messages_checked{0};
+	std::atomic<uint64_t> messages_skipped{0};
+}
+
+namespace message_urls {
+
+	bool contains_url(std::string_view text) {
+		size_t pos = 0;
+#if defined(__SSE2__)
+		/* Compare 16 bytes at a time against 'h', folding case by setting bit 5 */
+		const __m128i fold = _mm_set1_epi8(0x20);
+		const __m128i h = _mm_set1_epi8('h');
+		for (; pos + 16 <= text.size(); pos += 16) {
+			const __m128i block = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + pos)), fold);
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, h)));
+			while (mask) {
+				const size_t offset = static_cast<size_t>(__builtin_ctz(mask));
+				if (scheme_length(text.substr(pos + offset))) {
+					return true;
+				}
+				mask &= mask - 1;
+			}
+		}
+#endif
+		for (; pos < text.size(); ++pos) {
+			if ((text[pos] | 0x20) == 'h' && scheme_length(text.substr(pos))) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool has_scannable_content(const dpp::message& msg) {
+		messages_checked.fetch_add(1, std::memory_order_relaxed);
+		if (!msg.attachments.empty() || !msg.embeds.empty() || !msg.stickers.empty() || contains_url(msg.content) || next_custom_emoji(msg.content, 0)) {
+			return true;
+		}
+		messages_skipped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	prefilter_statistics stats() {
+		return {
+			.checked = messages_checked.load(std::memory_order_relaxed),
+			.skipped = messages_skipped.load(std::memory_order_relaxed),
+		};
+	}
+
+	void find_in_text(std::string_view text, std::vector<std::string_view>& urls) {
+		/* Next 'h' and 'H' at or after pos, each only searched for again once passed */
+		auto find_from = [text](char c, size_t from) {
+			const void* found = from < text.size() ? std::memchr(text.data() + from, c, text.size() - from) : nullptr;
+			return found ? static_cast<size_t>(static_cast<const char*>(found) - text.data()) : std::string_view::npos;
+		};
+		size_t pos = 0;
+		size_t lower = find_from('h', 0);
+		size_t upper = find_from('H', 0);
+		while (pos < text.size()) {
+			if (lower < pos) {
+				lower = find_from('h', pos);
+			}
+			if (upper < pos) {
+				upper = find_from('H', pos);
+			}
+			const size_t start = std::min(lower, upper);
+			if (start == std::string_view::npos) {
+				return;
+			}
+			const size_t scheme = scheme_length(text.substr(start));
+			if (!scheme) {
+				pos = start + 1;
+				continue;
+			}
+			const char closing = closing_bracket(text, start);
+			size_t end = start + scheme;
+			while (end < text.size() && !is_space(text[end]) && (closing == 0 || text[end] != closing)) {
+				end++;
+			}
+			if (end > start + scheme) {
+				urls.emplace_back(text.substr(start, end - start));
+			}
+			pos = end;
+		}
+	}
+
+	found extract(const dpp::message& msg) {
+		found result;
+		std::vector<std::string_view> candidates;
+
+		find_in_text(msg.content, candidates);
+
+		/* Embeds are checked too. Although bots, which can send embeds, are ignored, Discord
+		 * generates embeds for links users send, such as YouTube links, and selfbots can send them.
+		 */
+		for (const dpp::embed& embed : msg.embeds) {
+			find_in_text(embed.url, candidates);
+			if (embed.thumbnail.has_value()) {
+				find_in_text(embed.thumbnail->url, candidates);
+			}
+			if (embed.footer.has_value()) {
+				find_in_text(embed.footer->icon_url, candidates);
+			}
+			if (embed.image.has_value()) {
+				find_in_text(embed.image->url, candidates);
+			}
+			if (embed.video.has_value()) {
+				find_in_text(embed.video->url, candidates);
+			}
+			if (embed.author.has_value()) {
+				find_in_text(embed.author->icon_url, candidates);
+				find_in_text(embed.author->url, candidates);
+			}
+			find_in_text(embed.description, candidates);
+			for (const dpp::embed_field& field : embed.fields) {
+				find_in_text(field.value, candidates);
+			}
+		}
+
+		for (const dpp::sticker& sticker : msg.stickers) {
+			if (!sticker.id.empty()) {
+				candidates.emplace_back(result.generated.emplace_back(sticker.get_url()));
+			}
+		}
+
+		size_t emoji_pos = 0;
+		while (std::optional<custom_emoji> emoji = next_custom_emoji(msg.content, emoji_pos)) {
+			const std::string extension = emoji->animated ? ".gif" : ".png";
+			candidates.emplace_back(result.generated.emplace_back("https://cdn.discordapp.com/emojis/" + std::to_string(emoji->id) + extension));
+			emoji_pos = emoji->end;
+		}
+
+		std::unordered_set<std::string_view> seen;
+		result.urls.reserve(candidates.size());
+		for (std::string_view url : candidates) {
+			if (seen.insert(url).second) {
+				result.urls.emplace_back(url);
+			}
+		}
+		return result;
+	}
+
+	std::string filename(std::string_view url) {
+		size_t path_start = 0;
+		size_t scheme = url.find("://");
+		if (scheme != std::string_view::npos) {
+			path_start = url.find('/', scheme + 3);
+			if (path_start == std::string_view::npos) {
+				return "";
+			}
+		}
+		std::string_view path = url.substr(path_start);
+		path = path.substr(0, path.find_first_of("?#"));
+		size_t slash = path.rfind('/');
+		return std::string(slash == std::string_view::npos ? path : path.substr(slash + 1));
+	}
+};
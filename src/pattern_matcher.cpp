@@ -0,0 +1,217 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/pattern_matcher.h>
+#include <algorithm>
+#include <deque>
+
+namespace {
+
+	inline uint8_t fold(char c) {
+		uint8_t byte = static_cast<uint8_t>(c);
+		return (byte >= 'A' && byte <= 'Z') ? byte + ('a' - 'A') : byte;
+	}
+
+	/**
+	 * @brief Wildcard match of text against a lower cased mask, folding the text as it goes
+	 */
+	bool glob(std::string_view text, std::string_view mask) {
+		size_t t = 0, m = 0, star = std::string_view::npos, resume = 0;
+		while (t < text.size()) {
+			if (m < mask.size() && mask[m] == '*') {
+				star = m++;
+				resume = t;
+			} else if (m < mask.size() && (mask[m] == '?' || static_cast<uint8_t>(mask[m]) == fold(text[t]))) {
+				m++;
+				t++;
+			} else if (star != std::string_view::npos) {
+				m = star + 1;
+				t = ++resume;
+			} else {
+				return false;
+			}
+		}
+		while (m < mask.size() && mask[m] == '*') {
+			m++;
+		}
+		return m == mask.size();
+	}
+
+	/**
+	 * @brief Longest run of a lower cased pattern with no wildcards in it
+	 */
+	std::string_view longest_literal(std::string_view pattern) {
+		std::string_view best;
+		size_t start = 0;
+		while (start < pattern.size()) {
+			size_t end = pattern.find_first_of("*?", start);
+			if (end == std::string_view::npos) {
+				end = pattern.size();
+			}
+			if (end - start > best.size()) {
+				best = pattern.substr(start, end - start);
+			}
+			start = end + 1;
+		}
+		return best;
+	}
+}
+
+pattern_matcher::pattern_matcher(const std::vector<std::string>& pattern_list) {
+	patterns.reserve(pattern_list.size());
+	folded.reserve(pattern_list.size());
+	nodes.emplace_back();
+
+	for (const std::string& original : pattern_list) {
+		const uint32_t index = static_cast<uint32_t>(patterns.size());
+		patterns.emplace_back(normalise(original));
+
+		std::string lower;
+		lower.reserve(patterns.back().size() + 2);
+		lower += '*';
+		for (char c : patterns.back()) {
+			lower += static_cast<char>(fold(c));
+		}
+		lower += '*';
+		folded.emplace_back(std::move(lower));
+
+		if (patterns.back().empty()) {
+			continue;
+		}
+
+		std::string_view key = longest_literal(std::string_view(folded.back()).substr(1, folded.back().size() - 2));
+		if (key.empty()) {
+			always_check.push_back(index);
+			continue;
+		}
+
+		uint32_t state = 0;
+		for (char c : key) {
+			uint32_t next = child(state, static_cast<uint8_t>(c));
+			state = next ? next : add_child(state, static_cast<uint8_t>(c));
+		}
+		nodes[state].outputs.push_back(index);
+	}
+
+	build_links();
+}
+
+std::string pattern_matcher::normalise(std::string_view pattern) {
+	std::string out;
+	out.reserve(pattern.size());
+	for (char c : pattern) {
+		if (c != '\r') {
+			out += c;
+		}
+	}
+	return out;
+}
+
+const std::string& pattern_matcher::pattern(size_t index) const {
+	return patterns.at(index);
+}
+
+uint32_t pattern_matcher::child(uint32_t state, uint8_t byte) const {
+	const auto& children = nodes[state].children;
+	auto found = std::lower_bound(children.begin(), children.end(), byte, [](const std::pair<uint8_t, uint32_t>& entry, uint8_t b) {
+		return entry.first < b;
+	});
+	return (found != children.end() && found->first == byte) ? found->second : 0;
+}
+
+uint32_t pattern_matcher::add_child(uint32_t state, uint8_t byte) {
+	const uint32_t added = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	auto& children = nodes[state].children;
+	auto position = std::lower_bound(children.begin(), children.end(), byte, [](const std::pair<uint8_t, uint32_t>& entry, uint8_t b) {
+		return entry.first < b;
+	});
+	children.insert(position, {byte, added});
+	return added;
+}
+
+void pattern_matcher::build_links() {
+	std::deque<uint32_t> queue;
+	for (const auto& [byte, next] : nodes[0].children) {
+		queue.push_back(next);
+	}
+	while (!queue.empty()) {
+		const uint32_t current = queue.front();
+		queue.pop_front();
+		for (const auto& [byte, next] : nodes[current].children) {
+			uint32_t fallback = nodes[current].fail;
+			while (fallback && !child(fallback, byte)) {
+				fallback = nodes[fallback].fail;
+			}
+			const uint32_t target = child(fallback, byte);
+			nodes[next].fail = (target && target != next) ? target : 0;
+			const node& fail_node = nodes[nodes[next].fail];
+			nodes[next].output_link = fail_node.outputs.empty() ? fail_node.output_link : nodes[next].fail;
+			queue.push_back(next);
+		}
+	}
+}
+
+std::optional<size_t> pattern_matcher::find(std::string_view text) const {
+	std::vector<uint32_t> candidates;
+	size_t start = 0;
+	while (start < text.size()) {
+		size_t end = text.find('\n', start);
+		if (end == std::string_view::npos) {
+			end = text.size();
+		}
+		if (end > start) {
+			if (std::optional<size_t> found = find_in_line(text.substr(start, end - start), candidates)) {
+				return found;
+			}
+		}
+		start = end + 1;
+	}
+	return std::nullopt;
+}
+
+std::optional<size_t> pattern_matcher::find_in_line(std::string_view line, std::vector<uint32_t>& candidates) const {
+	candidates.clear();
+	uint32_t state = 0;
+	for (char c : line) {
+		const uint8_t byte = fold(c);
+		uint32_t next = child(state, byte);
+		while (!next && state) {
+			state = nodes[state].fail;
+			next = child(state, byte);
+		}
+		state = next;
+		for (uint32_t out = nodes[state].outputs.empty() ? nodes[state].output_link : state; out; out = nodes[out].output_link) {
+			candidates.insert(candidates.end(), nodes[out].outputs.begin(), nodes[out].outputs.end());
+		}
+	}
+	candidates.insert(candidates.end(), always_check.begin(), always_check.end());
+	if (candidates.empty()) {
+		return std::nullopt;
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	for (uint32_t index : candidates) {
+		if (glob(line, folded[index])) {
+			return index;
+		}
+	}
+	return std::nullopt;
+}
@@ -0,0 +1,345 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/profanity_filter.h>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+
+namespace {
+
+	enum class unit_kind {
+		letter,
+		digit,
+		/* '@' and '$', part of a word wherever they appear */
+		symbol,
+		/* '!' and '|', part of a word only when a letter or digit follows */
+		inner_symbol,
+		separator,
+	};
+
+	struct unit {
+		char32_t codepoint;
+		unit_kind kind;
+	};
+
+	/**
+	 * @brief Latin-1 letters U+00C0 to U+00FF without their accents, nullptr for × and ÷
+	 */
+	const char* const latin1_base[64] = {
+		"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+		"d", "n", "o", "o", "o", "o", "o", nullptr, "o", "u", "u", "u", "u", "y", "th", "ss",
+		"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+		"d", "n", "o", "o", "o", "o", "o", nullptr, "o", "u", "u", "u", "u", "y", "th", "y",
+	};
+
+	/**
+	 * @brief Latin Extended-A letters U+0100 to U+017F without their accents
+	 */
+	constexpr std::string_view latin_extended_base =
+		"aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiiijjkkkllllllllllnnnnnnnnnoooooooorrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+	char32_t leet(char32_t c) {
+		switch (c) {
+			case '0': return 'o';
+			case '1': return 'i';
+			case '3': return 'e';
+			case '4': return 'a';
+			case '5': return 's';
+			case '7': return 't';
+			case '8': return 'b';
+			case '9': return 'g';
+			case '@': return 'a';
+			case '$': return 's';
+			case '!': return 'i';
+			case '|': return 'l';
+			default: return c;
+		}
+	}
+
+	/**
+	 * @brief Decode one UTF-8 sequence, advancing pos. Invalid bytes decode as U+FFFD.
+	 */
+	char32_t decode_utf8(std::string_view text, size_t& pos) {
+		const uint8_t lead = static_cast<uint8_t>(text[pos++]);
+		if (lead < 0x80) {
+			return lead;
+		}
+		size_t extra = 0;
+		char32_t cp = 0;
+		if ((lead & 0xE0) == 0xC0) {
+			extra = 1;
+			cp = lead & 0x1F;
+		} else if ((lead & 0xF0) == 0xE0) {
+			extra = 2;
+			cp = lead & 0x0F;
+		} else if ((lead & 0xF8) == 0xF0) {
+			extra = 3;
+			cp = lead & 0x07;
+		} else {
+			return 0xFFFD;
+		}
+		for (size_t i = 0; i < extra; ++i) {
+			if (pos >= text.size() || (static_cast<uint8_t>(text[pos]) & 0xC0) != 0x80) {
+				return 0xFFFD;
+			}
+			cp = (cp << 6) | (static_cast<uint8_t>(text[pos++]) & 0x3F);
+		}
+		return cp;
+	}
+
+	void encode_utf8(char32_t cp, std::string& out) {
+		if (cp < 0x80) {
+			out += static_cast<char>(cp);
+		} else if (cp < 0x800) {
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else if (cp < 0x10000) {
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else {
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+	}
+
+	bool invisible(char32_t cp) {
+		return (cp >= 0x0300 && cp <= 0x036F)	/* combining diacritical marks */
+			|| cp == 0x00AD			/* soft hyphen */
+			|| (cp >= 0x200B && cp <= 0x200D)	/* zero width space and joiners */
+			|| cp == 0x2060 || cp == 0xFEFF
+			|| (cp >= 0xFE00 && cp <= 0xFE0F);	/* variation selectors */
+	}
+
+	/**
+	 * @brief Fold one code point to lower case, unaccented units
+	 */
+	void fold(char32_t cp, std::vector<unit>& out) {
+		if (cp >= 0xFF01 && cp <= 0xFF5E) {
+			cp -= 0xFEE0;
+		}
+		if (cp < 0x80) {
+			if (cp >= 'A' && cp <= 'Z') {
+				out.push_back({cp + ('a' - 'A'), unit_kind::letter});
+			} else if (cp >= 'a' && cp <= 'z') {
+				out.push_back({cp, unit_kind::letter});
+			} else if (cp >= '0' && cp <= '9') {
+				out.push_back({cp, unit_kind::digit});
+			} else if (cp == '@' || cp == '$') {
+				out.push_back({cp, unit_kind::symbol});
+			} else if (cp == '!' || cp == '|') {
+				out.push_back({cp, unit_kind::inner_symbol});
+			} else {
+				out.push_back({' ', unit_kind::separator});
+			}
+		} else if (cp >= 0xC0 && cp <= 0xFF) {
+			const char* base = latin1_base[cp - 0xC0];
+			if (!base) {
+				out.push_back({' ', unit_kind::separator});
+				return;
+			}
+			for (; *base; ++base) {
+				out.push_back({static_cast<char32_t>(*base), unit_kind::letter});
+			}
+		} else if (cp >= 0x100 && cp <= 0x17F) {
+			out.push_back({static_cast<char32_t>(latin_extended_base[cp - 0x100]), unit_kind::letter});
+		} else if (cp < 0xC0 || (cp >= 0x2B0 && cp < 0x370) || (cp >= 0x2000 && cp < 0x2C00) || (cp >= 0x3000 && cp <= 0x303F) || cp >= 0x1F000 || cp == 0xFFFD) {
+			/* Latin-1 punctuation, modifier letters, general punctuation and symbols, CJK punctuation and emoji */
+			out.push_back({' ', unit_kind::separator});
+		} else if (cp >= 0x0391 && cp <= 0x03A9) {
+			out.push_back({cp + 0x20, unit_kind::letter});
+		} else if (cp >= 0x0410 && cp <= 0x042F) {
+			out.push_back({cp + 0x20, unit_kind::letter});
+		} else if (cp >= 0x0400 && cp <= 0x040F) {
+			out.push_back({cp + 0x50, unit_kind::letter});
+		} else {
+			out.push_back({cp, unit_kind::letter});
+		}
+	}
+}
+
+profanity_filter::profanity_filter(const std::vector<std::string>& words) {
+	nodes.emplace_back();
+
+	for (const std::string& original : words) {
+		const std::string key = normalise(original);
+		if (key.empty()) {
+			continue;
+		}
+
+		uint32_t state = 0;
+		for (char c : key) {
+			uint32_t next = child(state, static_cast<uint8_t>(c));
+			state = next ? next : add_child(state, static_cast<uint8_t>(c));
+		}
+		if (!nodes[state].word) {
+			nodes[state].word = true;
+			word_count++;
+		}
+	}
+
+	build_links();
+}
+
+std::string profanity_filter::normalise(std::string_view text) {
+	std::vector<unit> units;
+	units.reserve(text.size());
+	size_t pos = 0;
+	while (pos < text.size()) {
+		const char32_t cp = decode_utf8(text, pos);
+		if (!invisible(cp)) {
+			fold(cp, units);
+		}
+	}
+
+	for (size_t i = 0; i < units.size(); ++i) {
+		if (units[i].kind == unit_kind::inner_symbol) {
+			const bool followed = i + 1 < units.size() && (units[i + 1].kind == unit_kind::letter || units[i + 1].kind == unit_kind::digit);
+			units[i].kind = followed ? unit_kind::symbol : unit_kind::separator;
+		}
+	}
+
+	std::string out;
+	out.reserve(text.size());
+	size_t start = 0;
+	while (start < units.size()) {
+		if (units[start].kind == unit_kind::separator) {
+			start++;
+			continue;
+		}
+		size_t end = start;
+		bool has_letter = false;
+		while (end < units.size() && units[end].kind != unit_kind::separator) {
+			has_letter = has_letter || units[end].kind == unit_kind::letter;
+			end++;
+		}
+		if (!out.empty()) {
+			out += ' ';
+		}
+		for (size_t i = start; i < end; ++i) {
+			encode_utf8(has_letter ? leet(units[i].codepoint) : units[i].codepoint, out);
+		}
+		start = end;
+	}
+	return out;
+}
+
+std::optional<std::vector<std::string>> profanity_filter::read_word_lists(const std::string& directory, const std::vector<std::string>& languages) {
+	std::vector<std::string> words;
+	for (const std::string& language : languages) {
+		/* Language codes come from guild settings; anything else must not reach the path */
+		if (language.empty() || !std::all_of(language.begin(), language.end(), [](char c) {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_';
+		})) {
+			return std::nullopt;
+		}
+		std::ifstream list(directory + "/" + language + ".txt");
+		if (!list) {
+			return std::nullopt;
+		}
+		std::string line;
+		while (std::getline(list, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (!line.empty() && line[0] != '#') {
+				words.emplace_back(std::move(line));
+			}
+		}
+	}
+	return words;
+}
+
+size_t profanity_filter::size() const {
+	return word_count;
+}
+
+uint32_t profanity_filter::child(uint32_t state, uint8_t byte) const {
+	const auto& children = nodes[state].children;
+	auto found = std::lower_bound(children.begin(), children.end(), byte, [](const std::pair<uint8_t, uint32_t>& entry, uint8_t b) {
+		return entry.first < b;
+	});
+	return (found != children.end() && found->first == byte) ? found->second : 0;
+}
+
+uint32_t profanity_filter::add_child(uint32_t state, uint8_t byte) {
+	const uint32_t added = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	nodes[added].depth = nodes[state].depth + 1;
+	auto& children = nodes[state].children;
+	auto position = std::lower_bound(children.begin(), children.end(), byte, [](const std::pair<uint8_t, uint32_t>& entry, uint8_t b) {
+		return entry.first < b;
+	});
+	children.insert(position, {byte, added});
+	return added;
+}
+
+void profanity_filter::build_links() {
+	std::deque<uint32_t> queue;
+	for (const auto& [byte, next] : nodes[0].children) {
+		queue.push_back(next);
+	}
+	while (!queue.empty()) {
+		const uint32_t current = queue.front();
+		queue.pop_front();
+		for (const auto& [byte, next] : nodes[current].children) {
+			uint32_t fallback = nodes[current].fail;
+			while (fallback && !child(fallback, byte)) {
+				fallback = nodes[fallback].fail;
+			}
+			const uint32_t target = child(fallback, byte);
+			nodes[next].fail = (target && target != next) ? target : 0;
+			const node& fail_node = nodes[nodes[next].fail];
+			nodes[next].output_link = fail_node.word ? nodes[next].fail : fail_node.output_link;
+			queue.push_back(next);
+		}
+	}
+}
+
+bool profanity_filter::contains(std::string_view text) const {
+	if (word_count == 0) {
+		return false;
+	}
+	const std::string normalised = normalise(text);
+	uint32_t state = 0;
+	for (size_t i = 0; i < normalised.size(); ++i) {
+		const uint8_t byte = static_cast<uint8_t>(normalised[i]);
+		uint32_t next = child(state, byte);
+		while (!next && state) {
+			state = nodes[state].fail;
+			next = child(state, byte);
+		}
+		state = next;
+
+		/* Words only count if they end where a word of the text ends */
+		if (i + 1 < normalised.size() && normalised[i + 1] != ' ') {
+			continue;
+		}
+		for (uint32_t out = nodes[state].word ? state : nodes[state].output_link; out; out = nodes[out].output_link) {
+			const size_t start = i + 1 - nodes[out].depth;
+			if (start == 0 || normalised[start - 1] == ' ') {
+				return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,130 @@
+#include <beholder/regex_set.h>
+#include <re2/re2.h>
+#include <re2/set.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace regex {
+
+namespace {
+
+std::atomic<uint64_t> compiles{0};
+std::atomic<uint64_t> compile_us{0};
+std::atomic<uint64_t> matches{0};
+std::atomic<uint64_t> match_us{0};
+std::atomic<uint64_t> fallback_patterns{0};
+
+re2::RE2::Options set_options() {
+    re2::RE2::Options options;
+    options.set_case_sensitive(false);
+    options.set_log_errors(false);
+    /* Large pattern lists need more than the default 8MB of DFA state */
+    options.set_max_mem(64 << 20);
+    return options;
+}
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+struct regex_set::compiled_set {
+    re2::RE2::Set set{set_options(), re2::RE2::UNANCHORED};
+};
+
+regex_set::regex_set(const std::vector<std::string>& patterns) : pattern_count(patterns.size()) {
+    auto start = std::chrono::steady_clock::now();
+
+    compiled = std::make_unique<compiled_set>();
+    std::vector<size_t> unsupported;
+
+    for (size_t index = 0; index < patterns.size(); ++index) {
+        std::string error;
+        if (compiled->set.Add(patterns[index], &error) == -1) {
+            unsupported.push_back(index);
+        } else {
+            set_indexes.push_back(index);
+        }
+    }
+
+    if (set_indexes.empty()) {
+        compiled.reset();
+    } else if (!compiled->set.Compile()) {
+        /* Out of DFA memory, check everything with TRE */
+        compiled.reset();
+        unsupported.insert(unsupported.end(), set_indexes.begin(), set_indexes.end());
+        set_indexes.clear();
+        std::sort(unsupported.begin(), unsupported.end());
+    }
+
+    for (size_t index : unsupported) {
+        try {
+            fallback.emplace_back(index, std::make_unique<regex>(patterns[index], true));
+        } catch (const regex_exception&) {
+            /* Invalid in both engines, never matches */
+        }
+    }
+
+    fallback_patterns += fallback.size();
+    compiles++;
+    compile_us += elapsed_us(start);
+}
+
+regex_set::~regex_set() = default;
+
+std::vector<size_t> regex_set::match(const std::string& text) const {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> found;
+
+    if (compiled) {
+        std::vector<int> set_matches;
+        if (compiled->set.Match(text, &set_matches)) {
+            for (int set_index : set_matches) {
+                found.push_back(set_indexes[set_index]);
+            }
+        }
+    }
+
+    for (const auto& [index, expression] : fallback) {
+        if (expression->match(text)) {
+            found.push_back(index);
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+
+    matches++;
+    match_us += elapsed_us(start);
+    return found;
+}
+
+size_t regex_set::size() const {
+    return pattern_count;
+}
+
+std::optional<std::string> regex_set::validate(const std::string& pattern) {
+    re2::RE2 expression(pattern, set_options());
+    if (expression.ok()) {
+        return std::nullopt;
+    }
+    try {
+        regex fallback_expression(pattern, true);
+        return std::nullopt;
+    } catch (const regex_exception& e) {
+        return e.what();
+    }
+}
+
+set_statistics regex_set::stats() {
+    return {
+        .compiles = compiles,
+        .compile_ms = compile_us / 1000.0,
+        .matches = matches,
+        .match_ms = match_us / 1000.0,
+        .fallback_patterns = fallback_patterns,
+    };
+}
+
+}
@@ -0,0 +1,461 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/scan_cache.h>
+#include <beholder/config.h>
+#include <beholder/database.h>
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+	enum record_kind : uint8_t {
+		kind_ocr = 1,
+		kind_basic = 2,
+	};
+
+	/**
+	 * @brief Hashes are hex SHA-256
+	 */
+	constexpr size_t hash_length = 64;
+
+	constexpr uint32_t record_magic = 0x42484331;
+
+	/**
+	 * @brief Header before each value in the on-disk cache. A header of zeroes marks the end of the log.
+	 */
+	struct record_header {
+		uint32_t magic;
+		uint32_t length;
+		uint32_t checksum;
+		uint8_t kind;
+		uint8_t reserved[3];
+		char hash[hash_length];
+	};
+
+	static_assert(sizeof(record_header) == 80);
+
+	/**
+	 * @brief FNV-1a, to detect records which were only partly written
+	 */
+	uint32_t checksum(const char* data, size_t length, uint32_t seed = 2166136261u) {
+		uint32_t h = seed;
+		for (size_t i = 0; i < length; ++i) {
+			h = (h ^ static_cast<uint8_t>(data[i])) * 16777619u;
+		}
+		return h;
+	}
+
+	uint32_t record_checksum(const record_header& header, const char* data) {
+		return checksum(data, header.length, checksum(header.hash, hash_length, header.kind));
+	}
+
+	uint64_t aligned(uint64_t size) {
+		return (size + 7) & ~uint64_t{7};
+	}
+
+	/**
+	 * @brief Memory mapped, append-only log of cached values with an in-memory index.
+	 * The index is rebuilt by reading the log when the file is opened.
+	 */
+	class cache_file {
+		int fd{-1};
+		char* base{nullptr};
+		uint64_t capacity{0};
+		uint64_t tail{0};
+
+		/**
+		 * @brief Record offsets, keyed by kind followed by hash
+		 */
+		std::unordered_map<std::string, uint64_t> index;
+
+		std::mutex mutex;
+
+		static std::string key(record_kind kind, std::string_view hash) {
+			std::string k(1, static_cast<char>(kind));
+			k.append(hash);
+			return k;
+		}
+
+		const record_header* header_at(uint64_t offset) const {
+			if (offset + sizeof(record_header) > capacity) {
+				return nullptr;
+			}
+			const record_header* header = reinterpret_cast<const record_header*>(base + offset);
+			if (header->magic != record_magic || offset + sizeof(record_header) + header->length > capacity) {
+				return nullptr;
+			}
+			return header;
+		}
+
+		void mark_end() {
+			if (tail + sizeof(record_header) <= capacity) {
+				std::memset(base + tail, 0, sizeof(record_header));
+			}
+		}
+
+	public:
+		~cache_file() {
+			if (base) {
+				munmap(base, capacity);
+			}
+			if (fd != -1) {
+				::close(fd);
+			}
+		}
+
+		bool open(const std::string& path, uint64_t size, dpp::cluster& bot) {
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			if (fd == -1) {
+				bot.log(dpp::ll_error, "Scan cache: can't open " + path + ": " + strerror(errno));
+				return false;
+			}
+			/* The file is sparse, so disk is only used as the log grows */
+			if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+				bot.log(dpp::ll_error, "Scan cache: can't size " + path + ": " + strerror(errno));
+				return false;
+			}
+			void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapping == MAP_FAILED) {
+				bot.log(dpp::ll_error, "Scan cache: can't map " + path + ": " + strerror(errno));
+				return false;
+			}
+			base = static_cast<char*>(mapping);
+			capacity = size;
+
+			/* Rebuild the index, stopping at the end marker or the first damaged record */
+			while (const record_header* header = header_at(tail)) {
+				if (record_checksum(*header, base + tail + sizeof(record_header)) != header->checksum) {
+					break;
+				}
+				index[key(static_cast<record_kind>(header->kind), std::string_view(header->hash, hash_length))] = tail;
+				tail += aligned(sizeof(record_header) + header->length);
+			}
+			mark_end();
+			bot.log(dpp::ll_info, "Scan cache: opened " + path + " with " + std::to_string(index.size()) + " records");
+			return true;
+		}
+
+		bool is_open() const {
+			return base != nullptr;
+		}
+
+		std::optional<std::string> read(record_kind kind, std::string_view hash) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = index.find(key(kind, hash));
+			if (found == index.end()) {
+				return std::nullopt;
+			}
+			const record_header* header = header_at(found->second);
+			if (!header) {
+				return std::nullopt;
+			}
+			return std::string(base + found->second + sizeof(record_header), header->length);
+		}
+
+		void append(record_kind kind, std::string_view hash, std::string_view value) {
+			uint64_t size = aligned(sizeof(record_header) + value.size());
+			if (hash.size() != hash_length || size > capacity / 4) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tail + size > capacity) {
+				/* Full, start again from the beginning */
+				index.clear();
+				tail = 0;
+			}
+			record_header header{};
+			header.magic = record_magic;
+			header.length = static_cast<uint32_t>(value.size());
+			header.kind = kind;
+			std::memcpy(header.hash, hash.data(), hash_length);
+			header.checksum = record_checksum(header, value.data());
+			std::memcpy(base + tail + sizeof(record_header), value.data(), value.size());
+			std::memcpy(base + tail, &header, sizeof(header));
+			index[key(kind, hash)] = tail;
+			tail += size;
+			mark_end();
+		}
+
+		uint64_t used() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return tail;
+		}
+	};
+
+	struct memory_entry {
+		std::string hash;
+		scan_cache::entry value;
+
+		/**
+		 * @brief When the image's database rows were last marked as used
+		 */
+		double touched{0};
+	};
+
+	/**
+	 * @brief An image which stays in memory marks its database rows as used at most this often, in seconds
+	 */
+	constexpr double touch_interval = 60 * 60;
+
+	/**
+	 * @brief Images kept in memory
+	 */
+	size_t memory_capacity{65536};
+
+	/**
+	 * @brief Recently used images, most recent first. An entry with no values records
+	 * that no tier had anything for the image, and is filled in when it is scanned.
+	 */
+	std::list<memory_entry> lru;
+
+	/**
+	 * @brief Index into lru
+	 */
+	std::unordered_map<std::string, std::list<memory_entry>::iterator> memory_index;
+
+	/**
+	 * @brief Guards lru and memory_index
+	 */
+	std::mutex memory_mutex;
+
+	cache_file file;
+
+	/**
+	 * @brief Database rows not read or written for this many days are deleted, 0 to keep them forever
+	 */
+	uint64_t retention_days{90};
+
+	/**
+	 * @brief Rows deleted per statement when expiring, so no single delete holds locks for long
+	 */
+	constexpr uint64_t expiry_batch_size = 1000;
+
+	/**
+	 * @brief Maximum statements per table in one expiry run. Anything left is picked up next run.
+	 */
+	constexpr size_t expiry_max_batches = 50;
+
+	std::atomic<uint64_t> memory_hits{0};
+	std::atomic<uint64_t> file_hits{0};
+	std::atomic<uint64_t> database_hits{0};
+	std::atomic<uint64_t> misses{0};
+
+	/**
+	 * @brief Look up an image in memory
+	 *
+	 * @param hash image hash
+	 * @param needs_touch set to true if the image has values and its database rows are due to be marked as used
+	 */
+	std::optional<scan_cache::entry> memory_get(const std::string& hash, bool& needs_touch) {
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		auto found = memory_index.find(hash);
+		if (found == memory_index.end()) {
+			return std::nullopt;
+		}
+		lru.splice(lru.begin(), lru, found->second);
+		memory_entry& cached = *found->second;
+		const double now = dpp::utility::time_f();
+		if ((cached.value.ocr || cached.value.basic) && now - cached.touched >= touch_interval) {
+			cached.touched = now;
+			needs_touch = true;
+		}
+		return cached.value;
+	}
+
+	/**
+	 * @brief Mark database rows as recently used, so they are not expired
+	 */
+	void touch(const std::string& hash, const scan_cache::entry& found) {
+		if (found.ocr) {
+			db::query_async("UPDATE scan_cache SET last_hit = NOW() WHERE hash = ?", {db::hash_key(hash)}, nullptr);
+		}
+		if (found.basic) {
+			db::query_async("UPDATE basic_cache SET last_hit = NOW() WHERE hash = ?", {db::hash_key(hash)}, nullptr);
+		}
+	}
+
+	/**
+	 * @brief Delete cold rows from one table in batches
+	 *
+	 * @return rows deleted
+	 */
+	size_t expire_table(const std::string& table) {
+		size_t deleted = 0;
+		for (size_t batch = 0; batch < expiry_max_batches; ++batch) {
+			/* LIMIT can't take a text bound parameter, both values are our own integers */
+			db::query("DELETE FROM " + table + " WHERE last_hit < NOW() - INTERVAL " + std::to_string(retention_days) + " DAY LIMIT " + std::to_string(expiry_batch_size));
+			if (!db::error().empty()) {
+				break;
+			}
+			size_t affected = db::affected_rows();
+			deleted += affected;
+			if (affected < expiry_batch_size) {
+				break;
+			}
+		}
+		return deleted;
+	}
+
+	/**
+	 * @brief Insert or update an image in memory
+	 *
+	 * @param hash image hash
+	 * @param update called with the image's entry, which is empty if it was not cached
+	 */
+	template<typename Update> void memory_update(const std::string& hash, Update update) {
+		if (memory_capacity == 0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		auto found = memory_index.find(hash);
+		if (found != memory_index.end()) {
+			lru.splice(lru.begin(), lru, found->second);
+			update(found->second->value);
+			return;
+		}
+		lru.push_front({ .hash = hash, .touched = dpp::utility::time_f() });
+		update(lru.front().value);
+		memory_index.emplace(hash, lru.begin());
+		while (lru.size() > memory_capacity) {
+			memory_index.erase(lru.back().hash);
+			lru.pop_back();
+		}
+	}
+}
+
+namespace scan_cache {
+
+	void init(dpp::cluster& bot) {
+		const json settings = config::get().value("scan_cache", json::object());
+		if (!settings.is_object()) {
+			return;
+		}
+		memory_capacity = settings.value("entries", memory_capacity);
+		retention_days = settings.value("retention_days", retention_days);
+		std::string path = settings.value("file", "");
+		uint64_t size = settings.value("file_size", uint64_t{1024} * 1024 * 1024);
+		if (!path.empty() && size >= 1024 * 1024) {
+			file.open(path, size, bot);
+		}
+	}
+
+	entry get(const std::string& hash) {
+		bool needs_touch = false;
+		if (std::optional<entry> cached = memory_get(hash, needs_touch)) {
+			/* An empty entry remembers that nothing had this image, it is still a miss */
+			if (!cached->ocr && !cached->basic) {
+				misses++;
+				return *cached;
+			}
+			memory_hits++;
+			if (needs_touch) {
+				touch(hash, *cached);
+			}
+			return *cached;
+		}
+
+		entry result;
+		if (file.is_open()) {
+			result.ocr = file.read(kind_ocr, hash);
+			result.basic = file.read(kind_basic, hash);
+		}
+
+		if (result.ocr || result.basic) {
+			file_hits++;
+			touch(hash, result);
+		} else {
+			db::result ocr = db::execute("SELECT ocr FROM scan_cache WHERE hash = ?", {db::hash_key(hash)});
+			if (!ocr.empty()) {
+				result.ocr = ocr.get<std::string>(0, 0);
+			}
+			db::result basic = db::execute("SELECT basic FROM basic_cache WHERE hash = ?", {db::hash_key(hash)});
+			if (!basic.empty()) {
+				result.basic = basic.get<std::string>(0, 0);
+			}
+			if (result.ocr || result.basic) {
+				database_hits++;
+				touch(hash, result);
+				if (file.is_open()) {
+					if (result.ocr) {
+						file.append(kind_ocr, hash, *result.ocr);
+					}
+					if (result.basic) {
+						file.append(kind_basic, hash, *result.basic);
+					}
+				}
+			} else {
+				misses++;
+			}
+		}
+
+		memory_update(hash, [&result](entry& cached) {
+			cached = result;
+		});
+		return result;
+	}
+
+	void put_ocr(const std::string& hash, const std::string& ocr) {
+		memory_update(hash, [&ocr](entry& cached) {
+			cached.ocr = ocr;
+		});
+		if (file.is_open()) {
+			file.append(kind_ocr, hash, ocr);
+		}
+		db::query_async("INSERT INTO scan_cache (hash, ocr) VALUES(?,?) ON DUPLICATE KEY UPDATE ocr = ?, last_hit = NOW()", {db::hash_key(hash), ocr, ocr}, nullptr);
+	}
+
+	void put_basic(const std::string& hash, const std::string& basic) {
+		memory_update(hash, [&basic](entry& cached) {
+			cached.basic = basic;
+		});
+		if (file.is_open()) {
+			file.append(kind_basic, hash, basic);
+		}
+		db::query_async("INSERT INTO basic_cache (hash, basic) VALUES(?,?) ON DUPLICATE KEY UPDATE basic = ?, last_hit = NOW()", {db::hash_key(hash), basic, basic}, nullptr);
+	}
+
+	size_t expire_database() {
+		if (retention_days == 0) {
+			return 0;
+		}
+		return expire_table("scan_cache") + expire_table("basic_cache");
+	}
+
+	statistics stats() {
+		statistics s;
+		{
+			std::lock_guard<std::mutex> lock(memory_mutex);
+			s.memory_entries = lru.size();
+		}
+		s.memory_hits = memory_hits;
+		s.file_hits = file_hits;
+		s.database_hits = database_hits;
+		s.misses = misses;
+		s.file_bytes = file.is_open() ? file.used() : 0;
+		return s;
+	}
+};
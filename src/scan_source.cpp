@@ -0,0 +1,54 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/scan_source.h>
+#include <beholder/message_urls.h>
+
+namespace {
+
+	void set_message(scan_source& source, std::shared_ptr<const dpp::message> message) {
+		if (message) {
+			source.guild_id = message->guild_id;
+			source.channel_id = message->channel_id;
+			source.message_id = message->id;
+			source.author_id = message->author.id;
+		}
+		source.message = std::move(message);
+	}
+}
+
+scan_source::scan_source(const dpp::attachment& attach, std::shared_ptr<const dpp::message> message)
+	: attachment_id(attach.id), url(attach.url), filename(attach.filename), width(attach.width), height(attach.height), size(attach.size)
+{
+	set_message(*this, std::move(message));
+}
+
+scan_source::scan_source(std::string_view url, std::shared_ptr<const dpp::message> message)
+	: url(url), filename(message_urls::filename(url))
+{
+	set_message(*this, std::move(message));
+}
+
+std::string scan_source::author_mention() const {
+	return "<@" + author_id.str() + ">";
+}
+
+std::string scan_source::author_name() const {
+	return message ? message->author.format_username() : author_mention();
+}
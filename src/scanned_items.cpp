@@ -0,0 +1,121 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/scanned_items.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+	constexpr size_t max_messages = 65536;
+
+	/**
+	 * @brief Edits to messages older than this are not scanned, see on_message_update
+	 */
+	constexpr double message_lifetime = 7 * 24 * 60 * 60;
+
+	/**
+	 * @brief Snowflakes fit in 63 bits, so URL keys set the top bit to keep them apart from attachment IDs
+	 */
+	constexpr uint64_t url_key_bit = 1ULL << 63;
+
+	struct message_record {
+		double expires{0};
+		std::vector<uint64_t> keys;
+	};
+
+	std::unordered_map<dpp::snowflake, message_record> messages;
+
+	/**
+	 * @brief Message IDs in the order they were first seen, which is close to the order they expire in
+	 */
+	std::deque<dpp::snowflake> seen_order;
+
+	/**
+	 * @brief Guards messages and seen_order
+	 */
+	std::mutex messages_mutex;
+
+	/**
+	 * @brief Forget expired messages, and the oldest if there are too many. Call with messages_mutex held.
+	 */
+	void expire(double now) {
+		while (!seen_order.empty()) {
+			auto found = messages.find(seen_order.front());
+			if (found != messages.end() && found->second.expires > now && messages.size() <= max_messages) {
+				break;
+			}
+			if (found != messages.end()) {
+				messages.erase(found);
+			}
+			seen_order.pop_front();
+		}
+	}
+
+	uint64_t key_of(const scan_source& source) {
+		if (!source.attachment_id.empty()) {
+			return static_cast<uint64_t>(source.attachment_id) & ~url_key_bit;
+		}
+		return std::hash<std::string_view>{}(source.url) | url_key_bit;
+	}
+
+	bool record(dpp::snowflake message_id, uint64_t key) {
+		const double now = dpp::utility::time_f();
+		std::lock_guard<std::mutex> lock(messages_mutex);
+		auto [found, added] = messages.try_emplace(message_id);
+		message_record& entry = found->second;
+		if (added) {
+			entry.expires = message_id.get_creation_time() + message_lifetime;
+			seen_order.push_back(message_id);
+		}
+		if (std::find(entry.keys.begin(), entry.keys.end(), key) != entry.keys.end()) {
+			return false;
+		}
+		entry.keys.push_back(key);
+		if (added) {
+			expire(now);
+		}
+		return true;
+	}
+}
+
+namespace scanned_items {
+
+	bool scanned(const scan_source& source) {
+		std::lock_guard<std::mutex> lock(messages_mutex);
+		auto found = messages.find(source.message_id);
+		if (found == messages.end()) {
+			return false;
+		}
+		const std::vector<uint64_t>& keys = found->second.keys;
+		return std::find(keys.begin(), keys.end(), key_of(source)) != keys.end();
+	}
+
+	bool first_scan(const scan_source& source) {
+		return record(source.message_id, key_of(source));
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(messages_mutex);
+		return messages.size();
+	}
+};
@@ -0,0 +1,195 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/statistics.h>
+#include <beholder/database.h>
+#include <array>
+#include <ctime>
+#include <mutex>
+#include <unordered_map>
+#include <fmt/format.h>
+
+namespace {
+
+	/**
+	 * @brief Number of independently locked counter tables. A guild always uses the
+	 * same stripe, so increments for different guilds rarely wait on each other.
+	 */
+	constexpr size_t stripe_count = 32;
+
+	/**
+	 * @brief Largest number of rows in one INSERT. Smaller batches are powers of two,
+	 * which keeps the number of distinct prepared statements small.
+	 */
+	constexpr size_t max_batch_rows = 128;
+
+	constexpr std::array<const char*, statistics::stat_count> column_names = {
+		"images_scanned",
+		"images_blocked",
+		"images_ocr",
+		"images_nsfw",
+		"cache_miss",
+	};
+
+	struct counter_key {
+		uint64_t guild_id;
+
+		/**
+		 * @brief Local date as YYYYMMDD
+		 */
+		uint32_t day;
+
+		bool operator==(const counter_key& other) const = default;
+	};
+
+	struct counter_key_hash {
+		size_t operator()(const counter_key& key) const {
+			return std::hash<uint64_t>()(key.guild_id) ^ (static_cast<size_t>(key.day) << 1);
+		}
+	};
+
+	using counter_row = std::array<uint64_t, statistics::stat_count>;
+
+	using counter_table = std::unordered_map<counter_key, counter_row, counter_key_hash>;
+
+	struct stripe {
+		std::mutex mutex;
+		counter_table counts;
+	};
+
+	stripe stripes[stripe_count];
+
+	/**
+	 * @brief Only one flush runs at a time
+	 */
+	std::mutex flush_mutex;
+
+	stripe& stripe_for(uint64_t guild_id) {
+		return stripes[(guild_id >> 22) % stripe_count];
+	}
+
+	/**
+	 * @brief Today's local date as YYYYMMDD. localtime_r takes a lock on the time
+	 * zone, so the result is cached per thread for the rest of the second.
+	 */
+	uint32_t today() {
+		thread_local time_t cached_second{0};
+		thread_local uint32_t cached_day{0};
+		time_t now = time(nullptr);
+		if (now != cached_second) {
+			tm local{};
+			localtime_r(&now, &local);
+			cached_day = (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+			cached_second = now;
+		}
+		return cached_day;
+	}
+
+	void add_back(const counter_key& key, const counter_row& row) {
+		stripe& s = stripe_for(key.guild_id);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		counter_row& existing = s.counts[key];
+		for (size_t i = 0; i < statistics::stat_count; ++i) {
+			existing[i] += row[i];
+		}
+	}
+
+	std::string insert_statement(size_t rows) {
+		std::string columns, row_placeholder = "(?,?", updates;
+		for (const char* column : column_names) {
+			columns += std::string(", ") + column;
+			row_placeholder += ",?";
+			updates += fmt::format(fmt::runtime("{}{} = {} + VALUES({})"), updates.empty() ? "" : ", ", column, column, column);
+		}
+		row_placeholder += ")";
+		std::string values;
+		for (size_t i = 0; i < rows; ++i) {
+			values += (i ? "," : "") + row_placeholder;
+		}
+		return "INSERT INTO guild_statistics (guild_id, stat_date" + columns + ") VALUES " + values + " ON DUPLICATE KEY UPDATE " + updates;
+	}
+
+	/**
+	 * @brief Write one batch of rows
+	 *
+	 * @return true if the rows were written
+	 */
+	bool write_batch(std::vector<std::pair<counter_key, counter_row>>::const_iterator first, size_t rows) {
+		db::paramlist parameters;
+		parameters.reserve(rows * (statistics::stat_count + 2));
+		for (auto row = first; row != first + rows; ++row) {
+			const uint32_t day = row->first.day;
+			parameters.emplace_back(row->first.guild_id);
+			parameters.emplace_back(fmt::format(fmt::runtime("{:04}-{:02}-{:02}"), day / 10000, (day / 100) % 100, day % 100));
+			for (uint64_t count : row->second) {
+				parameters.emplace_back(count);
+			}
+		}
+		db::query(insert_statement(rows), parameters);
+		return db::error().empty();
+	}
+}
+
+namespace statistics {
+
+	void increment(stat s, dpp::snowflake guild_id, uint32_t amount) {
+		if (s >= stat_count || guild_id.empty()) {
+			return;
+		}
+		const counter_key key{ .guild_id = guild_id, .day = today() };
+		stripe& target = stripe_for(guild_id);
+		std::lock_guard<std::mutex> lock(target.mutex);
+		target.counts[key][s] += amount;
+	}
+
+	size_t flush() {
+		std::lock_guard<std::mutex> flush_lock(flush_mutex);
+
+		/* Swap each stripe's table for an empty one, so increments only wait for the swap */
+		std::vector<std::pair<counter_key, counter_row>> pending;
+		for (stripe& s : stripes) {
+			counter_table taken;
+			{
+				std::lock_guard<std::mutex> lock(s.mutex);
+				taken.swap(s.counts);
+			}
+			pending.insert(pending.end(), taken.begin(), taken.end());
+		}
+
+		size_t written = 0;
+		auto next = pending.cbegin();
+		while (next != pending.cend()) {
+			size_t remaining = pending.cend() - next;
+			size_t rows = max_batch_rows;
+			while (rows > remaining) {
+				rows /= 2;
+			}
+			if (!write_batch(next, rows)) {
+				/* Keep what is left for the next flush */
+				for (; next != pending.cend(); ++next) {
+					add_back(next->first, next->second);
+				}
+				break;
+			}
+			written += rows;
+			next += rows;
+		}
+		return written;
+	}
+};
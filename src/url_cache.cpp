@@ -0,0 +1,192 @@
+/************************************************************************************
+ *
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/url_cache.h>
+#include <beholder/beholder.h>
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+	/**
+	 * @brief How long a URL is remembered for. Discord's signed links are valid for about a day,
+	 * repost storms are over well within this.
+	 */
+	constexpr time_t url_ttl = 6 * 60 * 60;
+
+	/**
+	 * @brief Maximum number of URLs remembered
+	 */
+	constexpr size_t max_entries = 65536;
+
+	/**
+	 * @brief Discord CDN query parameters which sign the link rather than select the content
+	 */
+	constexpr std::string_view discord_signing_parameters[] = { "ex", "is", "hm" };
+
+	struct cached_url {
+		url_cache::entry value;
+		time_t expires{0};
+	};
+
+	std::unordered_map<std::string, cached_url> urls;
+
+	/**
+	 * @brief Keys in the order they were added, oldest first. As every entry lives for the
+	 * same time, this is also the order they expire in.
+	 */
+	std::deque<std::pair<std::string, time_t>> expiry_order;
+
+	/**
+	 * @brief Guards urls and expiry_order
+	 */
+	std::mutex urls_mutex;
+
+	bool is_discord_cdn(const std::string& host) {
+		return host == "cdn.discordapp.com" || host == "media.discordapp.net";
+	}
+
+	bool is_id(std::string_view text) {
+		return !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+	}
+
+	/**
+	 * @brief Check for /attachments/<channel id>/<attachment id>/<filename>, whose content
+	 * is fixed by the attachment ID
+	 */
+	bool is_attachment_path(std::string_view path) {
+		constexpr std::string_view prefix = "/attachments/";
+		if (!path.starts_with(prefix)) {
+			return false;
+		}
+		const std::vector<std::string> parts = dpp::utility::tokenize(std::string(path.substr(prefix.length())), "/");
+		return parts.size() == 3 && is_id(parts[0]) && is_id(parts[1]) && !parts[2].empty();
+	}
+
+	/**
+	 * @brief Remove expired entries, and the oldest entries if there are too many. Call with urls_mutex held.
+	 */
+	void expire(time_t now) {
+		while (!expiry_order.empty() && (expiry_order.front().second <= now || urls.size() > max_entries)) {
+			auto found = urls.find(expiry_order.front().first);
+			/* Only erase if this is the entry the expiry was queued for, and not a newer one */
+			if (found != urls.end() && found->second.expires == expiry_order.front().second) {
+				urls.erase(found);
+			}
+			expiry_order.pop_front();
+		}
+	}
+
+	/**
+	 * @brief Find or add the entry for a key. Call with urls_mutex held.
+	 */
+	url_cache::entry& entry_for(const std::string& key, const std::string& hash) {
+		time_t now = time(nullptr);
+		auto found = urls.find(key);
+		if (found != urls.end() && found->second.expires > now && found->second.value.hash == hash) {
+			return found->second.value;
+		}
+		cached_url& added = urls[key];
+		added.value = { .hash = hash };
+		added.expires = now + url_ttl;
+		expiry_order.emplace_back(key, added.expires);
+		expire(now);
+		return urls.at(key).value;
+	}
+}
+
+namespace url_cache {
+
+	std::string canonical_key(const std::string& url) {
+		const std::string_view scheme = "https://";
+		if (url.compare(0, scheme.length(), scheme) != 0) {
+			return "";
+		}
+
+		const size_t path_start = url.find('/', scheme.length());
+		if (path_start == std::string::npos) {
+			return "";
+		}
+		std::string host = dpp::lowercase(url.substr(scheme.length(), path_start - scheme.length()));
+		if (!is_discord_cdn(host)) {
+			return "";
+		}
+
+		const size_t query_start = url.find_first_of("?#", path_start);
+		const std::string path = url.substr(path_start, query_start == std::string::npos ? std::string::npos : query_start - path_start);
+		if (!is_attachment_path(path)) {
+			return "";
+		}
+
+		std::vector<std::string> parameters;
+		if (query_start != std::string::npos && url[query_start] == '?') {
+			const size_t fragment = url.find('#', query_start);
+			const std::string query = url.substr(query_start + 1, fragment == std::string::npos ? std::string::npos : fragment - query_start - 1);
+			for (const std::string& parameter : dpp::utility::tokenize(query, "&")) {
+				if (parameter.empty()) {
+					continue;
+				}
+				const std::string name = parameter.substr(0, parameter.find('='));
+				if (std::find(std::begin(discord_signing_parameters), std::end(discord_signing_parameters), name) != std::end(discord_signing_parameters)) {
+					continue;
+				}
+				parameters.emplace_back(parameter);
+			}
+		}
+		std::sort(parameters.begin(), parameters.end());
+
+		/* media.discordapp.net with no resizing parameters serves the same file as the CDN */
+		if (host == "media.discordapp.net" && parameters.empty()) {
+			host = "cdn.discordapp.com";
+		}
+
+		std::string key = host + path;
+		for (size_t index = 0; index < parameters.size(); ++index) {
+			key += (index == 0 ? "?" : "&") + parameters[index];
+		}
+		return key;
+	}
+
+	std::optional<entry> get(const std::string& key) {
+		std::lock_guard<std::mutex> lock(urls_mutex);
+		auto found = urls.find(key);
+		if (found == urls.end() || found->second.expires <= time(nullptr)) {
+			return std::nullopt;
+		}
+		return found->second.value;
+	}
+
+	void store_hash(const std::string& key, const std::string& hash) {
+		std::lock_guard<std::mutex> lock(urls_mutex);
+		entry_for(key, hash);
+	}
+
+	void store_verdict(const std::string& key, const std::string& hash, const verdict& result) {
+		std::lock_guard<std::mutex> lock(urls_mutex);
+		entry_for(key, hash).last_verdict = result;
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(urls_mutex);
+		return urls.size();
+	}
+};
@@ -23,6 +23,8 @@
 #include <beholder/beholder.h>
 #include <beholder/proc/json_frame.h>
 #include <beholder/tessd.h>
+#include <beholder/pattern_matcher.h>
+#include <beholder/profanity_filter.h>
 #include "3rdparty/httplib.h"
 #include <beholder/trusted_hosts.h>
 #include <CxxUrl/url.hpp>
@@ -32,7 +34,9 @@
 #include <sstream>
 #include <string>
 #include <sys/resource.h>
+#include <unistd.h>
 #include <fmt/format.h>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -241,23 +245,30 @@ void set_limit(int type, uint64_t max)
 	}
 }
 
-void write_error(const std::string& stage, const std::string& error)
+dpp::json make_error(const std::string& stage, const std::string& error)
 {
-	proc::write_frame({
+	return {
 		{"stage", stage},
 		{"status", "error"},
 		{"error", error}
-	});
+	};
+}
+
+dpp::json make_error(const std::string& stage, const std::string& error, const std::string& detail)
+{
+	dpp::json frame = make_error(stage, error);
+	frame["detail"] = detail;
+	return frame;
+}
+
+void write_error(const std::string& stage, const std::string& error)
+{
+	proc::write_frame(make_error(stage, error));
 }
 
 void write_error(const std::string& stage, const std::string& error, const std::string& detail)
 {
-	proc::write_frame({
-		{"stage", stage},
-		{"status", "error"},
-		{"error", error},
-		{"detail", detail}
-	});
+	proc::write_frame(make_error(stage, error, detail));
 }
 
 std::string build_path_with_query(const Url& url)
@@ -299,16 +310,10 @@ bool validate_image_dimensions(const std::string& file_content)
 
 bool trusted_media_host(const std::string& host)
 {
-	for (const char* trusted_host : trusted) {
-		if (match(host.c_str(), trusted_host)) {
-			return true;
-		}
-	}
-
-	return false;
+	return trusted_hosts().find(host).has_value();
 }
 
-bool fetch_image(const std::string& url, std::string& file_content)
+bool fetch_image(const std::string& url, std::string& file_content, dpp::json& error)
 {
 	Url parsed(url);
 	const std::string host = parsed.scheme() + "://" + parsed.host();
@@ -336,32 +341,24 @@ bool fetch_image(const std::string& url, std::string& file_content)
 	auto res = cli.Get(path);
 
 	if (!res) {
-		write_error("fetch", "download_failed", httplib::to_string(res.error()));
+		error = make_error("fetch", "download_failed", httplib::to_string(res.error()));
 		return false;
 	}
 
 	if (res->status >= 400) {
-		proc::write_frame({
-			{"stage", "fetch"},
-			{"status", "error"},
-			{"error", "http_error"},
-			{"http_status", res->status}
-		});
+		error = make_error("fetch", "http_error");
+		error["http_status"] = res->status;
 		return false;
 	}
 
 	if (res->body.size() > max_size) {
-		proc::write_frame({
-			{"stage", "fetch"},
-			{"status", "error"},
-			{"error", "image_too_large"},
-			{"size", res->body.size()}
-		});
+		error = make_error("fetch", "image_too_large");
+		error["size"] = res->body.size();
 		return false;
 	}
 
 	if (!is_webm(res->body) && !is_mp4(res->body) && !is_webp(res->body) && !is_avif(res->body) && !validate_image_dimensions(res->body)) {
-		write_error("fetch", "invalid_image");
+		error = make_error("fetch", "invalid_image");
 		return false;
 	}
 
@@ -627,9 +624,26 @@ std::string run_tesseract(const std::string& file_content, const std::string& la
 	return text;
 }
 
-bool run_profanity_filter(const std::string& text, const std::vector<std::string>& languages)
+/**
+ * @brief If the profanity filter creates this socket, it is used instead of TCP
+ */
+constexpr const char* profanity_socket = "/tmp/beholder-profanity.sock";
+
+/**
+ * @brief Word lists for the built in profanity filter, one "<language>.txt" per language
+ */
+constexpr const char* profanity_word_lists = "profanity";
+
+bool run_profanity_service(const std::string& text, const std::vector<std::string>& languages)
 {
-	httplib::Client cli("http://localhost:6970");
+	static const bool use_socket = access(profanity_socket, F_OK) == 0;
+	static httplib::Client cli = use_socket ? httplib::Client(profanity_socket) : httplib::Client("http://localhost:6970");
+
+	if (use_socket) {
+		cli.set_address_family(AF_UNIX);
+	}
+
+	cli.set_keep_alive(true);
 
 	const dpp::json payload = {
 		{"content", text},
@@ -660,6 +674,16 @@ bool run_profanity_filter(const std::string& text, const std::vector<std::string
 	return answer.at("is-bad").get<bool>();
 }
 
+bool run_profanity_filter(const std::string& text, const std::vector<std::string>& languages)
+{
+	/* The profanity service is only needed for languages which have no local word list */
+	if (std::optional<std::vector<std::string>> words = profanity_filter::read_word_lists(profanity_word_lists, languages)) {
+		return profanity_filter(*words).contains(text);
+	}
+
+	return run_profanity_service(text, languages);
+}
+
 scan_result scan_ocr(const dpp::json& command, const std::string& file_content, const std::vector<std::size_t>& frames, bool mp4, bool webp, bool avif)
 {
 	scan_result result;
@@ -671,7 +695,10 @@ scan_result scan_ocr(const dpp::json& command, const std::string& file_content,
 	const std::vector<std::string> languages = command.contains("prem_languages") ? json_string_array(command.at("prem_languages")) : std::vector<std::string>{};
 	std::string languages_str = get_tesseract_languages(command);
 
-	if (patterns.empty() && (!profanity_enabled || languages.empty())) {
+	/* The bot asks for OCR text when it has regular expression patterns to check it against */
+	const bool ocr_required = json_bool(command, "ocr_required", false);
+
+	if (patterns.empty() && !ocr_required && (!profanity_enabled || languages.empty())) {
 		result.text = "No match or not enabled";
 		return result;
 	}
@@ -711,24 +738,12 @@ scan_result scan_ocr(const dpp::json& command, const std::string& file_content,
 		}
 	}
 
-	std::vector<std::string> lines = dpp::utility::tokenize(ocr_text, "\n");
-
-	for (const std::string& line : lines) {
-		for (const std::string& pattern : patterns) {
-			const std::string p = replace_string(pattern, "\r", "");
+	const pattern_matcher matcher(patterns);
 
-			if (line.empty() || p.empty()) {
-				continue;
-			}
-
-			const std::string pattern_wild = "*" + p + "*";
-
-			if (match(line.c_str(), pattern_wild.c_str())) {
-				result.blocked = true;
-				result.text = p;
-				return result;
-			}
-		}
+	if (std::optional<size_t> found = matcher.find(ocr_text)) {
+		result.blocked = true;
+		result.text = matcher.pattern(*found);
+		return result;
 	}
 
 	result.text = "No match";
@@ -737,9 +752,22 @@ scan_result scan_ocr(const dpp::json& command, const std::string& file_content,
 
 dpp::json run_basic_nsfw(const std::string& file_content)
 {
-	httplib::Client cli("http://localhost:6969");
+	if (std::optional<dpp::json> answer = nsfw_socket_classify(file_content)) {
+		return *answer;
+	}
+
+	static httplib::Client cli("http://localhost:6969");
+	cli.set_keep_alive(true);
+
 	auto res = cli.Post("/", file_content, "application/octet-stream");
 
+	/* A connection can be reset if it lands on an nsfwd child at the moment it is
+	 * being replaced, in which case the replacement will be listening. Retry once.
+	 */
+	if (!res && (res.error() == httplib::Error::Connection || res.error() == httplib::Error::Read)) {
+		res = cli.Post("/", file_content, "application/octet-stream");
+	}
+
 	if (!res) {
 		throw std::runtime_error("NSFW API Error: " + httplib::to_string(res.error()));
 	}
@@ -757,23 +785,13 @@ dpp::json run_basic_nsfw(const std::string& file_content)
 	return answer;
 }
 
-std::string pix_to_png(Pix* image)
+dpp::json run_basic_nsfw_rgba(const unsigned char* pixels, int width, int height)
 {
-	l_uint8* data = nullptr;
-	size_t size = 0;
-
-	if (!image || pixWriteMemPng(&data, &size, image, 0.0f) != 0 || !data || size == 0) {
-		if (data) {
-			lept_free(data);
-		}
-
-		throw std::runtime_error("pix_write_png_failed");
+	if (std::optional<dpp::json> answer = nsfw_socket_classify_rgba(pixels, width, height)) {
+		return *answer;
 	}
 
-	std::string content(reinterpret_cast<const char*>(data), size);
-	lept_free(data);
-
-	return content;
+	return run_basic_nsfw(rgba_to_png(pixels, width, height));
 }
 
 dpp::json run_basic_nsfw_mp4(const std::string& file_content, const std::vector<std::size_t>& frames)
@@ -790,24 +808,7 @@ dpp::json run_basic_nsfw_mp4(const std::string& file_content, const std::vector<
 				throw std::runtime_error("image_size");
 			}
 
-			Pix* image = rgba_to_pix(pixels, width, height);
-
-			if (!image) {
-				throw std::runtime_error("pix_create_failed");
-			}
-
-			std::string png;
-
-			try {
-				png = pix_to_png(image);
-			} catch (...) {
-				pixDestroy(&image);
-				throw;
-			}
-
-			pixDestroy(&image);
-
-			const dpp::json frame_answer = run_basic_nsfw(png);
+			const dpp::json frame_answer = run_basic_nsfw_rgba(pixels, width, height);
 
 			if (first) {
 				answer = frame_answer;
@@ -844,9 +845,7 @@ dpp::json run_basic_nsfw_gif(const std::string& file_content, const std::vector<
 				throw std::runtime_error("image_size");
 			}
 
-			const std::string png = rgba_to_png(pixels, width, height);
-
-			const dpp::json frame_answer = run_basic_nsfw(png);
+			const dpp::json frame_answer = run_basic_nsfw_rgba(pixels, width, height);
 
 			if (first) {
 				answer = frame_answer;
@@ -1056,7 +1055,7 @@ dpp::json run_basic_nsfw_webp(const std::string& file_content, const std::vector
 				throw std::runtime_error("image_size");
 			}
 
-			const dpp::json frame_answer = run_basic_nsfw(rgba_to_png(pixels, width, height));
+			const dpp::json frame_answer = run_basic_nsfw_rgba(pixels, width, height);
 
 			if (first) {
 				answer = frame_answer;
@@ -1136,7 +1135,7 @@ dpp::json run_basic_nsfw_avif(const std::string& file_content, const std::vector
 				throw std::runtime_error("image_size");
 			}
 
-			const dpp::json frame_answer = run_basic_nsfw(rgba_to_png(pixels, width, height));
+			const dpp::json frame_answer = run_basic_nsfw_rgba(pixels, width, height);
 
 			if (first) {
 				answer = frame_answer;
@@ -1250,6 +1249,46 @@ dpp::json scan_all(const dpp::json& command, const std::string& hash, const std:
 	return response;
 }
 
+/**
+ * @brief One image of the batch tessd was asked to scan
+ */
+struct batch_item {
+	std::string url;
+	std::string filename;
+	std::string file_content;
+	std::string hash;
+
+	/**
+	 * @brief Frame to send instead of the hash if the fetch failed, otherwise null
+	 */
+	dpp::json error;
+};
+
+/**
+ * @brief Fetch every item at once, one thread each, and hash what was fetched
+ */
+void fetch_batch(std::vector<batch_item>& items)
+{
+	std::vector<std::thread> fetchers;
+	fetchers.reserve(items.size());
+
+	for (batch_item& item : items) {
+		fetchers.emplace_back([&item]() {
+			try {
+				if (fetch_image(item.url, item.file_content, item.error)) {
+					item.hash = sha256(item.file_content);
+				}
+			} catch (const std::exception& e) {
+				item.error = make_error("fetch", "exception", e.what());
+			}
+		});
+	}
+
+	for (std::thread& fetcher : fetchers) {
+		fetcher.join();
+	}
+}
+
 int main(int argc, char** argv)
 {
 	std::signal(SIGALRM, tessd_timeout);
@@ -1277,35 +1316,59 @@ int main(int argc, char** argv)
 		return static_cast<int>(tessd::exit_code::read);
 	}
 
-	if (!request.contains("url") || !request.at("url").is_string()) {
-		write_error("fetch", "missing_url");
+	if (!request.contains("items") || !request.at("items").is_array() || request.at("items").empty() || request.at("items").size() > max_batch_items) {
+		write_error("fetch", "invalid_items");
 		return static_cast<int>(tessd::exit_code::read);
 	}
 
-	std::string file_content;
-	std::string filename;
-
-	if (request.contains("filename") && request.at("filename").is_string()) {
-		filename = request.at("filename").get<std::string>();
+	if (request.contains("nsfwd_socket") && request.at("nsfwd_socket").is_string()) {
+		set_nsfw_socket_path(request.at("nsfwd_socket").get<std::string>());
 	}
 
-	try {
-		if (!fetch_image(request.at("url").get<std::string>(), file_content)) {
+	std::vector<batch_item> items;
+
+	for (const dpp::json& entry : request.at("items")) {
+		if (!entry.is_object() || !entry.contains("url") || !entry.at("url").is_string()) {
+			write_error("fetch", "missing_url");
 			return static_cast<int>(tessd::exit_code::read);
 		}
-	} catch (const std::exception& e) {
-		write_error("fetch", "exception", e.what());
-		return static_cast<int>(tessd::exit_code::read);
+
+		batch_item& item = items.emplace_back();
+		item.url = entry.at("url").get<std::string>();
+
+		if (entry.contains("filename") && entry.at("filename").is_string()) {
+			item.filename = entry.at("filename").get<std::string>();
+		}
 	}
 
-	const std::string hash = sha256(file_content);
+	fetch_batch(items);
 
-	proc::write_frame({
-		{"stage", "hash"},
-		{"status", "ok"},
-		{"hash", hash},
-		{"size", file_content.size()}
-	});
+	bool fetched = false;
+
+	for (size_t index = 0; index < items.size(); ++index) {
+		if (items[index].hash.empty()) {
+			dpp::json error = items[index].error.is_null() ? make_error("fetch", "download_failed") : items[index].error;
+			error["item"] = index;
+			proc::write_frame(error);
+			continue;
+		}
+
+		fetched = true;
+		proc::write_frame({
+			{"stage", "hash"},
+			{"status", "ok"},
+			{"item", index},
+			{"hash", items[index].hash},
+			{"size", items[index].file_content.size()}
+		});
+	}
+
+	if (!fetched) {
+		return static_cast<int>(tessd::exit_code::read);
+	}
+
+	/* Each scan, and the wait before it, gets the time limit a single image has */
+	alarm(60);
 
 	dpp::json command;
 
@@ -1324,16 +1387,52 @@ int main(int argc, char** argv)
 		return static_cast<int>(tessd::exit_code::no_error);
 	}
 
-	if (action != "continue") {
+	if (action != "continue" || !command.contains("items") || !command.at("items").is_array()) {
 		write_error("command", "invalid_action");
 		return static_cast<int>(tessd::exit_code::read);
 	}
 
-	try {
-		proc::write_frame(scan_all(command, hash, file_content, filename));
-	} catch (const std::exception& e) {
-		write_error("scan", "exception", e.what());
-		return static_cast<int>(tessd::exit_code::read);
+	/* The settings in the continue frame are shared by every item. Each item brings its
+	 * own scan cache, and after each result the bot says whether to go on to the next.
+	 */
+	dpp::json scan_list = std::move(command["items"]);
+	command.erase("items");
+
+	for (size_t position = 0; position < scan_list.size(); ++position) {
+		const dpp::json& entry = scan_list[position];
+
+		if (!entry.is_object() || !entry.contains("item") || !entry.at("item").is_number_unsigned() || entry.at("item").get<size_t>() >= items.size() || items[entry.at("item").get<size_t>()].hash.empty()) {
+			write_error("command", "invalid_item");
+			return static_cast<int>(tessd::exit_code::read);
+		}
+
+		const size_t index = entry.at("item").get<size_t>();
+		batch_item& item = items[index];
+		command["cache"] = entry.contains("cache") ? entry.at("cache") : dpp::json::object();
+
+		try {
+			dpp::json response = scan_all(command, item.hash, item.file_content, item.filename);
+			response["item"] = index;
+			proc::write_frame(response);
+		} catch (const std::exception& e) {
+			dpp::json error = make_error("scan", "exception", e.what());
+			error["item"] = index;
+			proc::write_frame(error);
+		}
+
+		std::string().swap(item.file_content);
+
+		if (position + 1 == scan_list.size()) {
+			break;
+		}
+
+		alarm(60);
+
+		dpp::json next;
+
+		if (!proc::read_frame(std::cin, next) || !next.contains("action") || next.at("action") != "next") {
+			return static_cast<int>(tessd::exit_code::no_error);
+		}
 	}
 
 	return static_cast<int>(tessd::exit_code::no_error);
@@ -0,0 +1,278 @@
+/************************************************************************************
+ * 
+ * Beholder, the image filtering bot
+ *
+ * Copyright 2019,2023,2026 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <beholder/tessd.h>
+#include <nsfwd/socket_protocol.h>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+	/**
+	 * @brief Connection to nsfwd, kept open for every request made by this tessd process.
+	 * -1 if not yet connected, -2 if the socket is unavailable and HTTP should be used.
+	 */
+	int nsfwd_fd = -1;
+
+	/**
+	 * @brief Socket path sent by the bot, empty if the socket is disabled
+	 */
+	std::string nsfwd_path{nsfw_socket::default_path};
+
+	bool connect_nsfwd()
+	{
+		if (nsfwd_fd >= 0) {
+			return true;
+		}
+
+		if (nsfwd_fd == -2 || nsfwd_path.empty() || nsfwd_path.size() >= sizeof(sockaddr_un::sun_path)) {
+			return false;
+		}
+
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, nsfwd_path.c_str(), sizeof(address.sun_path) - 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+			if (fd >= 0) {
+				close(fd);
+			}
+
+			nsfwd_fd = -2;
+			return false;
+		}
+
+		nsfwd_fd = fd;
+		return true;
+	}
+
+	void disconnect_nsfwd()
+	{
+		if (nsfwd_fd >= 0) {
+			close(nsfwd_fd);
+		}
+
+		nsfwd_fd = -1;
+	}
+
+	bool send_all(int fd, const void* buffer, size_t length)
+	{
+		const auto* in = static_cast<const char*>(buffer);
+
+		while (length > 0) {
+			ssize_t w = send(fd, in, length, MSG_NOSIGNAL);
+
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (w <= 0) {
+				return false;
+			}
+
+			in += w;
+			length -= w;
+		}
+
+		return true;
+	}
+
+	bool read_all(int fd, void* buffer, size_t length)
+	{
+		auto* out = static_cast<char*>(buffer);
+
+		while (length > 0) {
+			ssize_t r = read(fd, out, length);
+
+			if (r < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (r <= 0) {
+				return false;
+			}
+
+			out += r;
+			length -= r;
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief Send the header, with a descriptor attached if passed_fd is not -1
+	 */
+	bool send_header(int fd, const nsfw_socket::request_header& header, int passed_fd)
+	{
+		iovec iov{ const_cast<nsfw_socket::request_header*>(&header), sizeof(header) };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if (passed_fd >= 0) {
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsghdr* c = CMSG_FIRSTHDR(&msg);
+			c->cmsg_level = SOL_SOCKET;
+			c->cmsg_type = SCM_RIGHTS;
+			c->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(c), &passed_fd, sizeof(int));
+		}
+
+		ssize_t w;
+
+		do {
+			w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		} while (w < 0 && errno == EINTR);
+
+		return w > 0 && (static_cast<size_t>(w) == sizeof(header) || send_all(fd, reinterpret_cast<const char*>(&header) + w, sizeof(header) - w));
+	}
+
+	/**
+	 * @brief Make one request over the socket.
+	 *
+	 * @return The scores, or std::nullopt if the socket could not be used and the caller
+	 * should fall back to HTTP. Errors reported by nsfwd itself are thrown.
+	 */
+	std::optional<dpp::json> socket_request(const nsfw_socket::request_header& header, std::string_view body, int passed_fd)
+	{
+		/* A connection left over from a previous request may have been closed by an nsfwd
+		 * restart, so one failed attempt on an existing connection is retried on a new one.
+		 */
+		for (int attempt = 0; attempt < 2; ++attempt) {
+			const bool reused = nsfwd_fd >= 0;
+
+			if (!connect_nsfwd()) {
+				return std::nullopt;
+			}
+
+			nsfw_socket::response_header response;
+
+			if (send_header(nsfwd_fd, header, passed_fd) && send_all(nsfwd_fd, body.data(), body.size()) && read_all(nsfwd_fd, &response, sizeof(response)) && response.magic == nsfw_socket::magic) {
+				if (response.status != 0) {
+					std::string error(std::min<uint32_t>(response.error_length, 1024), '\0');
+
+					if (!read_all(nsfwd_fd, error.data(), error.size()) || response.error_length != error.size()) {
+						disconnect_nsfwd();
+					}
+
+					throw std::runtime_error("NSFW API Error: " + error);
+				}
+
+				return dpp::json{
+					{"drawing", response.scores[0]},
+					{"hentai", response.scores[1]},
+					{"neutral", response.scores[2]},
+					{"porn", response.scores[3]},
+					{"sexy", response.scores[4]},
+				};
+			}
+
+			disconnect_nsfwd();
+
+			if (!reused) {
+				break;
+			}
+		}
+
+		return std::nullopt;
+	}
+}
+
+void set_nsfw_socket_path(const std::string& path)
+{
+	disconnect_nsfwd();
+	nsfwd_path = path;
+}
+
+std::optional<dpp::json> nsfw_socket_classify(std::string_view file_content)
+{
+	if (file_content.empty() || file_content.size() > nsfw_socket::max_length) {
+		return std::nullopt;
+	}
+
+	nsfw_socket::request_header header;
+	header.type = nsfw_socket::request_encoded;
+	header.length = file_content.size();
+
+	return socket_request(header, file_content, -1);
+}
+
+std::optional<dpp::json> nsfw_socket_classify_rgba(const unsigned char* pixels, int width, int height)
+{
+	if (!pixels || width <= 0 || height <= 0 || static_cast<uint64_t>(width) * static_cast<uint64_t>(height) > nsfw_socket::max_pixels) {
+		return std::nullopt;
+	}
+
+	if (!connect_nsfwd()) {
+		return std::nullopt;
+	}
+
+	const size_t length = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
+
+	int memfd = memfd_create("beholder-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (memfd < 0) {
+		return std::nullopt;
+	}
+
+	if (ftruncate(memfd, static_cast<off_t>(length)) != 0) {
+		close(memfd);
+		return std::nullopt;
+	}
+
+	void* shared = mmap(nullptr, length, PROT_WRITE, MAP_SHARED, memfd, 0);
+
+	if (shared == MAP_FAILED) {
+		close(memfd);
+		return std::nullopt;
+	}
+
+	memcpy(shared, pixels, length);
+	munmap(shared, length);
+
+	/* nsfwd only maps sealed memfds, so the pixels can't be changed or truncated under it */
+	if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) != 0) {
+		close(memfd);
+		return std::nullopt;
+	}
+
+	nsfw_socket::request_header header;
+	header.type = nsfw_socket::request_rgba;
+	header.width = static_cast<uint32_t>(width);
+	header.height = static_cast<uint32_t>(height);
+	header.length = length;
+
+	try {
+		std::optional<dpp::json> answer = socket_request(header, {}, memfd);
+		close(memfd);
+		return answer;
+	} catch (...) {
+		close(memfd);
+		throw;
+	}
+}
@@ -18,10 +18,9 @@
  *
  ************************************************************************************/
 #include <openssl/evp.h>
+#include <beholder/hex.h>
 #include <string>
 #include <vector>
-#include <iomanip>
-#include <sstream>
 #include <memory>
 
 using evp_ctx = std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)>;
@@ -36,11 +35,6 @@ std::string sha256(const std::string &buffer) {
 	unsigned int len{0};
 	EVP_DigestFinal_ex(evpCtx.get(), hash.data(), &len);
 
-	std::stringstream out;
-	for (size_t i = 0; i < hash.size(); i++) {
-		out << std::setfill('0') << std::setw(2) << std::hex << int(hash[i]);
-	}
-
-	return out.str();
+	return hex::encode(hash.data(), hash.size());
 }
 